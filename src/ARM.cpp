@@ -21,8 +21,12 @@
 #include "DSi.h"
 #include "ARM.h"
 #include "ARMInterpreter.h"
+#include "ARMInterpreter_ALU.h"
+#include "ARMInterpreter_Branch.h"
+#include "ARMInterpreter_LoadStore.h"
 #include "Config.h"
 #include "AREngine.h"
+#include "BIOS_HLE.h"
 #include "ARMJIT.h"
 #include "Config.h"
 
@@ -102,6 +106,7 @@ void ARM::Reset()
     Halted = 0;
 
     IRQ = 0;
+    IdleLoop = 0;
 
     for (int i = 0; i < 16; i++)
         R[i] = 0;
@@ -111,11 +116,14 @@ void ARM::Reset()
     ExceptionBase = Num ? 0x00000000 : 0xFFFF0000;
 
     CodeMem.Mem = NULL;
+    ARMInterpreter::ResetIdleLoopCache(this);
 
 #ifdef JIT_ENABLED
     FastBlockLookup = NULL;
     FastBlockLookupStart = 0;
     FastBlockLookupSize = 0;
+    LoopBlockAddr = 0;
+    LoopIterations = 0;
 #endif
 
     // zorp
@@ -228,6 +236,17 @@ void ARMv5::DoSavestate(Savestate* file)
 }
 
 
+u32 ARM::PeekCode(u32 addr, bool thumb)
+{
+    if (!Num && addr < ((ARMv5*)this)->ITCMSize)
+    {
+        u8* ptr = &((ARMv5*)this)->ITCM[addr & (ITCMPhysicalSize - 1)];
+        return thumb ? *(u16*)ptr : *(u32*)ptr;
+    }
+
+    return thumb ? BusRead16(addr) : BusRead32(addr);
+}
+
 void ARM::SetupCodeMem(u32 addr)
 {
     if (!Num)
@@ -251,6 +270,9 @@ void ARMv5::JumpTo(u32 addr, bool restorecpsr)
 
         if (CPSR & 0x20)    addr |= 0x1;
         else                addr &= ~0x1;
+
+        if (Config::BIOS_HLE == 2)
+            BIOS_HLE::CheckReturn(this, addr);
     }
 
     // aging cart debug crap
@@ -320,6 +342,9 @@ void ARMv4::JumpTo(u32 addr, bool restorecpsr)
 
         if (CPSR & 0x20)    addr |= 0x1;
         else                addr &= ~0x1;
+
+        if (Config::BIOS_HLE == 2)
+            BIOS_HLE::CheckReturn(this, addr);
     }
 
     u32 oldregion = R[15] >> 23;
@@ -535,6 +560,71 @@ void ARMv5::DataAbort()
     JumpTo(ExceptionBase + 0x10);
 }
 
+#ifdef THREADEDINTERP_ENABLED
+
+// handlers that get their own dispatch label in the threaded interpreter
+#define INTERP_ALU(X, name, s) \
+    X(A_##name##_REG_LSL_IMM##s) X(A_##name##_REG_LSR_IMM##s) X(A_##name##_REG_ASR_IMM##s) X(A_##name##_REG_ROR_IMM##s) \
+    X(A_##name##_REG_LSL_REG##s) X(A_##name##_REG_LSR_REG##s) X(A_##name##_REG_ASR_REG##s) X(A_##name##_REG_ROR_REG##s) X(A_##name##_IMM##s)
+#define INTERP_ALU_OP(X, name) INTERP_ALU(X, name,) INTERP_ALU(X, name, _S)
+#define INTERP_MEM_WB(X, name) \
+    X(A_##name##_REG_LSL) X(A_##name##_REG_LSR) X(A_##name##_REG_ASR) X(A_##name##_REG_ROR) X(A_##name##_IMM) \
+    X(A_##name##_POST_REG_LSL) X(A_##name##_POST_REG_LSR) X(A_##name##_POST_REG_ASR) X(A_##name##_POST_REG_ROR) X(A_##name##_POST_IMM)
+#define INTERP_MEM_HD(X, name) \
+    X(A_##name##_REG) X(A_##name##_IMM) X(A_##name##_POST_REG) X(A_##name##_POST_IMM)
+
+#define INTERP_ARM_HANDLERS(X) \
+    INTERP_ALU_OP(X, AND) INTERP_ALU_OP(X, EOR) INTERP_ALU_OP(X, SUB) INTERP_ALU_OP(X, RSB) \
+    INTERP_ALU_OP(X, ADD) INTERP_ALU_OP(X, ADC) INTERP_ALU_OP(X, SBC) INTERP_ALU_OP(X, RSC) \
+    INTERP_ALU_OP(X, ORR) INTERP_ALU_OP(X, MOV) INTERP_ALU_OP(X, BIC) INTERP_ALU_OP(X, MVN) \
+    INTERP_ALU(X, TST,) INTERP_ALU(X, TEQ,) INTERP_ALU(X, CMP,) INTERP_ALU(X, CMN,) \
+    X(A_MOV_REG_LSL_IMM_DBG) \
+    X(A_MUL) X(A_MLA) X(A_UMULL) X(A_UMLAL) X(A_SMULL) X(A_SMLAL) X(A_SMLAxy) X(A_SMLAWy) X(A_SMULWy) X(A_SMLALxy) X(A_SMULxy) \
+    X(A_CLZ) X(A_QADD) X(A_QSUB) X(A_QDADD) X(A_QDSUB) \
+    INTERP_MEM_WB(X, STR) INTERP_MEM_WB(X, STRB) INTERP_MEM_WB(X, LDR) INTERP_MEM_WB(X, LDRB) \
+    INTERP_MEM_HD(X, STRH) INTERP_MEM_HD(X, LDRD) INTERP_MEM_HD(X, STRD) \
+    INTERP_MEM_HD(X, LDRH) INTERP_MEM_HD(X, LDRSB) INTERP_MEM_HD(X, LDRSH) \
+    X(A_SWP) X(A_SWPB) X(A_LDM) X(A_STM) \
+    X(A_B) X(A_BL) X(A_BX) X(A_BLX_REG) \
+    X(A_MSR_IMM) X(A_MSR_REG) X(A_MRS) X(A_MCR) X(A_MRC) X(A_SVC)
+
+#define INTERP_THUMB_HANDLERS(X) \
+    X(T_LSL_IMM) X(T_LSR_IMM) X(T_ASR_IMM) \
+    X(T_ADD_REG_) X(T_SUB_REG_) X(T_ADD_IMM_) X(T_SUB_IMM_) \
+    X(T_MOV_IMM) X(T_CMP_IMM) X(T_ADD_IMM) X(T_SUB_IMM) \
+    X(T_AND_REG) X(T_EOR_REG) X(T_LSL_REG) X(T_LSR_REG) X(T_ASR_REG) \
+    X(T_ADC_REG) X(T_SBC_REG) X(T_ROR_REG) X(T_TST_REG) X(T_NEG_REG) \
+    X(T_CMP_REG) X(T_CMN_REG) X(T_ORR_REG) X(T_MUL_REG) X(T_BIC_REG) X(T_MVN_REG) \
+    X(T_ADD_HIREG) X(T_CMP_HIREG) X(T_MOV_HIREG) \
+    X(T_ADD_PCREL) X(T_ADD_SPREL) X(T_ADD_SP) \
+    X(T_LDR_PCREL) X(T_STR_REG) X(T_STRB_REG) X(T_LDR_REG) X(T_LDRB_REG) X(T_STRH_REG) \
+    X(T_LDRSB_REG) X(T_LDRH_REG) X(T_LDRSH_REG) X(T_STR_IMM) X(T_LDR_IMM) X(T_STRB_IMM) \
+    X(T_LDRB_IMM) X(T_STRH_IMM) X(T_LDRH_IMM) X(T_STR_SPREL) X(T_LDR_SPREL) \
+    X(T_PUSH) X(T_POP) X(T_LDMIA) X(T_STMIA) \
+    X(T_BCOND) X(T_BX) X(T_BLX_REG) X(T_B) X(T_BL_LONG_1) X(T_BL_LONG_2) \
+    X(T_SVC)
+
+typedef void (*InterpreterFunc)(ARM* cpu);
+
+void BuildDispatchTable(void** dispatch, InterpreterFunc* table, int size,
+                        void* const* labels, const InterpreterFunc* funcs, int count, void* fallback)
+{
+    for (int i = 0; i < size; i++)
+    {
+        dispatch[i] = fallback;
+        for (int j = 0; j < count; j++)
+        {
+            if (funcs[j] == table[i])
+            {
+                dispatch[i] = labels[j];
+                break;
+            }
+        }
+    }
+}
+
+#endif
+
 void ARMv5::Execute()
 {
     if (Halted)
@@ -556,6 +646,34 @@ void ARMv5::Execute()
         }
     }
 
+#ifdef THREADEDINTERP_ENABLED
+#define TD_TIMESTAMP NDS::ARM9Timestamp
+#define TD_TARGET NDS::ARM9Target
+#define TD_PREFETCH_THUMB() \
+    R[15] += 2; \
+    CurInstr = NextInstr[0]; \
+    NextInstr[0] = NextInstr[1]; \
+    if (R[15] & 0x2) { NextInstr[1] >>= 16; CodeCycles = 0; } \
+    else             NextInstr[1] = CodeRead32(R[15], false);
+#define TD_PREFETCH_ARM() \
+    R[15] += 4; \
+    CurInstr = NextInstr[0]; \
+    NextInstr[0] = NextInstr[1]; \
+    NextInstr[1] = CodeRead32(R[15], false);
+#define TD_CONDFAILED() \
+    if ((CurInstr & 0xFE000000) == 0xFA000000) \
+        ARMInterpreter::A_BLX_IMM(this); \
+    else \
+        AddCycles_C();
+
+#include "ARM_ThreadedDispatch.h"
+
+#undef TD_TIMESTAMP
+#undef TD_TARGET
+#undef TD_PREFETCH_THUMB
+#undef TD_PREFETCH_ARM
+#undef TD_CONDFAILED
+#else
     while (NDS::ARM9Timestamp < NDS::ARM9Target)
     {
         if (CPSR & 0x20) // THUMB
@@ -593,25 +711,34 @@ void ARMv5::Execute()
                 AddCycles_C();
         }
 
-        // TODO optimize this shit!!!
-        if (Halted)
+        if (StopExecution)
         {
-            if (Halted == 1 && NDS::ARM9Timestamp < NDS::ARM9Target)
+            if (Halted)
             {
-                NDS::ARM9Timestamp = NDS::ARM9Target;
+                if (Halted == 1 && NDS::ARM9Timestamp < NDS::ARM9Target)
+                {
+                    NDS::ARM9Timestamp = NDS::ARM9Target;
+                }
+                break;
+            }
+            if (IRQ) TriggerIRQ();
+
+            if (IdleLoop)
+            {
+                // nothing will change before the end of this timeslice
+                IdleLoop = 0;
+                NDS::ARM9Timestamp += Cycles;
+                Cycles = 0;
+                if (NDS::ARM9Timestamp < NDS::ARM9Target)
+                    NDS::ARM9Timestamp = NDS::ARM9Target;
+                break;
             }
-            break;
         }
-        /*if (NDS::IF[0] & NDS::IE[0])
-        {
-            if (NDS::IME[0] & 0x1)
-                TriggerIRQ();
-        }*/
-        if (IRQ) TriggerIRQ();
 
         NDS::ARM9Timestamp += Cycles;
         Cycles = 0;
     }
+#endif
 
     if (Halted == 2)
         Halted = 0;
@@ -653,6 +780,19 @@ void ARMv5::ExecuteJIT()
 
         ARMJIT::JitBlockEntry block = ARMJIT::LookUpBlock(0, FastBlockLookup,
             instrAddr - FastBlockLookupStart, instrAddr);
+        if (!block || instrAddr != LoopBlockAddr)
+        {
+            LoopBlockAddr = instrAddr;
+            LoopIterations = 0;
+        }
+        else if (++LoopIterations == ARMJIT::kLoopProfileInterval)
+        {
+            // the block keeps jumping back to its own start
+            LoopIterations = 0;
+            if (ARMJIT::ProfileLoop(this))
+                block = NULL;
+        }
+
         if (block)
             ARM_Dispatch(this, block);
         else
@@ -683,6 +823,145 @@ void ARMv5::ExecuteJIT()
     if (Halted == 2)
         Halted = 0;
 }
+
+void ARMv5::ExecuteCached()
+{
+    if (Halted)
+    {
+        if (Halted == 2)
+        {
+            Halted = 0;
+        }
+        else if (NDS::HaltInterrupted(0))
+        {
+            Halted = 0;
+            if (NDS::IME[0] & 0x1)
+                TriggerIRQ();
+        }
+        else
+        {
+            NDS::ARM9Timestamp = NDS::ARM9Target;
+            return;
+        }
+    }
+
+    while (NDS::ARM9Timestamp < NDS::ARM9Target)
+    {
+        bool thumb = CPSR & 0x20;
+        u32 instrAddr = R[15] - (thumb ? 2 : 4);
+
+        ARMJIT::CachedInstr* instr = NULL;
+        if ((instrAddr >= FastBlockLookupStart && instrAddr < (FastBlockLookupStart + FastBlockLookupSize))
+            || ARMJIT::SetupExecutableRegion(0, instrAddr, FastBlockLookup, FastBlockLookupStart, FastBlockLookupSize))
+        {
+            instr = ARMJIT::LookUpCachedBlock(0, FastBlockLookup, instrAddr - FastBlockLookupStart, instrAddr);
+            if (!instr)
+                instr = ARMJIT::CompileCachedBlock(this);
+        }
+
+        // the block can only be used if the pipeline holds what it was decoded from
+        // which isn't the case if the code was modified after being prefetched
+        bool cached = instr && instr->Thumb == thumb
+            && instr[0].Instr == NextInstr[0] && instr[1].Instr == NextInstr[1];
+
+        ARMJIT::CachedInstr uncached;
+        if (!cached)
+        {
+            // run a single instruction the regular way
+            if (thumb)
+            {
+                R[15] += 2;
+                CurInstr = NextInstr[0];
+                NextInstr[0] = NextInstr[1];
+                if (R[15] & 0x2) { NextInstr[1] >>= 16; CodeCycles = 0; }
+                else             NextInstr[1] = CodeRead32(R[15], false);
+            }
+            else
+            {
+                R[15] += 4;
+                CurInstr = NextInstr[0];
+                NextInstr[0] = NextInstr[1];
+                NextInstr[1] = CodeRead32(R[15], false);
+            }
+
+            ARMJIT::DecodeCachedInstr(0, thumb, CurInstr, &uncached);
+            instr = &uncached;
+        }
+
+        u32 numInvalidations = ARMJIT::NumInvalidations;
+        for (;;)
+        {
+            if (cached)
+            {
+                // prefetch
+                R[15] += thumb ? 2 : 4;
+                CurInstr = instr[0].Instr;
+                NextInstr[0] = instr[1].Instr;
+                NextInstr[1] = instr[2].Instr;
+
+                // same timing as CodeRead32()
+                if (thumb && (R[15] & 0x2))
+                    CodeCycles = 0;
+                else if (R[15] < ITCMSize)
+                    CodeCycles = 1;
+                else
+                {
+                    CodeCycles = RegionCodeCycles;
+                    if (CodeCycles == 0xFF)
+                        CodeCycles = (R[15] & 0x1F) ? 1 : kCodeCacheTiming;
+                }
+            }
+
+            u32 r15 = R[15];
+
+            // actually execute
+            if (CheckCondition(instr->Cond))
+                instr->Handler(this);
+            else
+                AddCycles_C();
+
+            if (StopExecution)
+            {
+                if (Halted)
+                    break;
+                if (IRQ) TriggerIRQ();
+                if (IdleLoop)
+                    break;
+            }
+
+            NDS::ARM9Timestamp += Cycles;
+            Cycles = 0;
+
+            instr++;
+            if (!cached || !instr->Handler || R[15] != r15
+                || NDS::ARM9Timestamp >= NDS::ARM9Target
+                || ARMJIT::NumInvalidations != numInvalidations)
+                break;
+        }
+
+        if (Halted)
+        {
+            if (Halted == 1 && NDS::ARM9Timestamp < NDS::ARM9Target)
+            {
+                NDS::ARM9Timestamp = NDS::ARM9Target;
+            }
+            break;
+        }
+        if (IdleLoop)
+        {
+            // nothing will change before the end of this timeslice
+            IdleLoop = 0;
+            NDS::ARM9Timestamp += Cycles;
+            Cycles = 0;
+            if (NDS::ARM9Timestamp < NDS::ARM9Target)
+                NDS::ARM9Timestamp = NDS::ARM9Target;
+            break;
+        }
+    }
+
+    if (Halted == 2)
+        Halted = 0;
+}
 #endif
 
 void ARMv4::Execute()
@@ -706,6 +985,29 @@ void ARMv4::Execute()
         }
     }
 
+#ifdef THREADEDINTERP_ENABLED
+#define TD_TIMESTAMP NDS::ARM7Timestamp
+#define TD_TARGET NDS::ARM7Target
+#define TD_PREFETCH_THUMB() \
+    R[15] += 2; \
+    CurInstr = NextInstr[0]; \
+    NextInstr[0] = NextInstr[1]; \
+    NextInstr[1] = CodeRead16(R[15]);
+#define TD_PREFETCH_ARM() \
+    R[15] += 4; \
+    CurInstr = NextInstr[0]; \
+    NextInstr[0] = NextInstr[1]; \
+    NextInstr[1] = CodeRead32(R[15]);
+#define TD_CONDFAILED() AddCycles_C();
+
+#include "ARM_ThreadedDispatch.h"
+
+#undef TD_TIMESTAMP
+#undef TD_TARGET
+#undef TD_PREFETCH_THUMB
+#undef TD_PREFETCH_ARM
+#undef TD_CONDFAILED
+#else
     while (NDS::ARM7Timestamp < NDS::ARM7Target)
     {
         if (CPSR & 0x20) // THUMB
@@ -738,25 +1040,34 @@ void ARMv4::Execute()
                 AddCycles_C();
         }
 
-        // TODO optimize this shit!!!
-        if (Halted)
+        if (StopExecution)
         {
-            if (Halted == 1 && NDS::ARM7Timestamp < NDS::ARM7Target)
+            if (Halted)
             {
-                NDS::ARM7Timestamp = NDS::ARM7Target;
+                if (Halted == 1 && NDS::ARM7Timestamp < NDS::ARM7Target)
+                {
+                    NDS::ARM7Timestamp = NDS::ARM7Target;
+                }
+                break;
+            }
+            if (IRQ) TriggerIRQ();
+
+            if (IdleLoop)
+            {
+                // nothing will change before the end of this timeslice
+                IdleLoop = 0;
+                NDS::ARM7Timestamp += Cycles;
+                Cycles = 0;
+                if (NDS::ARM7Timestamp < NDS::ARM7Target)
+                    NDS::ARM7Timestamp = NDS::ARM7Target;
+                break;
             }
-            break;
         }
-        /*if (NDS::IF[1] & NDS::IE[1])
-        {
-            if (NDS::IME[1] & 0x1)
-                TriggerIRQ();
-        }*/
-        if (IRQ) TriggerIRQ();
 
         NDS::ARM7Timestamp += Cycles;
         Cycles = 0;
     }
+#endif
 
     if (Halted == 2)
         Halted = 0;
@@ -804,6 +1115,19 @@ void ARMv4::ExecuteJIT()
 
         ARMJIT::JitBlockEntry block = ARMJIT::LookUpBlock(1, FastBlockLookup,
             instrAddr - FastBlockLookupStart, instrAddr);
+        if (!block || instrAddr != LoopBlockAddr)
+        {
+            LoopBlockAddr = instrAddr;
+            LoopIterations = 0;
+        }
+        else if (++LoopIterations == ARMJIT::kLoopProfileInterval)
+        {
+            // the block keeps jumping back to its own start
+            LoopIterations = 0;
+            if (ARMJIT::ProfileLoop(this))
+                block = NULL;
+        }
+
         if (block)
             ARM_Dispatch(this, block);
         else
@@ -839,6 +1163,135 @@ void ARMv4::ExecuteJIT()
         Halted = 2;
     }
 }
+
+void ARMv4::ExecuteCached()
+{
+    if (Halted)
+    {
+        if (Halted == 2)
+        {
+            Halted = 0;
+        }
+        else if (NDS::HaltInterrupted(1))
+        {
+            Halted = 0;
+            if (NDS::IME[1] & 0x1)
+                TriggerIRQ();
+        }
+        else
+        {
+            NDS::ARM7Timestamp = NDS::ARM7Target;
+            return;
+        }
+    }
+
+    while (NDS::ARM7Timestamp < NDS::ARM7Target)
+    {
+        bool thumb = CPSR & 0x20;
+        u32 instrAddr = R[15] - (thumb ? 2 : 4);
+
+        ARMJIT::CachedInstr* instr = NULL;
+        if ((instrAddr >= FastBlockLookupStart && instrAddr < (FastBlockLookupStart + FastBlockLookupSize))
+            || ARMJIT::SetupExecutableRegion(1, instrAddr, FastBlockLookup, FastBlockLookupStart, FastBlockLookupSize))
+        {
+            instr = ARMJIT::LookUpCachedBlock(1, FastBlockLookup, instrAddr - FastBlockLookupStart, instrAddr);
+            if (!instr)
+                instr = ARMJIT::CompileCachedBlock(this);
+        }
+
+        bool cached = instr && instr->Thumb == thumb
+            && instr[0].Instr == NextInstr[0] && instr[1].Instr == NextInstr[1];
+
+        ARMJIT::CachedInstr uncached;
+        if (!cached)
+        {
+            if (thumb)
+            {
+                R[15] += 2;
+                CurInstr = NextInstr[0];
+                NextInstr[0] = NextInstr[1];
+                NextInstr[1] = CodeRead16(R[15]);
+            }
+            else
+            {
+                R[15] += 4;
+                CurInstr = NextInstr[0];
+                NextInstr[0] = NextInstr[1];
+                NextInstr[1] = CodeRead32(R[15]);
+            }
+
+            ARMJIT::DecodeCachedInstr(1, thumb, CurInstr, &uncached);
+            instr = &uncached;
+        }
+
+        u32 numInvalidations = ARMJIT::NumInvalidations;
+        for (;;)
+        {
+            if (cached)
+            {
+                // prefetch
+                R[15] += thumb ? 2 : 4;
+                CurInstr = instr[0].Instr;
+                NextInstr[0] = instr[1].Instr;
+                NextInstr[1] = instr[2].Instr;
+            }
+
+            u32 r15 = R[15];
+
+            // actually execute
+            if (CheckCondition(instr->Cond))
+                instr->Handler(this);
+            else
+                AddCycles_C();
+
+            if (StopExecution)
+            {
+                if (Halted)
+                    break;
+                if (IRQ) TriggerIRQ();
+                if (IdleLoop)
+                    break;
+            }
+
+            NDS::ARM7Timestamp += Cycles;
+            Cycles = 0;
+
+            instr++;
+            if (!cached || !instr->Handler || R[15] != r15
+                || NDS::ARM7Timestamp >= NDS::ARM7Target
+                || ARMJIT::NumInvalidations != numInvalidations)
+                break;
+        }
+
+        if (Halted)
+        {
+            if (Halted == 1 && NDS::ARM7Timestamp < NDS::ARM7Target)
+            {
+                NDS::ARM7Timestamp = NDS::ARM7Target;
+            }
+            break;
+        }
+        if (IdleLoop)
+        {
+            // nothing will change before the end of this timeslice
+            IdleLoop = 0;
+            NDS::ARM7Timestamp += Cycles;
+            Cycles = 0;
+            if (NDS::ARM7Timestamp < NDS::ARM7Target)
+                NDS::ARM7Timestamp = NDS::ARM7Target;
+            break;
+        }
+    }
+
+    if (Halted == 2)
+        Halted = 0;
+
+    if (Halted == 4)
+    {
+        DSi::SoftReset();
+        Halted = 2;
+    }
+}
 #endif
 
 void ARMv5::FillPipeline()
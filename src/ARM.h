@@ -38,6 +38,14 @@ enum
 const u32 ITCMPhysicalSize = 0x8000;
 const u32 DTCMPhysicalSize = 0x4000;
 
+// access timing for cached regions
+// this would be an average between cache hits and cache misses
+// this was measured to be close to hardware average
+// a value of 1 would represent a perfect cache, but that causes
+// games to run too fast, causing a number of issues
+const int kDataCacheTiming = 3;//2;
+const int kCodeCacheTiming = 3;//5;
+
 class ARM
 {
 public:
@@ -62,6 +70,8 @@ public:
     virtual void Execute() = 0;
 #ifdef JIT_ENABLED
     virtual void ExecuteJIT() = 0;
+    // see Config::JIT_CachedInterpreter for why it's only in JIT builds
+    virtual void ExecuteCached() = 0;
 #endif
 
     bool CheckCondition(u32 code)
@@ -99,6 +109,9 @@ public:
 
     void SetupCodeMem(u32 addr);
 
+    // code read without any effect on timings
+    u32 PeekCode(u32 addr, bool thumb);
+
 
     virtual void DataRead8(u32 addr, u32* val) = 0;
     virtual void DataRead16(u32 addr, u32* val) = 0;
@@ -152,6 +165,10 @@ public:
 #ifdef JIT_ENABLED
     u32 FastBlockLookupStart, FastBlockLookupSize;
     u64* FastBlockLookup;
+
+    // the block which ran last and how often it did in a row
+    u32 LoopBlockAddr;
+    u32 LoopIterations;
 #endif
 
     static u32 ConditionTable[16];
@@ -187,6 +204,7 @@ public:
     void Execute();
 #ifdef JIT_ENABLED
     void ExecuteJIT();
+    void ExecuteCached();
 #endif
 
     // all code accesses are forced nonseq 32bit
@@ -317,6 +335,7 @@ public:
     void Execute();
 #ifdef JIT_ENABLED
     void ExecuteJIT();
+    void ExecuteCached();
 #endif
 
     u16 CodeRead16(u32 addr)
@@ -18,6 +18,8 @@
 
 #include <stdio.h>
 #include "NDS.h"
+#include "Config.h"
+#include "BIOS_HLE.h"
 #include "ARMInterpreter.h"
 #include "ARMInterpreter_ALU.h"
 #include "ARMInterpreter_Branch.h"
@@ -220,6 +222,9 @@ void A_MRC(ARM* cpu)
 
 void A_SVC(ARM* cpu)
 {
+    if (Config::BIOS_HLE && BIOS_HLE::HandleSWI(cpu, (cpu->CurInstr >> 16) & 0xFF))
+        return;
+
     u32 oldcpsr = cpu->CPSR;
     cpu->CPSR &= ~0xBF;
     cpu->CPSR |= 0x93;
@@ -232,6 +237,9 @@ void A_SVC(ARM* cpu)
 
 void T_SVC(ARM* cpu)
 {
+    if (Config::BIOS_HLE && BIOS_HLE::HandleSWI(cpu, cpu->CurInstr & 0xFF))
+        return;
+
     u32 oldcpsr = cpu->CPSR;
     cpu->CPSR &= ~0xBF;
     cpu->CPSR |= 0x93;
@@ -39,6 +39,8 @@ void T_SVC(ARM* cpu);
 
 void A_BLX_IMM(ARM* cpu); // I'm a special one look at me
 
+void ResetIdleLoopCache(ARM* cpu);
+
 }
 
 #endif // ARMINTERPRETER_H
@@ -17,16 +17,133 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include "ARM.h"
+#include "ARM_InstrInfo.h"
+#include "Config.h"
 
 
 namespace ARMInterpreter
 {
 
+// idle loop detection
+// a loop is idle when it doesn't write to memory and when no iteration depends
+// on the previous one (same rules as ARMJIT::IsIdleLoop()). such a loop spins
+// until something else (IRQ, DMA, the other CPU, a scheduler event) changes the
+// values it reads, so the CPU can skip straight to the end of its timeslice.
+//
+// results are cached per branch address. idle loops also keep a checksum of
+// their code so that they aren't skipped anymore once overwritten.
+
+const u32 kIdleLoopCacheSize = 256;
+const u32 kIdleLoopMaxLength = 16;
+
+struct IdleLoopEntry
+{
+    u32 BranchAddr; // bit0 set for THUMB code
+    u32 Target;
+    u32 Checksum;
+    bool Idle;
+};
+
+IdleLoopEntry IdleLoopCache[2][kIdleLoopCacheSize];
+
+void ResetIdleLoopCache(ARM* cpu)
+{
+    memset(IdleLoopCache[cpu->Num], 0, sizeof(IdleLoopCache[0]));
+}
+
+bool IdleLoopChecksum(ARM* cpu, bool thumb, u32 target, u32 count, u32* checksum)
+{
+    // never read I/O registers from here
+    if ((target >> 24) == 0x04)
+        return false;
+
+    u32 sum = 0;
+    for (u32 i = 0; i < count; i++)
+        sum = (sum * 31) + cpu->PeekCode(target + (i << (thumb ? 1 : 2)), thumb);
+
+    *checksum = sum;
+    return true;
+}
+
+bool AnalyseIdleLoop(ARM* cpu, bool thumb, u32 target, u32 count)
+{
+    u16 regsWrittenTo = 0;
+    u16 regsDisallowedToWrite = 0;
+    for (u32 i = 0; i < count; i++)
+    {
+        u32 instr = cpu->PeekCode(target + (i << (thumb ? 1 : 2)), thumb);
+        ARMInstrInfo::Info info = ARMInstrInfo::Decode(thumb, cpu->Num, instr);
+
+        if (info.SpecialKind == ARMInstrInfo::special_WriteMem)
+            return false;
+        if (!thumb && info.Kind >= ARMInstrInfo::ak_MSR_IMM && info.Kind <= ARMInstrInfo::ak_MRC)
+            return false;
+        if (i < count - 1 && info.Branches())
+            return false;
+
+        u16 srcRegs = info.SrcRegs & ~(1 << 15);
+        u16 dstRegs = info.DstRegs & ~(1 << 15);
+
+        regsDisallowedToWrite |= srcRegs & ~regsWrittenTo;
+
+        if (dstRegs & regsDisallowedToWrite)
+            return false;
+        regsWrittenTo |= dstRegs;
+    }
+    return true;
+}
+
+// called when a conditional branch jumps backwards
+// skipping changes the phase of the timeslices, so it's opt-in (Config::SkipIdle)
+void CheckIdleLoop(ARM* cpu, u32 branchaddr, u32 target, bool thumb)
+{
+    if (!Config::SkipIdle)
+        return;
+
+#ifdef JIT_ENABLED
+    // the JIT does its own detection
+    if (Config::JIT_Enable)
+        return;
+#endif
+
+    u32 count = ((branchaddr - target) >> (thumb ? 1 : 2)) + 1;
+    if (count > kIdleLoopMaxLength)
+        return;
+
+    u32 key = branchaddr | (thumb ? 1 : 0);
+    IdleLoopEntry& entry = IdleLoopCache[cpu->Num][(branchaddr >> 1) & (kIdleLoopCacheSize - 1)];
+
+    u32 checksum;
+    if (entry.BranchAddr != key || entry.Target != target)
+    {
+        entry.BranchAddr = key;
+        entry.Target = target;
+        entry.Idle = IdleLoopChecksum(cpu, thumb, target, count, &entry.Checksum)
+            && AnalyseIdleLoop(cpu, thumb, target, count);
+    }
+    else if (!entry.Idle)
+    {
+        return;
+    }
+    else if (!IdleLoopChecksum(cpu, thumb, target, count, &checksum) || checksum != entry.Checksum)
+    {
+        // the code was changed, take another look
+        entry.Checksum = checksum;
+        entry.Idle = AnalyseIdleLoop(cpu, thumb, target, count);
+    }
+
+    if (entry.Idle)
+        cpu->IdleLoop = 1;
+}
+
 
 void A_B(ARM* cpu)
 {
     s32 offset = (s32)(cpu->CurInstr << 8) >> 6;
+    if (offset < -8 && (cpu->CurInstr >> 28) != 0xE)
+        CheckIdleLoop(cpu, cpu->R[15] - 8, cpu->R[15] + offset, false);
     cpu->JumpTo(cpu->R[15] + offset);
 }
 
@@ -64,6 +181,8 @@ void T_BCOND(ARM* cpu)
     if (cpu->CheckCondition((cpu->CurInstr >> 8) & 0xF))
     {
         s32 offset = (s32)(cpu->CurInstr << 24) >> 23;
+        if (offset < -4)
+            CheckIdleLoop(cpu, cpu->R[15] - 4, cpu->R[15] + offset, true);
         cpu->JumpTo(cpu->R[15] + offset + 1);
     }
     else
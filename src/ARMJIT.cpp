@@ -2,16 +2,22 @@
 
 #include <string.h>
 #include <assert.h>
+#include <algorithm>
 #include <unordered_map>
+#include <vector>
+#include <deque>
 
 #define XXH_STATIC_LINKING_ONLY
 #include "xxhash/xxhash.h"
 
 #include "Config.h"
+#include "Platform.h"
+#include "version.h"
 
 #include "ARMJIT_Internal.h"
 #include "ARMJIT_Memory.h"
 #include "ARMJIT_Compiler.h"
+#include "ARMJIT_PerfMap.h"
 
 #include "ARMInterpreter_ALU.h"
 #include "ARMInterpreter_LoadStore.h"
@@ -46,6 +52,58 @@ std::unordered_map<u32, JitBlock*> RestoreCandidates;
 
 TinyVector<u32> InvalidLiterals;
 
+u32 NumInvalidations;
+
+// code cache statistics
+u32 NumEvictions;
+u32 NumEvictedBlocks;
+u32 NumCacheResets;
+u32 NumLoops;
+
+// asynchronous compilation, used if Config::JIT_AsyncCompile is set
+// a block is registered as soon as it's queued, so it's invalidated like
+// any other block. it's only entered into the fast lookup table once it's
+// compiled, until then it's run by the interpreter
+struct CompileJob
+{
+    // NULL if the block got invalidated in the meantime
+    JitBlock* Block;
+
+    ARM* CPU;
+    bool Thumb;
+    int NumInstrs;
+    FetchedInstr Instrs[32];
+
+    // NULL if the code memory is full
+    JitBlockEntry EntryPoint;
+    JitBlockCode Code;
+    // registered once the block is installed
+    CodePatches Patches;
+};
+
+const int kMaxCompileJobs = 64;
+
+Platform::Thread* CompileThread;
+bool CompileThreadRunning;
+Platform::Semaphore* Sema_CompileStart;
+
+Platform::Mutex* CompilerLock;
+// protects the queues below
+Platform::Mutex* CompileQueueLock;
+std::deque<CompileJob*> CompileQueue;
+std::vector<CompileJob*> FinishedCompileJobs;
+
+// everything below is only touched by the emulation thread
+std::unordered_map<JitBlock*, CompileJob*> PendingBlocks;
+int NumCompileJobs;
+std::vector<CompileJob*> InstallList;
+
+// instructions of all cached interpreter blocks, in order of compilation
+// the whole block cache is reset once it's full
+const u32 kCachedInstrsSize = 1024 * 1024;
+CachedInstr CachedInstrs[kCachedInstrsSize];
+u32 CachedInstrsUsed;
+
 AddressRange CodeIndexITCM[ITCMPhysicalSize / 512];
 AddressRange CodeIndexMainRAM[NDS::MainRAMMaxSize / 512];
 AddressRange CodeIndexSWRAM[NDS::SharedWRAMSize / 512];
@@ -289,16 +347,354 @@ void SlowBlockTransfer7(u32 addr, u64* data, u32 num)
 INSTANTIATE_SLOWMEM(0)
 INSTANTIATE_SLOWMEM(1)
 
+void CompileThreadFunc()
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_CompileStart);
+        if (!CompileThreadRunning) return;
+
+        // taken first, so that once the emulation thread holds it
+        // no job can be in progress
+        Platform::Mutex_Lock(CompilerLock);
+
+        Platform::Mutex_Lock(CompileQueueLock);
+        CompileJob* job = NULL;
+        if (!CompileQueue.empty())
+        {
+            job = CompileQueue.front();
+            CompileQueue.pop_front();
+        }
+        Platform::Mutex_Unlock(CompileQueueLock);
+
+        if (job)
+        {
+            job->EntryPoint = JITCompiler->CompileBlock(job->CPU, job->Thumb, job->Instrs, job->NumInstrs, &job->Code);
+            JITCompiler->TakeNewPatches(job->Patches);
+
+            Platform::Mutex_Lock(CompileQueueLock);
+            FinishedCompileJobs.push_back(job);
+            Platform::Mutex_Unlock(CompileQueueLock);
+        }
+
+        Platform::Mutex_Unlock(CompilerLock);
+    }
+}
+
+void StopCompileThread()
+{
+    if (CompileThreadRunning)
+    {
+        CompileThreadRunning = false;
+        Platform::Semaphore_Post(Sema_CompileStart);
+        Platform::Thread_Wait(CompileThread);
+        Platform::Thread_Free(CompileThread);
+    }
+}
+
+void SetupCompileThread()
+{
+    if (Config::JIT_AsyncCompile)
+    {
+        if (!CompileThreadRunning)
+        {
+            Platform::Semaphore_Reset(Sema_CompileStart);
+            CompileThreadRunning = true;
+            CompileThread = Platform::Thread_Create(CompileThreadFunc);
+        }
+    }
+    else
+    {
+        StopCompileThread();
+    }
+}
+
+void QueueCompileJob(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, JitBlock* block)
+{
+    CompileJob* job = new CompileJob();
+    job->Block = block;
+    job->CPU = cpu;
+    job->Thumb = thumb;
+    job->NumInstrs = instrsCount;
+    memcpy(job->Instrs, instrs, instrsCount * sizeof(FetchedInstr));
+    job->EntryPoint = NULL;
+
+    PendingBlocks[block] = job;
+    NumCompileJobs++;
+
+    Platform::Mutex_Lock(CompileQueueLock);
+    CompileQueue.push_back(job);
+    Platform::Mutex_Unlock(CompileQueueLock);
+
+    Platform::Semaphore_Post(Sema_CompileStart);
+}
+
+bool IsBlockPending(JitBlock* block)
+{
+    return NumCompileJobs && PendingBlocks.find(block) != PendingBlocks.end();
+}
+
+// called when a block which is still queued got invalidated
+// the job itself is deleted once it's done
+bool CancelCompileJob(JitBlock* block)
+{
+    if (!NumCompileJobs)
+        return false;
+
+    auto it = PendingBlocks.find(block);
+    if (it == PendingBlocks.end())
+        return false;
+
+    it->second->Block = NULL;
+    PendingBlocks.erase(it);
+    return true;
+}
+
+// removes a block whose code is going to be overwritten
+void EvictBlock(JitBlock* block)
+{
+    for (int j = 0; j < block->NumAddresses; j++)
+    {
+        u32 addr = block->AddressRanges()[j];
+        AddressRange* region = CodeMemRegions[addr >> 27];
+        AddressRange* range = &region[(addr & 0x7FFFFFF) / 512];
+
+        bool removed = range->Blocks.RemoveByValue(block);
+        assert(removed);
+
+        range->Code = 0;
+        for (int i = 0; i < range->Blocks.Length; i++)
+        {
+            JitBlock* other = range->Blocks[i];
+            for (int k = 0; k < other->NumAddresses; k++)
+            {
+                if (other->AddressRanges()[k] == addr)
+                {
+                    range->Code |= other->AddressMasks()[k];
+                    break;
+                }
+            }
+        }
+
+        if (range->Blocks.Length == 0
+            && !PageContainsCode(&region[(addr & 0x7FFF000) / 512]))
+        {
+            ARMJIT_Memory::SetCodeProtection(addr >> 27, addr & 0x7FFFFFF, false);
+        }
+    }
+
+    // another block at a different mirror might be in the fast lookup table
+    u64* entry = &FastBlockLookupRegions[block->StartAddrLocal >> 27][(block->StartAddrLocal & 0x7FFFFFF) / 2];
+    if ((u32)*entry == JITCompiler->SubEntryOffset(block->EntryPoint))
+        *entry = (u64)UINT32_MAX << 32;
+
+    if (block->Num == 0)
+        JitBlocks9.erase(block->StartAddr);
+    else
+        JitBlocks7.erase(block->StartAddr);
+}
+
+// makes space once the code memory is full by evicting all blocks
+// in the oldest generation. hot blocks among them are simply
+// compiled again into the newest one
+void EvictCodeGeneration()
+{
+    // no job can be compiled in the meantime
+    Platform::Mutex_Lock(CompilerLock);
+
+    int generation = JITCompiler->GetNextGeneration();
+
+    std::vector<JitBlock*> evicted;
+    for (auto it : JitBlocks9)
+    {
+        // blocks which are still queued don't have any code yet
+        if (it.second->EntryPoint && JITCompiler->GetGeneration(it.second->EntryPoint) == generation)
+            evicted.push_back(it.second);
+    }
+    for (auto it : JitBlocks7)
+    {
+        if (it.second->EntryPoint && JITCompiler->GetGeneration(it.second->EntryPoint) == generation)
+            evicted.push_back(it.second);
+    }
+    for (JitBlock* block : evicted)
+    {
+        EvictBlock(block);
+        delete block;
+    }
+    NumEvictedBlocks += evicted.size();
+
+    for (auto it = RestoreCandidates.begin(); it != RestoreCandidates.end();)
+    {
+        if (it->second->EntryPoint && JITCompiler->GetGeneration(it->second->EntryPoint) == generation)
+        {
+            delete it->second;
+            it = RestoreCandidates.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    // jobs which are done but not installed yet have to be compiled again
+    int requeued = 0;
+    Platform::Mutex_Lock(CompileQueueLock);
+    for (auto it = FinishedCompileJobs.begin(); it != FinishedCompileJobs.end();)
+    {
+        CompileJob* job = *it;
+        if (job->EntryPoint && JITCompiler->GetGeneration(job->EntryPoint) == generation)
+        {
+            job->EntryPoint = NULL;
+            CompileQueue.push_back(job);
+            it = FinishedCompileJobs.erase(it);
+            requeued++;
+        }
+        else
+        {
+            it++;
+        }
+    }
+    Platform::Mutex_Unlock(CompileQueueLock);
+
+    ARMJIT_PerfMap::EvictGeneration(generation);
+
+    JITCompiler->SwitchGeneration();
+    NumEvictions++;
+
+    Platform::Mutex_Unlock(CompilerLock);
+
+    for (int i = 0; i < requeued; i++)
+        Platform::Semaphore_Post(Sema_CompileStart);
+}
+
+void InstallCompiledBlocks()
+{
+    if (!NumCompileJobs)
+        return;
+
+    Platform::Mutex_Lock(CompileQueueLock);
+    InstallList.swap(FinishedCompileJobs);
+    Platform::Mutex_Unlock(CompileQueueLock);
+
+    std::vector<CompileJob*> outOfMemory;
+    for (CompileJob* job : InstallList)
+    {
+        JitBlock* block = job->Block;
+        if (block && !job->EntryPoint)
+        {
+            // the code memory was full, it's compiled again once there's space
+            outOfMemory.push_back(job);
+            continue;
+        }
+
+        if (block)
+        {
+            PendingBlocks.erase(block);
+
+            JITCompiler->CommitPatches(job->Patches);
+            block->EntryPoint = job->EntryPoint;
+            block->Code = job->Code;
+            ARMJIT_PerfMap::AddBlock(block);
+
+            u32 localAddr = block->StartAddrLocal;
+            u64* entry = &FastBlockLookupRegions[localAddr >> 27][(localAddr & 0x7FFFFFF) / 2];
+            *entry = ((u64)block->StartAddr | block->Num) << 32;
+            *entry |= JITCompiler->SubEntryOffset(block->EntryPoint);
+        }
+
+        delete job;
+        NumCompileJobs--;
+    }
+    InstallList.clear();
+
+    if (!outOfMemory.empty())
+    {
+        EvictCodeGeneration();
+
+        Platform::Mutex_Lock(CompileQueueLock);
+        for (CompileJob* job : outOfMemory)
+            CompileQueue.push_back(job);
+        Platform::Mutex_Unlock(CompileQueueLock);
+
+        for (size_t i = 0; i < outOfMemory.size(); i++)
+            Platform::Semaphore_Post(Sema_CompileStart);
+    }
+}
+
+// compiles all remaining jobs on this thread
+void FinishCompileJobs()
+{
+    if (!NumCompileJobs)
+        return;
+
+    Platform::Mutex_Lock(CompilerLock);
+    Platform::Mutex_Lock(CompileQueueLock);
+    while (!CompileQueue.empty())
+    {
+        CompileJob* job = CompileQueue.front();
+        CompileQueue.pop_front();
+
+        job->EntryPoint = JITCompiler->CompileBlock(job->CPU, job->Thumb, job->Instrs, job->NumInstrs, &job->Code);
+        JITCompiler->TakeNewPatches(job->Patches);
+        FinishedCompileJobs.push_back(job);
+    }
+    Platform::Mutex_Unlock(CompileQueueLock);
+    Platform::Mutex_Unlock(CompilerLock);
+
+    InstallCompiledBlocks();
+}
+
+void DiscardCompileJobs()
+{
+    if (!NumCompileJobs)
+        return;
+
+    // waits for the job which is currently being compiled
+    Platform::Mutex_Lock(CompilerLock);
+    Platform::Mutex_Lock(CompileQueueLock);
+    for (CompileJob* job : CompileQueue)
+        delete job;
+    for (CompileJob* job : FinishedCompileJobs)
+        delete job;
+    CompileQueue.clear();
+    FinishedCompileJobs.clear();
+    Platform::Mutex_Unlock(CompileQueueLock);
+    Platform::Mutex_Unlock(CompilerLock);
+
+    PendingBlocks.clear();
+    NumCompileJobs = 0;
+}
+
 void Init()
 {
     JITCompiler = new Compiler();
 
     ARMJIT_Memory::Init();
+
+    Sema_CompileStart = Platform::Semaphore_Create();
+    CompilerLock = Platform::Mutex_Create();
+    CompileQueueLock = Platform::Mutex_Create();
+    CompileThreadRunning = false;
+    NumCompileJobs = 0;
+
+    NumEvictions = 0;
+    NumEvictedBlocks = 0;
+    NumCacheResets = 0;
+    NumLoops = 0;
 }
 
 void DeInit()
 {
+    // the symbols have to stay for the profiler
+    ARMJIT_PerfMap::Close();
+
     ResetBlockCache();
+    StopCompileThread();
+
+    Platform::Semaphore_Free(Sema_CompileStart);
+    Platform::Mutex_Free(CompilerLock);
+    Platform::Mutex_Free(CompileQueueLock);
+
     ARMJIT_Memory::DeInit();
 
     delete JITCompiler;
@@ -309,6 +705,9 @@ void Reset()
     ResetBlockCache();
 
     ARMJIT_Memory::Reset();
+
+    SetupCompileThread();
+    ARMJIT_PerfMap::Setup();
 }
 
 void FloodFillSetFlags(FetchedInstr instrs[], int start, u8 flags)
@@ -340,6 +739,8 @@ bool DecodeLiteral(bool thumb, const FetchedInstr& instr, u32& addr)
             addr = (instr.Addr + 8) + ((instr.Instr & 0xFFF) * (instr.Instr & (1 << 23) ? 1 : -1));
             return true;
         case ARMInstrInfo::ak_LDRH_IMM:
+        case ARMInstrInfo::ak_LDRSB_IMM:
+        case ARMInstrInfo::ak_LDRSH_IMM:
             addr = (instr.Addr + 8) + (((instr.Instr & 0xF00) >> 4 | (instr.Instr & 0xF)) * (instr.Instr & (1 << 23) ? 1 : -1));
             return true;
         default:
@@ -356,6 +757,163 @@ bool DecodeLiteral(bool thumb, const FetchedInstr& instr, u32& addr)
     return false;
 }
 
+void LookUpJumpTimings(ARM* cpu, FetchedInstr& instr, u32 addr, u32 r15)
+{
+    u32 cycles = 0;
+
+    if (cpu->Num == 0)
+    {
+        ARMv5* cpu9 = (ARMv5*)cpu;
+
+        u32 regionCodeCycles = cpu9->MemTimings[addr >> 12][0];
+        u32 compileTimeCodeCycles = cpu9->RegionCodeCycles;
+        cpu9->RegionCodeCycles = regionCodeCycles;
+
+        bool setupRegion = (addr >> 24) != (r15 >> 24);
+        if (setupRegion)
+            cpu9->SetupCodeMem(addr);
+
+        if (addr & 0x1)
+        {
+            addr &= ~0x1;
+
+            // two-opcodes-at-once fetch
+            if (addr & 0x2)
+            {
+                cpu9->CodeRead32(addr-2, true);
+                cycles += cpu9->CodeCycles;
+                cpu9->CodeRead32(addr+2, false);
+                cycles += cpu9->CodeCycles;
+            }
+            else
+            {
+                cpu9->CodeRead32(addr, true);
+                cycles += cpu9->CodeCycles;
+            }
+        }
+        else
+        {
+            addr &= ~0x3;
+
+            cpu9->CodeRead32(addr, true);
+            cycles += cpu9->CodeCycles;
+            cpu9->CodeRead32(addr+4, false);
+            cycles += cpu9->CodeCycles;
+        }
+
+        cpu9->RegionCodeCycles = compileTimeCodeCycles;
+        if (setupRegion)
+            cpu9->SetupCodeMem(r15);
+
+        instr.JumpRegionCodeCycles = regionCodeCycles;
+    }
+    else
+    {
+        ARMv4* cpu7 = (ARMv4*)cpu;
+
+        u32 codeCycles = addr >> 15; // cheato
+
+        if (addr & 0x1)
+        {
+            addr &= ~0x1;
+            cycles += NDS::ARM7MemTimings[codeCycles][0] + NDS::ARM7MemTimings[codeCycles][1];
+        }
+        else
+        {
+            addr &= ~0x3;
+            cycles += NDS::ARM7MemTimings[codeCycles][2] + NDS::ARM7MemTimings[codeCycles][3];
+        }
+
+        cpu7->CodeRegion = r15 >> 24;
+        cpu7->CodeCycles = addr >> 15;
+
+        instr.JumpRegionCodeCycles = 0;
+    }
+
+    instr.JumpCycles = cycles;
+}
+
+// the compiler might run on another thread, so everything it needs
+// from the CPU or memory is looked up here, in the order it would do so
+void PrepareCompile(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount)
+{
+    for (int i = 0; i < instrsCount; i++)
+    {
+        FetchedInstr& instr = instrs[i];
+
+        instr.HasLiteral = false;
+        instr.LiteralValue = 0;
+        instr.JumpCycles = 0;
+        instr.JumpRegionCodeCycles = 0;
+
+        instr.DataMemRegion = cpu->Num == 0
+            ? ARMJIT_Memory::ClassifyAddress9(instr.DataRegion)
+            : ARMJIT_Memory::ClassifyAddress7(instr.DataRegion);
+
+        u32 literalAddr;
+        if (Config::JIT_LiteralOptimisations
+            && instr.Info.SpecialKind == ARMInstrInfo::special_LoadLiteral
+            && DecodeLiteral(thumb, instr, literalAddr))
+        {
+            int invalidLiteralIdx = InvalidLiterals.Find(LocaliseCodeAddress(cpu->Num, literalAddr));
+            if (invalidLiteralIdx != -1)
+            {
+                InvalidLiterals.Remove(invalidLiteralIdx);
+            }
+            else
+            {
+                // make sure arm7 bios is accessible
+                u32 tmpR15 = cpu->R[15];
+                cpu->R[15] = instr.Addr + (thumb ? 4 : 8);
+                cpu->DataRead32(literalAddr & ~0x3, &instr.LiteralValue);
+                cpu->R[15] = tmpR15;
+
+                instr.HasLiteral = true;
+            }
+        }
+
+        u32 r15 = instr.Addr + (thumb ? 4 : 8);
+        if (!thumb)
+        {
+            if (instr.Info.Kind == ARMInstrInfo::ak_B
+                || instr.Info.Kind == ARMInstrInfo::ak_BL
+                || instr.Info.Kind == ARMInstrInfo::ak_BLX_IMM)
+            {
+                u32 target = r15 + ((s32)(instr.Instr << 8) >> 6);
+                if (instr.Cond() == 0xF)
+                    target += (((instr.Instr >> 24) & 1) << 1) + 1;
+                LookUpJumpTimings(cpu, instr, target, r15);
+            }
+        }
+        else
+        {
+            switch (instr.Info.Kind)
+            {
+            case ARMInstrInfo::tk_BCOND:
+                LookUpJumpTimings(cpu, instr, r15 + ((s32)(instr.Instr << 24) >> 23) + 1, r15);
+                break;
+            case ARMInstrInfo::tk_B:
+                LookUpJumpTimings(cpu, instr, r15 + ((s32)((instr.Instr & 0x7FF) << 21) >> 20) + 1, r15);
+                break;
+            case ARMInstrInfo::tk_BL_LONG:
+                {
+                    // both halves are compiled at once
+                    r15 += 2;
+                    u32 upperPart = instr.Instr >> 16;
+                    u32 target = (r15 - 2) + ((s32)((instr.Instr & 0x7FF) << 21) >> 9);
+                    target += (upperPart & 0x7FF) << 1;
+                    if (cpu->Num == 1 || upperPart & (1 << 12))
+                        target |= 1;
+                    LookUpJumpTimings(cpu, instr, target, r15);
+                }
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
 bool DecodeBranch(bool thumb, const FetchedInstr& instr, u32& cond, bool hasLink, u32 lr, bool& link, 
     u32& linkAddr, u32& targetAddr)
 {
@@ -417,35 +975,401 @@ bool DecodeBranch(bool thumb, const FetchedInstr& instr, u32& cond, bool hasLink
     return false;
 }
 
+// how far the code after a block is followed to find out which flags it needs
+const int kFlagLivenessDepth = 8;
+
+// code in these regions only changes by being written to, which invalidates
+// the blocks depending on it. the others can be remapped under our feet
+bool IsFixedCodeRegion(int region)
+{
+    switch (region)
+    {
+    case ARMJIT_Memory::memregion_ITCM:
+    case ARMJIT_Memory::memregion_BIOS9:
+    case ARMJIT_Memory::memregion_MainRAM:
+    case ARMJIT_Memory::memregion_BIOS7:
+    case ARMJIT_Memory::memregion_WRAM7:
+    case ARMJIT_Memory::memregion_BIOS9DSi:
+    case ARMJIT_Memory::memregion_BIOS7DSi:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// returns the flags which might be read once the execution continues at addr,
+// before they're overwritten. the code which was looked at is added to the
+// address ranges of the block, so that it's invalidated once it's modified
+u8 FlagsReadAfter(ARM* cpu, bool thumb, u32 addr,
+    u32* addressRanges, u32* addressMasks, u32& numAddressRanges, u32 maxAddressRanges)
+{
+    u8 flagsRead = 0;
+    u8 flagsWritten = 0;
+    for (int j = 0; j < kFlagLivenessDepth; j++, addr += thumb ? 2 : 4)
+    {
+        int region = cpu->Num == 0
+            ? ARMJIT_Memory::ClassifyAddress9(addr)
+            : ARMJIT_Memory::ClassifyAddress7(addr);
+        if (!CodeMemRegions[region] || !IsFixedCodeRegion(region))
+            break;
+
+        u32 translatedAddr = ARMJIT_Memory::LocaliseAddress(region, cpu->Num, addr);
+        u32 translatedAddrRounded = translatedAddr & ~0x1FF;
+        u32 k = 0;
+        for (; k < numAddressRanges; k++)
+            if (addressRanges[k] == translatedAddrRounded)
+                break;
+        if (k == numAddressRanges)
+        {
+            if (numAddressRanges >= maxAddressRanges)
+                break;
+            addressRanges[numAddressRanges] = translatedAddrRounded;
+            addressMasks[numAddressRanges++] = 0;
+        }
+        addressMasks[k] |= 1 << ((translatedAddr & 0x1FF) / 16);
+
+        u32 instr = thumb && cpu->Num == 0
+            ? cpu->PeekCode(addr & ~0x3, false) >> ((addr & 0x2) * 8)
+            : cpu->PeekCode(addr, thumb);
+        ARMInstrInfo::Info info = ARMInstrInfo::Decode(thumb, cpu->Num, instr);
+
+        flagsRead |= info.ReadFlags & ~flagsWritten;
+        if (info.Branches() || info.EndBlock || !JITCompiler->CanCompile(thumb, info.Kind))
+            break;
+
+        // conditional writes don't count
+        flagsWritten |= info.WriteFlags & 0xF;
+        if (flagsWritten == 0xF)
+            return flagsRead;
+    }
+    return flagsRead | (0xF & ~flagsWritten);
+}
+
 bool IsIdleLoop(bool thumb, FetchedInstr* instrs, int instrsCount)
 {
     // see https://github.com/dolphin-emu/dolphin/blob/master/Source/Core/Core/PowerPC/PPCAnalyst.cpp#L678
     // it basically checks if one iteration of a loop depends on another
     // the rules are quite simple
 
-    JIT_DEBUGPRINT("checking potential idle loop\n");
-    u16 regsWrittenTo = 0;
-    u16 regsDisallowedToWrite = 0;
-    for (int i = 0; i < instrsCount; i++)
+    JIT_DEBUGPRINT("checking potential idle loop\n");
+    u16 regsWrittenTo = 0;
+    u16 regsDisallowedToWrite = 0;
+    for (int i = 0; i < instrsCount; i++)
+    {
+        JIT_DEBUGPRINT("instr %d %08x regs(%x %x) %x %x\n", i, instrs[i].Instr, instrs[i].Info.DstRegs, instrs[i].Info.SrcRegs, regsWrittenTo, regsDisallowedToWrite);
+        if (instrs[i].Info.SpecialKind == ARMInstrInfo::special_WriteMem)
+            return false;
+        if (!thumb && instrs[i].Info.Kind >= ARMInstrInfo::ak_MSR_IMM && instrs[i].Info.Kind <= ARMInstrInfo::ak_MRC)
+            return false;
+        if (i < instrsCount - 1 && instrs[i].Info.Branches())
+            return false;
+
+        u16 srcRegs = instrs[i].Info.SrcRegs & ~(1 << 15);
+        u16 dstRegs = instrs[i].Info.DstRegs & ~(1 << 15);
+
+        regsDisallowedToWrite |= srcRegs & ~regsWrittenTo;
+        
+        if (dstRegs & regsDisallowedToWrite)
+            return false;
+        regsWrittenTo |= dstRegs;
+    }
+    return true;
+}
+
+// a load or store of the registers to base, which is incremented
+bool DecodeBulkTransfer(bool thumb, const FetchedInstr& instr, bool& store, u32& base, u16& regs, u8& unit)
+{
+    store = instr.Info.SpecialKind == ARMInstrInfo::special_WriteMem;
+    if (!store && instr.Info.SpecialKind != ARMInstrInfo::special_LoadMem)
+        return false;
+
+    if (thumb)
+    {
+        if (instr.Info.Kind != ARMInstrInfo::tk_LDMIA && instr.Info.Kind != ARMInstrInfo::tk_STMIA)
+            return false;
+        base = instr.T_Reg(8);
+        regs = instr.Instr & 0xFF;
+        unit = 4;
+    }
+    else
+    {
+        switch (instr.Info.Kind)
+        {
+        case ARMInstrInfo::ak_LDM:
+        case ARMInstrInfo::ak_STM:
+            // only IA with writeback, without the user mode bit
+            if ((instr.Instr & 0x01E00000) != 0x00A00000)
+                return false;
+            base = instr.A_Reg(16);
+            regs = instr.Instr & 0xFFFF;
+            unit = 4;
+            break;
+        case ARMInstrInfo::ak_LDR_POST_IMM:
+        case ARMInstrInfo::ak_STR_POST_IMM:
+        case ARMInstrInfo::ak_LDRB_POST_IMM:
+        case ARMInstrInfo::ak_STRB_POST_IMM:
+            unit = (instr.Instr & (1 << 22)) ? 1 : 4;
+            // counting up, no user mode access
+            if ((instr.Instr & 0x00A00000) != 0x00800000 || (instr.Instr & 0xFFF) != unit)
+                return false;
+            base = instr.A_Reg(16);
+            regs = 1 << instr.A_Reg(12);
+            break;
+        case ARMInstrInfo::ak_LDRH_POST_IMM:
+        case ARMInstrInfo::ak_STRH_POST_IMM:
+            unit = 2;
+            if ((instr.Instr & 0x00A00000) != 0x00800000 || ((instr.Instr & 0xF) | ((instr.Instr >> 4) & 0xF0)) != unit)
+                return false;
+            base = instr.A_Reg(16);
+            regs = 1 << instr.A_Reg(12);
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return regs != 0 && !(regs & ((1 << base) | (1 << 15))) && base != 15;
+}
+
+bool DecodeBulkLoop(bool thumb, const FetchedInstr instrs[], int instrsCount, BulkLoop& loop)
+{
+    // one or two transfers, the counter or compare and the branch back
+    if (instrsCount < 3 || instrsCount > 4)
+        return false;
+
+    const FetchedInstr& branch = instrs[instrsCount - 1];
+    if (branch.Info.Kind != (thumb ? ARMInstrInfo::tk_BCOND : ARMInstrInfo::ak_B))
+        return false;
+    u32 cond = thumb ? (branch.Instr >> 8) & 0xF : branch.Cond();
+
+    memset(&loop, 0, sizeof(BulkLoop));
+    loop.Cond = cond;
+
+    u32 transfersStart, transfersEnd;
+    u32 counterReg, limitReg = 16;
+    const FetchedInstr& first = instrs[0];
+    if (!thumb && first.Info.Kind == ARMInstrInfo::ak_CMP_REG_LSL_IMM)
+    {
+        // CMP dst, end without shift, the transfers have the same condition as the branch
+        if (first.Cond() != 0xE || (first.Instr & 0xFF0) != 0
+            || (cond != 0x1 && cond != 0x3 && cond != 0xB))
+            return false;
+        counterReg = first.A_Reg(16);
+        limitReg = first.A_Reg(0);
+        transfersStart = 1;
+        transfersEnd = instrsCount - 1;
+    }
+    else
+    {
+        const FetchedInstr& sub = instrs[instrsCount - 2];
+        u32 step;
+        if (thumb && sub.Info.Kind == ARMInstrInfo::tk_SUB_IMM)
+        {
+            counterReg = sub.T_Reg(8);
+            step = sub.Instr & 0xFF;
+        }
+        else if (thumb && sub.Info.Kind == ARMInstrInfo::tk_SUB_IMM_ && sub.T_Reg(0) == sub.T_Reg(3))
+        {
+            counterReg = sub.T_Reg(0);
+            step = (sub.Instr >> 6) & 0x7;
+        }
+        else if (!thumb && sub.Info.Kind == ARMInstrInfo::ak_SUB_IMM_S && sub.Cond() == 0xE
+            && sub.A_Reg(12) == sub.A_Reg(16))
+        {
+            counterReg = sub.A_Reg(12);
+            step = ::ROR(sub.Instr & 0xFF, (sub.Instr >> 7) & 0x1E);
+        }
+        else
+            return false;
+
+        if (step == 0 || step > 0xFF
+            || (cond != 0x1 && cond != 0x2 && cond != 0x8 && cond != 0xA && cond != 0xC))
+            return false;
+        loop.Step = step;
+        transfersStart = 0;
+        transfersEnd = instrsCount - 2;
+    }
+
+    u32 transfers = transfersEnd - transfersStart;
+    if (transfers != 1 && transfers != 2)
+        return false;
+
+    for (u32 i = transfersStart; i < transfersEnd; i++)
+    {
+        if (!thumb && instrs[i].Cond() != (loop.Step ? 0xE : cond))
+            return false;
+
+        bool store;
+        u32 base;
+        u16 regs;
+        u8 unit;
+        if (!DecodeBulkTransfer(thumb, instrs[i], store, base, regs, unit))
+            return false;
+
+        // a load followed by a store of the same registers, or only a store
+        if (store != (i == transfersEnd - 1)
+            || (i > transfersStart && (regs != loop.Regs || unit != loop.Unit || base == loop.SrcReg)))
+            return false;
+
+        loop.Regs = regs;
+        loop.Unit = unit;
+        if (store)
+            loop.DstReg = base;
+        else
+            loop.SrcReg = base;
+    }
+    if (transfers == 1)
+        loop.SrcReg = 16;
+
+    // the compare has to be done with the destination
+    if (!loop.Step && counterReg != loop.DstReg)
+        return false;
+    u32 usedRegs = loop.Regs | (1 << 15);
+    if (usedRegs & (1 << loop.DstReg)
+        || (loop.SrcReg < 16 && usedRegs & (1 << loop.SrcReg))
+        || (loop.Step && (counterReg == loop.SrcReg || counterReg == loop.DstReg || usedRegs & (1 << counterReg)))
+        || (!loop.Step && (limitReg == loop.SrcReg || limitReg == loop.DstReg || usedRegs & (1 << limitReg))))
+        return false;
+
+    loop.CounterReg = loop.Step ? counterReg : limitReg;
+    return true;
+}
+
+// whether code was compiled from any part of the range
+bool RangeContainsCode(u32 localAddr, u32 size)
+{
+    AddressRange* region = CodeMemRegions[localAddr >> 27];
+    if (!region)
+        return false;
+
+    u32 start = localAddr & 0x7FFFFFF;
+    for (u32 i = start / 512; i <= (start + size - 1) / 512; i++)
+    {
+        if (region[i].Code)
+            return true;
+    }
+    return false;
+}
+
+void RunBulkLoop(ARM* cpu, u64 packedLoop, s32 iterationCycles)
+{
+    BulkLoop loop;
+    memcpy(&loop, &packedLoop, sizeof(BulkLoop));
+
+    u32 stride = loop.Unit * __builtin_popcount(loop.Regs);
+    u32 dst = cpu->R[loop.DstReg];
+    u32 src = loop.SrcReg < 16 ? cpu->R[loop.SrcReg] : 0;
+    u32 counter = cpu->R[loop.CounterReg];
+
+    // how many iterations are left, including the one which is about to start
+    u64 iterations;
+    if (loop.Step == 0)
+    {
+        // the transfers are skipped once dst reaches the end in counter
+        switch (loop.Cond)
+        {
+        case 0x1: // NE
+            if ((counter - dst) % stride)
+                return;
+            iterations = (counter - dst) / stride;
+            break;
+        case 0x3: // CC
+            iterations = dst < counter ? ((u64)(counter - dst) + stride - 1) / stride : 0;
+            break;
+        case 0xB: // LT
+            iterations = (s32)dst < (s32)counter ? ((u64)((s64)(s32)counter - (s32)dst) + stride - 1) / stride : 0;
+            break;
+        default:
+            return;
+        }
+    }
+    else
+    {
+        // the loop continues while the counter was above (or equal to) the step
+        u32 step = loop.Step;
+        switch (loop.Cond)
+        {
+        case 0x1: // NE
+            if (counter == 0 || counter % step)
+                return;
+            iterations = counter / step;
+            break;
+        case 0x2: // CS
+            iterations = counter >= step ? counter / step + 1 : 1;
+            break;
+        case 0x8: // HI
+            iterations = counter > step ? ((u64)counter + step - 1) / step : 1;
+            break;
+        case 0xA: // GE
+            iterations = (s32)counter >= (s32)step ? (s32)counter / step + 1 : 1;
+            break;
+        case 0xC: // GT
+            iterations = (s32)counter > (s32)step ? ((u64)(s32)counter + step - 1) / step : 1;
+            break;
+        default:
+            return;
+        }
+    }
+
+    // the last iteration is left to the compiled code. the loop may run past
+    // the end of the timeslice, the other CPU only catches up later, but not
+    // past the next event. like without the loop it's left in the iteration
+    // which reaches it, so all the others have to end before it
+    if (iterations < 2 || iterationCycles <= 0)
+        return;
+    u64 timestamp = (cpu->Num == 0 ? NDS::ARM9Timestamp : NDS::ARM7Timestamp) + cpu->Cycles;
+    u64 limit = NDS::NextEventTimestamp() << (cpu->Num == 0 ? NDS::ARM9ClockShift : 0);
+    if (timestamp >= limit)
+        return;
+    u64 count = std::min(iterations - 1, (limit - timestamp - 1) / iterationCycles);
+
+    u64 size = count * stride;
+    if (count == 0 || size > 0x1000000 || (dst | src) & (loop.Unit - 1))
+        return;
+
+    u32 dstLocal;
+    u8* dstMem = ARMJIT_Memory::GetHostRange(cpu->Num, dst, size, dstLocal);
+    if (!dstMem || RangeContainsCode(dstLocal, size))
+        return;
+
+    if (loop.SrcReg < 16)
     {
-        JIT_DEBUGPRINT("instr %d %08x regs(%x %x) %x %x\n", i, instrs[i].Instr, instrs[i].Info.DstRegs, instrs[i].Info.SrcRegs, regsWrittenTo, regsDisallowedToWrite);
-        if (instrs[i].Info.SpecialKind == ARMInstrInfo::special_WriteMem)
-            return false;
-        if (!thumb && instrs[i].Info.Kind >= ARMInstrInfo::ak_MSR_IMM && instrs[i].Info.Kind <= ARMInstrInfo::ak_MRC)
-            return false;
-        if (i < instrsCount - 1 && instrs[i].Info.Branches())
-            return false;
+        u32 srcLocal;
+        u8* srcMem = ARMJIT_Memory::GetHostRange(cpu->Num, src, size, srcLocal);
+        // copying one iteration after the other is only the same as
+        // memmove if the destination isn't ahead of the source
+        if (!srcMem || (dstMem > srcMem && dstMem < srcMem + size))
+            return;
 
-        u16 srcRegs = instrs[i].Info.SrcRegs & ~(1 << 15);
-        u16 dstRegs = instrs[i].Info.DstRegs & ~(1 << 15);
+        memmove(dstMem, srcMem, size);
+        cpu->R[loop.SrcReg] = src + size;
+    }
+    else
+    {
+        u8 pattern[64];
+        u32 offset = 0;
+        for (int reg = 0; reg < 15; reg++)
+        {
+            if (loop.Regs & (1 << reg))
+            {
+                memcpy(&pattern[offset], &cpu->R[reg], loop.Unit);
+                offset += loop.Unit;
+            }
+        }
 
-        regsDisallowedToWrite |= srcRegs & ~regsWrittenTo;
-        
-        if (dstRegs & regsDisallowedToWrite)
-            return false;
-        regsWrittenTo |= dstRegs;
+        if (stride == 1)
+            memset(dstMem, pattern[0], size);
+        else
+        {
+            for (u64 i = 0; i < size; i += stride)
+                memcpy(dstMem + i, pattern, stride);
+        }
     }
-    return true;
+
+    cpu->R[loop.DstReg] = dst + size;
+    if (loop.Step)
+        cpu->R[loop.CounterReg] = counter - count * loop.Step;
+    cpu->Cycles += count * iterationCycles;
 }
 
 typedef void (*InterpreterFunc)(ARM* cpu);
@@ -537,6 +1461,9 @@ InterpreterFunc InterpretTHUMB[ARMInstrInfo::tk_Count] =
 
 void RetireJitBlock(JitBlock* block)
 {
+    if (block->LoopState == loop_Hot)
+        block->LoopState = loop_Candidate;
+
     auto it = RestoreCandidates.find(block->InstrHash);
     if (it != RestoreCandidates.end())
     {
@@ -549,6 +1476,30 @@ void RetireJitBlock(JitBlock* block)
     }
 }
 
+void AddBlock(JitBlock* block)
+{
+    for (int j = 0; j < block->NumAddresses; j++)
+    {
+        u32 addr = block->AddressRanges()[j];
+        u32 mask = block->AddressMasks()[j];
+        assert(mask != 0);
+
+        AddressRange* region = CodeMemRegions[addr >> 27];
+
+        if (!PageContainsCode(&region[(addr & 0x7FFF000) / 512]))
+            ARMJIT_Memory::SetCodeProtection(addr >> 27, addr & 0x7FFFFFF, true);
+
+        AddressRange* range = &region[(addr & 0x7FFFFFF) / 512];
+        range->Code |= mask;
+        range->Blocks.Add(block);
+    }
+
+    if (block->Num == 0)
+        JitBlocks9[block->StartAddr] = block;
+    else
+        JitBlocks7[block->StartAddr] = block;
+}
+
 void CompileBlock(ARM* cpu)
 {
     bool thumb = cpu->CPSR & 0x20;
@@ -566,6 +1517,13 @@ void CompileBlock(ARM* cpu)
         printf("trying to compile non executable code? %x\n", blockAddr);
     }
 
+    InstallCompiledBlocks();
+
+    // the block is still being compiled, meanwhile it's only interpreted
+    bool interpretOnly = false;
+    // compile a hot block again, as loop
+    bool loop = false;
+
     auto& map = cpu->Num == 0 ? JitBlocks9 : JitBlocks7;
     auto existingBlockIt = map.find(blockAddr);
     if (existingBlockIt != map.end())
@@ -574,8 +1532,20 @@ void CompileBlock(ARM* cpu)
         // could be that there are two blocks at the same physical addr
         // but different mirrors
         u32 otherLocalAddr = existingBlockIt->second->StartAddrLocal;
+        bool pending = IsBlockPending(existingBlockIt->second);
 
-        if (localAddr == otherLocalAddr)
+        if (localAddr == otherLocalAddr && pending)
+        {
+            interpretOnly = true;
+        }
+        else if (localAddr == otherLocalAddr && existingBlockIt->second->LoopState == loop_Hot)
+        {
+            JitBlock* hotBlock = existingBlockIt->second;
+            EvictBlock(hotBlock);
+            delete hotBlock;
+            loop = true;
+        }
+        else if (localAddr == otherLocalAddr)
         {
             JIT_DEBUGPRINT("switching out block %x %x %x\n", localAddr, blockAddr, existingBlockIt->second->StartAddr);
 
@@ -584,10 +1554,17 @@ void CompileBlock(ARM* cpu)
             *entry |= JITCompiler->SubEntryOffset(existingBlockIt->second->EntryPoint);
             return;
         }
-
-        // some memory has been remapped
-        RetireJitBlock(existingBlockIt->second);        
-        map.erase(existingBlockIt);
+        else if (pending)
+        {
+            // some memory has been remapped
+            InvalidateByAddr(otherLocalAddr);
+        }
+        else
+        {
+            // some memory has been remapped
+            RetireJitBlock(existingBlockIt->second);        
+            map.erase(existingBlockIt);
+        }
     }
 
     FetchedInstr instrs[Config::JIT_MaxBlockSize];
@@ -614,6 +1591,10 @@ void CompileBlock(ARM* cpu)
     u32 lastSegmentStart = blockAddr;
     u32 lr;
     bool hasLink = false;
+    bool branchesToStart = false;
+    bool hasLoopBack = false;
+    // the last static branch
+    u32 branchTarget, branchCond;
 
     do
     {
@@ -761,6 +1742,8 @@ void CompileBlock(ARM* cpu)
             if (staticBranch)
             {
                 instrs[i].BranchFlags |= branch_StaticTarget;
+                branchTarget = target;
+                branchCond = cond;
 
                 bool isBackJump = false;
                 if (hasBranched)
@@ -775,6 +1758,8 @@ void CompileBlock(ARM* cpu)
                     }
                 }
 
+                bool loopBack = loop && target == blockAddr && !link;
+
                 if (cond < 0xE && target < instrs[i].Addr && target >= lastSegmentStart)
                 {
                     // we might have an idle loop
@@ -784,8 +1769,14 @@ void CompileBlock(ARM* cpu)
                         instrs[i].BranchFlags |= branch_IdleBranch;
                         JIT_DEBUGPRINT("found %s idle loop %d in block %08x\n", thumb ? "thumb" : "arm", cpu->Num, blockAddr);
                     }
+                    else if (Config::JIT_BulkLoops && backwardsOffset == i)
+                    {
+                        BulkLoop bulkLoop;
+                        if (DecodeBulkLoop(thumb, instrs, i + 1, bulkLoop))
+                            instrs[i].BranchFlags |= branch_BulkLoop;
+                    }
                 }
-                else if (hasBranched && !isBackJump && i + 1 < Config::JIT_MaxBlockSize)
+                else if (hasBranched && !isBackJump && !loopBack && i + 1 < Config::JIT_MaxBlockSize)
                 {
                     if (link)
                     {
@@ -811,9 +1802,21 @@ void CompileBlock(ARM* cpu)
                     if (cond < 0xE)
                         instrs[i].BranchFlags |= branch_FollowCondTaken;
                 }
+
+                if (target == blockAddr && !link && !(instrs[i].BranchFlags & branch_IdleBranch))
+                {
+                    branchesToStart = true;
+                    // the trace of a loop ends here, whether the branch was taken this time or not
+                    if (loopBack)
+                    {
+                        instrs[i].BranchFlags |= branch_LoopBack;
+                        instrs[i].LoopEntry = &FastBlockLookupRegions[localAddr >> 27][(localAddr & 0x7FFFFFF) / 2];
+                        hasLoopBack = true;
+                    }
+                }
             }
 
-            if (!hasBranched && cond < 0xE && i + 1 < Config::JIT_MaxBlockSize)
+            if (!hasBranched && cond < 0xE && !(instrs[i].BranchFlags & branch_LoopBack) && i + 1 < Config::JIT_MaxBlockSize)
             {
                 instrs[i].Info.EndBlock = false;
                 instrs[i].BranchFlags |= branch_FollowCondNotTaken;
@@ -822,12 +1825,48 @@ void CompileBlock(ARM* cpu)
 
         i++;
 
-        bool canCompile = JITCompiler->CanCompile(thumb, instrs[i - 1].Info.Kind);
-        bool secondaryFlagReadCond = !canCompile || (instrs[i - 1].BranchFlags & (branch_FollowCondTaken | branch_FollowCondNotTaken));
-        if (instrs[i - 1].Info.ReadFlags != 0 || secondaryFlagReadCond)
-            FloodFillSetFlags(instrs, i - 2, !secondaryFlagReadCond ? instrs[i - 1].Info.ReadFlags : 0xF);
+        // the flags also have to be there when the block is left on the path which isn't followed
+        u8 flagsRead = instrs[i - 1].Info.ReadFlags;
+        if (!JITCompiler->CanCompile(thumb, instrs[i - 1].Info.Kind))
+            flagsRead = 0xF;
+        else if (instrs[i - 1].BranchFlags & branch_FollowCondTaken)
+            flagsRead |= FlagsReadAfter(cpu, thumb, instrs[i - 1].Addr + (thumb ? 2 : 4),
+                addressRanges, addressMasks, numAddressRanges, Config::JIT_MaxBlockSize);
+        else if (instrs[i - 1].BranchFlags & branch_FollowCondNotTaken)
+            flagsRead |= (instrs[i - 1].BranchFlags & branch_StaticTarget)
+                ? FlagsReadAfter(cpu, thumb, branchTarget,
+                    addressRanges, addressMasks, numAddressRanges, Config::JIT_MaxBlockSize)
+                : 0xF;
+        if (flagsRead)
+            FloodFillSetFlags(instrs, i - 2, flagsRead);
     } while(!instrs[i - 1].Info.EndBlock && i < Config::JIT_MaxBlockSize && !cpu->Halted && (!cpu->IRQ || (cpu->CPSR & 0x80)));
 
+    if (interpretOnly)
+        return;
+
+    // the flags which are needed after the block, they're usually overwritten
+    // by the code which follows before they're read
+    u8 exitFlags = 0xF;
+    {
+        FetchedInstr& last = instrs[i - 1];
+        u32 nextAddr = last.Addr + (thumb ? 2 : 4);
+        if (!Config::JIT_BranchOptimisations
+            || !JITCompiler->CanCompile(thumb, last.Info.Kind)
+            || (last.BranchFlags & (branch_FollowCondTaken | branch_FollowCondNotTaken)))
+            exitFlags = 0xF;
+        else if (last.BranchFlags & branch_StaticTarget)
+        {
+            exitFlags = FlagsReadAfter(cpu, thumb, branchTarget,
+                addressRanges, addressMasks, numAddressRanges, Config::JIT_MaxBlockSize);
+            if (branchCond < 0xE)
+                exitFlags |= FlagsReadAfter(cpu, thumb, nextAddr,
+                    addressRanges, addressMasks, numAddressRanges, Config::JIT_MaxBlockSize);
+        }
+        else if (!last.Info.Branches() && !last.Info.EndBlock)
+            exitFlags = FlagsReadAfter(cpu, thumb, nextAddr,
+                addressRanges, addressMasks, numAddressRanges, Config::JIT_MaxBlockSize);
+    }
+
     u32 literalHash = (u32)XXH3_64bits(literalValues, numLiterals * 4);
     u32 instrHash = (u32)XXH3_64bits(instrValues, i * 4);
 
@@ -839,7 +1878,8 @@ void CompileBlock(ARM* cpu)
         prevBlock = prevBlockIt->second;
         RestoreCandidates.erase(prevBlockIt);
 
-        mayRestore = prevBlock->StartAddr == blockAddr && prevBlock->LiteralHash == literalHash;
+        mayRestore = prevBlock->Num == cpu->Num && prevBlock->StartAddr == blockAddr && prevBlock->LiteralHash == literalHash
+            && (!hasLoopBack || prevBlock->LoopState == loop_Compiled);
 
         if (mayRestore && prevBlock->NumAddresses == numAddressRanges)
         {
@@ -867,6 +1907,9 @@ void CompileBlock(ARM* cpu)
         if (prevBlock)
             delete prevBlock;
 
+        if (CompileThreadRunning && NumCompileJobs >= kMaxCompileJobs)
+            return;
+
         block = new JitBlock(cpu->Num, i, numAddressRanges, numLiterals);
         block->LiteralHash = literalHash;
         block->InstrHash = instrHash;
@@ -879,10 +1922,40 @@ void CompileBlock(ARM* cpu)
 
         block->StartAddr = blockAddr;
         block->StartAddrLocal = localAddr;
+        block->Thumb = thumb;
+        if (hasLoopBack)
+        {
+            block->LoopState = loop_Compiled;
+            NumLoops++;
+        }
+        else if (branchesToStart && !loop && Config::JIT_HotLoops)
+        {
+            block->LoopState = loop_Candidate;
+        }
+
+        FloodFillSetFlags(instrs, i - 1, exitFlags);
 
-        FloodFillSetFlags(instrs, i - 1, 0xF);
+        PrepareCompile(cpu, thumb, instrs, i);
+
+        if (CompileThreadRunning)
+        {
+            block->EntryPoint = NULL;
+            AddBlock(block);
+            QueueCompileJob(cpu, thumb, instrs, i, block);
+            return;
+        }
 
-        block->EntryPoint = JITCompiler->CompileBlock(cpu, thumb, instrs, i);
+        block->EntryPoint = JITCompiler->CompileBlock(cpu, thumb, instrs, i, &block->Code);
+        if (!block->EntryPoint)
+        {
+            // out of code memory
+            EvictCodeGeneration();
+            block->EntryPoint = JITCompiler->CompileBlock(cpu, thumb, instrs, i, &block->Code);
+        }
+        CodePatches patches;
+        JITCompiler->TakeNewPatches(patches);
+        JITCompiler->CommitPatches(patches);
+        ARMJIT_PerfMap::AddBlock(block);
 
         JIT_DEBUGPRINT("block start %p\n", block->EntryPoint);
     }
@@ -897,32 +1970,214 @@ void CompileBlock(ARM* cpu)
     {
         assert(addressRanges[j] == block->AddressRanges()[j]);
         assert(addressMasks[j] == block->AddressMasks()[j]);
-        assert(addressMasks[j] != 0);
+    }
+
+    AddBlock(block);
+
+    u64* entry = &FastBlockLookupRegions[(localAddr >> 27)][(localAddr & 0x7FFFFFF) / 2];
+    *entry = ((u64)blockAddr | cpu->Num) << 32;
+    *entry |= JITCompiler->SubEntryOffset(block->EntryPoint);
+}
 
-        AddressRange* region = CodeMemRegions[addressRanges[j] >> 27];
+bool ProfileLoop(ARM* cpu)
+{
+    if (!Config::JIT_HotLoops)
+        return false;
 
-        if (!PageContainsCode(&region[(addressRanges[j] & 0x7FFF000) / 512]))
-            ARMJIT_Memory::SetCodeProtection(addressRanges[j] >> 27, addressRanges[j] & 0x7FFFFFF, true);
+    u32 blockAddr = cpu->R[15] - ((cpu->CPSR & 0x20) ? 2 : 4);
 
-        AddressRange* range = &region[(addressRanges[j] & 0x7FFFFFF) / 512];
-        range->Code |= addressMasks[j];
-        range->Blocks.Add(block);
-    }
+    auto& map = cpu->Num == 0 ? JitBlocks9 : JitBlocks7;
+    auto it = map.find(blockAddr);
+    if (it == map.end() || it->second->LoopState != loop_Candidate)
+        return false;
 
-    if (cpu->Num == 0)
-        JitBlocks9[blockAddr] = block;
+    JitBlock* block = it->second;
+    block->LoopIterations += kLoopProfileInterval;
+    if (block->LoopIterations < kHotLoopThreshold)
+        return false;
+
+    // CompileBlock takes care of the rest
+    block->LoopState = loop_Hot;
+    return true;
+}
+
+void DecodeCachedInstr(u32 num, bool thumb, u32 instr, CachedInstr* res)
+{
+    res->Thumb = thumb;
+    res->Instr = instr;
+
+    if (thumb)
+    {
+        res->Handler = ARMInterpreter::THUMBInstrTable[(instr >> 6) & 0x3FF];
+        res->Cond = 0xE;
+    }
+    else if (num == 0 && (instr & 0xFE000000) == 0xFA000000)
+    {
+        res->Handler = ARMInterpreter::A_BLX_IMM;
+        res->Cond = 0xE;
+    }
     else
-        JitBlocks7[blockAddr] = block;
+    {
+        res->Handler = ARMInterpreter::ARMInstrTable[((instr >> 4) & 0xF) | ((instr >> 16) & 0xFF0)];
+        res->Cond = instr >> 28;
+    }
+}
 
-    u64* entry = &FastBlockLookupRegions[(localAddr >> 27)][(localAddr & 0x7FFFFFF) / 2];
+CachedInstr* CompileCachedBlock(ARM* cpu)
+{
+    bool thumb = cpu->CPSR & 0x20;
+    u32 instrSize = thumb ? 2 : 4;
+
+    if (Config::JIT_MaxBlockSize < 1)
+        Config::JIT_MaxBlockSize = 1;
+    if (Config::JIT_MaxBlockSize > 32)
+        Config::JIT_MaxBlockSize = 32;
+
+    u32 blockAddr = cpu->R[15] - instrSize;
+
+    u32 localAddr = LocaliseCodeAddress(cpu->Num, blockAddr);
+    if (!localAddr)
+        return NULL;
+
+    auto& map = cpu->Num == 0 ? JitBlocks9 : JitBlocks7;
+    auto existingBlockIt = map.find(blockAddr);
+    if (existingBlockIt != map.end())
+    {
+        JitBlock* existingBlock = existingBlockIt->second;
+        if (existingBlock->StartAddrLocal == localAddr
+            && CachedInstrs[existingBlock->CachedEntry].Thumb == thumb)
+        {
+            u64* entry = &FastBlockLookupRegions[localAddr >> 27][(localAddr & 0x7FFFFFF) / 2];
+            *entry = ((u64)blockAddr | cpu->Num) << 32;
+            *entry |= existingBlock->CachedEntry;
+            return &CachedInstrs[existingBlock->CachedEntry];
+        }
+
+        // memory has been remapped or the code is run in the other mode
+        InvalidateByAddr(existingBlock->StartAddrLocal);
+    }
+
+    if (CachedInstrsUsed + Config::JIT_MaxBlockSize + 2 > kCachedInstrsSize)
+        ResetBlockCache();
+
+    u32 addressRanges[Config::JIT_MaxBlockSize + 2];
+    u32 addressMasks[Config::JIT_MaxBlockSize + 2];
+    memset(addressMasks, 0, (Config::JIT_MaxBlockSize + 2) * sizeof(u32));
+    u32 numAddressRanges = 0;
+
+    u32 instrValues[Config::JIT_MaxBlockSize + 2];
+
+    // decode into the free space, it only gets used if no block can be restored
+    CachedInstr* instrs = &CachedInstrs[CachedInstrsUsed];
+    int numInstrs = -1;
+    int numFetched = 0;
+    while (numInstrs == -1 || numFetched < numInstrs + 2)
+    {
+        u32 addr = blockAddr + numFetched * instrSize;
+
+        // code outside of tracked memory can't be cached
+        u32 translatedAddr = LocaliseCodeAddress(cpu->Num, addr);
+        if (!translatedAddr)
+            break;
+
+        u32 translatedAddrRounded = translatedAddr & ~0x1FF;
+        u32 j = 0;
+        for (; j < numAddressRanges; j++)
+            if (addressRanges[j] == translatedAddrRounded)
+                break;
+        if (j == numAddressRanges)
+            addressRanges[numAddressRanges++] = translatedAddrRounded;
+        addressMasks[j] |= 1 << ((translatedAddr & 0x1FF) / 16);
+
+        // the exact value the interpreter's prefetch would put into the pipeline
+        // for the ARM9 THUMB code is fetched 32 bits at once
+        u32 instr;
+        if (thumb && cpu->Num == 0)
+            instr = cpu->PeekCode(addr & ~0x3, false) >> ((addr & 0x2) * 8);
+        else
+            instr = cpu->PeekCode(addr, thumb);
+        instrValues[numFetched] = instr;
+
+        DecodeCachedInstr(cpu->Num, thumb, instr, &instrs[numFetched]);
+        numFetched++;
+
+        if (numInstrs == -1)
+        {
+            ARMInstrInfo::Info info = ARMInstrInfo::Decode(thumb, cpu->Num, instr);
+            // MSR could switch to THUMB without branching
+            if (info.EndBlock || numFetched == Config::JIT_MaxBlockSize
+                || (!thumb && (info.Kind == ARMInstrInfo::ak_MSR_IMM || info.Kind == ARMInstrInfo::ak_MSR_REG)))
+                numInstrs = numFetched;
+        }
+    }
+
+    if (numInstrs == -1 || numFetched < numInstrs + 2)
+        numInstrs = numFetched - 2;
+    if (numInstrs < 1)
+        return NULL;
+
+    instrs[numInstrs].Handler = NULL;
+    instrs[numInstrs + 1].Handler = NULL;
+
+    u32 instrHash = (u32)XXH3_64bits(instrValues, (numInstrs + 2) * 4);
+
+    JitBlock* block = NULL;
+    auto prevBlockIt = RestoreCandidates.find(instrHash);
+    if (prevBlockIt != RestoreCandidates.end())
+    {
+        JitBlock* prevBlock = prevBlockIt->second;
+        RestoreCandidates.erase(prevBlockIt);
+
+        bool mayRestore = prevBlock->StartAddr == blockAddr && prevBlock->StartAddrLocal == localAddr;
+        for (int j = 0; j < numInstrs + 2 && mayRestore; j++)
+        {
+            CachedInstr& prevInstr = CachedInstrs[prevBlock->CachedEntry + j];
+            mayRestore = prevInstr.Handler == instrs[j].Handler
+                && prevInstr.Instr == instrs[j].Instr
+                && prevInstr.Cond == instrs[j].Cond
+                && prevInstr.Thumb == instrs[j].Thumb;
+        }
+
+        if (mayRestore)
+            block = prevBlock;
+        else
+            delete prevBlock;
+    }
+
+    if (!block)
+    {
+        block = new JitBlock(cpu->Num, 0, numAddressRanges, 0);
+        block->LiteralHash = 0;
+        block->InstrHash = instrHash;
+        for (int j = 0; j < numAddressRanges; j++)
+            block->AddressRanges()[j] = addressRanges[j];
+        for (int j = 0; j < numAddressRanges; j++)
+            block->AddressMasks()[j] = addressMasks[j];
+
+        block->StartAddr = blockAddr;
+        block->StartAddrLocal = localAddr;
+        block->Thumb = thumb;
+        block->EntryPoint = NULL;
+        block->CachedEntry = CachedInstrsUsed;
+
+        CachedInstrsUsed += numInstrs + 2;
+    }
+
+    AddBlock(block);
+
+    u64* entry = &FastBlockLookupRegions[localAddr >> 27][(localAddr & 0x7FFFFFF) / 2];
     *entry = ((u64)blockAddr | cpu->Num) << 32;
-    *entry |= JITCompiler->SubEntryOffset(block->EntryPoint);
+    *entry |= block->CachedEntry;
+
+    return &CachedInstrs[block->CachedEntry];
 }
 
 void InvalidateByAddr(u32 localAddr)
 {
     JIT_DEBUGPRINT("invalidating by addr %x\n", localAddr);
 
+    NumInvalidations++;
+
     AddressRange* region = CodeMemRegions[localAddr >> 27];
     AddressRange* range = &region[(localAddr & 0x7FFFFFF) / 512];
     u32 mask = 1 << ((localAddr & 0x1FF) / 16);
@@ -1002,7 +2257,11 @@ void InvalidateByAddr(u32 localAddr)
         else
             JitBlocks7.erase(block->StartAddr);
 
-        if (!literalInvalidation)
+        if (CancelCompileJob(block))
+        {
+            delete block;
+        }
+        else if (!literalInvalidation)
         {
             RetireJitBlock(block);
         }
@@ -1032,6 +2291,12 @@ void CheckAndInvalidate(u32 addr)
         InvalidateByAddr(localAddr);
 }
 
+void CheckAndInvalidateLocal(u32 localAddr)
+{
+    if (CodeMemRegions[localAddr >> 27][(localAddr & 0x7FFFFFF) / 512].Code & (1 << ((localAddr & 0x1FF) / 16)))
+        InvalidateByAddr(localAddr);
+}
+
 JitBlockEntry LookUpBlock(u32 num, u64* entries, u32 offset, u32 addr)
 {
     u64* entry = &entries[offset / 2];
@@ -1079,10 +2344,237 @@ template void CheckAndInvalidate<1, ARMJIT_Memory::memregion_NewSharedWRAM_B>(u3
 template void CheckAndInvalidate<0, ARMJIT_Memory::memregion_NewSharedWRAM_C>(u32);
 template void CheckAndInvalidate<1, ARMJIT_Memory::memregion_NewSharedWRAM_C>(u32);
 
+// persistent block cache
+// the file consists of the header, the compiler's code memory with the information
+// needed to relocate it, and the blocks. loaded blocks only become restore
+// candidates, so they are used once CompileBlock() fetched the same instructions
+// and literals from the same addresses again.
+const u32 kPersistentCacheVersion = 8;
+
+struct PersistentCacheHeader
+{
+    char Magic[8];
+    u32 Version;
+    u32 ConsoleType;
+    u64 BuildKey;
+    u32 MaxBlockSize;
+    u32 CodeCacheSize;
+    u8 BranchOptimisations, LiteralOptimisations, FastMemory, BulkLoops;
+    u8 HotLoops;
+};
+
+struct PersistentBlock
+{
+    u32 StartAddr, StartAddrLocal;
+    u32 InstrHash, LiteralHash;
+    u32 EntryOffset;
+    u16 NumAddresses, NumLiterals;
+    u32 Num;
+    u32 Thumb;
+    u32 LoopState;
+    u32 NearSize, FarOffset, FarSize;
+};
+
+u64 GetBuildKey()
+{
+    // the generated code refers to the emulator's functions and variables
+    // relative to its own position, so it can only be reused by the same
+    // executable. the distance of the interpreter functions to the
+    // code memory works as a fingerprint of it
+    u8* codeBase = (u8*)JITCompiler->AddEntryOffset(0);
+    s64 offsets[ARMInstrInfo::ak_Count + ARMInstrInfo::tk_Count + 1];
+    for (int i = 0; i < ARMInstrInfo::ak_Count; i++)
+        offsets[i] = (u8*)InterpretARM[i] - codeBase;
+    for (int i = 0; i < ARMInstrInfo::tk_Count; i++)
+        offsets[ARMInstrInfo::ak_Count + i] = (u8*)InterpretTHUMB[i] - codeBase;
+    offsets[ARMInstrInfo::ak_Count + ARMInstrInfo::tk_Count] = (u8*)&ARM_Dispatch - codeBase;
+
+    // the code also accesses the CPU state at fixed offsets, and the file
+    // holds structures of the JIT. none of them may have changed
+    const u32 layout[] =
+    {
+        kPersistentCacheVersion,
+        sizeof(ARMv5), sizeof(ARMv4),
+        sizeof(JitBlock), sizeof(FetchedInstr),
+        sizeof(PersistentCacheHeader), sizeof(PersistentBlock),
+    };
+
+    u64 key = XXH3_64bits(MELONDS_VERSION, sizeof(MELONDS_VERSION));
+    key = XXH3_64bits_withSeed(layout, sizeof(layout), key);
+    return XXH3_64bits_withSeed(offsets, sizeof(offsets), key);
+}
+
+void MakePersistentCacheHeader(PersistentCacheHeader* header)
+{
+    memset(header, 0, sizeof(PersistentCacheHeader));
+    memcpy(header->Magic, "MELONJIT", 8);
+    header->Version = kPersistentCacheVersion;
+    header->ConsoleType = NDS::ConsoleType;
+    header->BuildKey = GetBuildKey();
+    header->MaxBlockSize = Config::JIT_MaxBlockSize;
+    header->CodeCacheSize = Config::JIT_CodeCacheSize;
+    header->BranchOptimisations = Config::JIT_BranchOptimisations != 0;
+    header->LiteralOptimisations = Config::JIT_LiteralOptimisations != 0;
+    header->FastMemory = Config::JIT_FastMemory != 0;
+    header->BulkLoops = Config::JIT_BulkLoops != 0;
+    header->HotLoops = Config::JIT_HotLoops != 0;
+}
+
+bool SaveCache(const char* path)
+{
+    FinishCompileJobs();
+
+    FILE* f = Platform::OpenFile(path, "wb");
+    if (!f)
+        return false;
+
+    PersistentCacheHeader header;
+    MakePersistentCacheHeader(&header);
+    fwrite(&header, sizeof(PersistentCacheHeader), 1, f);
+
+    if (!JITCompiler->SaveCode(f))
+    {
+        fclose(f);
+        remove(path);
+        return false;
+    }
+
+    std::vector<JitBlock*> blocks;
+    for (auto it : JitBlocks9)
+        blocks.push_back(it.second);
+    for (auto it : JitBlocks7)
+        blocks.push_back(it.second);
+    for (auto it : RestoreCandidates)
+        blocks.push_back(it.second);
+
+    u32 numBlocks = blocks.size();
+    fwrite(&numBlocks, sizeof(u32), 1, f);
+    for (JitBlock* block : blocks)
+    {
+        PersistentBlock entry;
+        memset(&entry, 0, sizeof(PersistentBlock));
+        entry.StartAddr = block->StartAddr;
+        entry.StartAddrLocal = block->StartAddrLocal;
+        entry.InstrHash = block->InstrHash;
+        entry.LiteralHash = block->LiteralHash;
+        entry.EntryOffset = JITCompiler->SubEntryOffset(block->EntryPoint);
+        entry.NumAddresses = block->NumAddresses;
+        entry.NumLiterals = block->NumLiterals;
+        entry.Num = block->Num;
+        entry.Thumb = block->Thumb;
+        entry.LoopState = block->LoopState == loop_Hot ? loop_Candidate : block->LoopState;
+        entry.NearSize = block->Code.NearSize;
+        entry.FarOffset = JITCompiler->SubEntryOffset((JitBlockEntry)block->Code.Far);
+        entry.FarSize = block->Code.FarSize;
+        fwrite(&entry, sizeof(PersistentBlock), 1, f);
+        fwrite(block->AddressRanges(), sizeof(u32), block->NumAddresses * 2 + block->NumLiterals, f);
+    }
+
+    bool res = !ferror(f);
+    fclose(f);
+
+    printf("JIT cache: saved %d blocks to %s\n", numBlocks, path);
+    return res;
+}
+
+bool LoadCache(const char* path)
+{
+    FILE* f = Platform::OpenFile(path, "rb", true);
+    if (!f)
+        return false;
+
+    PersistentCacheHeader header, expected;
+    MakePersistentCacheHeader(&expected);
+    if (fread(&header, sizeof(PersistentCacheHeader), 1, f) != 1
+        || memcmp(&header, &expected, sizeof(PersistentCacheHeader)))
+    {
+        printf("JIT cache: %s was made by a different build or configuration\n", path);
+        fclose(f);
+        return false;
+    }
+
+    ResetBlockCache();
+
+    u32 numBlocks = 0;
+    bool res = JITCompiler->LoadCode(f) && fread(&numBlocks, sizeof(u32), 1, f) == 1;
+    for (u32 i = 0; res && i < numBlocks; i++)
+    {
+        PersistentBlock entry;
+        if (fread(&entry, sizeof(PersistentBlock), 1, f) != 1
+            || entry.Num > 1 || entry.NumAddresses == 0
+            || entry.NumAddresses > 2 * Config::JIT_MaxBlockSize
+            || entry.NumLiterals > Config::JIT_MaxBlockSize
+            || entry.LoopState > loop_Compiled)
+        {
+            res = false;
+            break;
+        }
+
+        JitBlock* block = new JitBlock(entry.Num, entry.LiteralHash, entry.NumAddresses, entry.NumLiterals);
+        block->StartAddr = entry.StartAddr;
+        block->StartAddrLocal = entry.StartAddrLocal;
+        block->InstrHash = entry.InstrHash;
+        block->LiteralHash = entry.LiteralHash;
+        block->Thumb = entry.Thumb != 0;
+        block->LoopState = entry.LoopState;
+        block->EntryPoint = JITCompiler->AddEntryOffset(entry.EntryOffset);
+        block->Code.Near = (u8*)block->EntryPoint;
+        block->Code.NearSize = entry.NearSize;
+        block->Code.Far = (u8*)JITCompiler->AddEntryOffset(entry.FarOffset);
+        block->Code.FarSize = entry.FarSize;
+
+        u32 dataLen = entry.NumAddresses * 2 + entry.NumLiterals;
+        if (fread(block->AddressRanges(), sizeof(u32), dataLen, f) != dataLen)
+        {
+            delete block;
+            res = false;
+            break;
+        }
+
+        if (RestoreCandidates.find(block->InstrHash) == RestoreCandidates.end())
+        {
+            RestoreCandidates[block->InstrHash] = block;
+            ARMJIT_PerfMap::AddBlock(block);
+        }
+        else
+        {
+            delete block;
+        }
+    }
+    fclose(f);
+
+    if (!res)
+    {
+        printf("JIT cache: %s is corrupted\n", path);
+        ResetBlockCache();
+        return false;
+    }
+
+    printf("JIT cache: loaded %d blocks from %s\n", numBlocks, path);
+    return true;
+}
+
+void GetCodeCacheStats(CodeCacheStats* stats)
+{
+    Platform::Mutex_Lock(CompilerLock);
+    JITCompiler->GetCodeMemUsage(stats->Size, stats->Used);
+    Platform::Mutex_Unlock(CompilerLock);
+
+    stats->NumBlocks = JitBlocks9.size() + JitBlocks7.size();
+    stats->NumEvictions = NumEvictions;
+    stats->NumEvictedBlocks = NumEvictedBlocks;
+    stats->NumResets = NumCacheResets;
+    stats->NumLoops = NumLoops;
+}
+
 void ResetBlockCache()
 {
     printf("Resetting JIT block cache...\n");
 
+    NumCacheResets++;
+
+    DiscardCompileJobs();
+
     // could be replace through a function which only resets
     // the permissions but we're too lazy
     ARMJIT_Memory::Reset();
@@ -1123,7 +2615,12 @@ void ResetBlockCache()
     JitBlocks9.clear();
     JitBlocks7.clear();
 
+    NumInvalidations++;
+    CachedInstrsUsed = 0;
+
     JITCompiler->Reset();
+
+    ARMJIT_PerfMap::Reset();
 }
 
 }
@@ -22,14 +22,83 @@ void InvalidateByAddr(u32 pseudoPhysical);
 
 template <u32 num, int region>
 void CheckAndInvalidate(u32 addr);
+void CheckAndInvalidateLocal(u32 localAddr);
+
+// whether code was compiled from anywhere in the range. the pages
+// are checked as a whole, so it might report code which isn't there
+bool RangeContainsCode(u32 localAddr, u32 size);
 
 void CompileBlock(ARM* cpu);
 
+// the dispatcher calls ProfileLoop every kLoopProfileInterval consecutive
+// runs of the same block. if it returns true the block is going to be
+// compiled again and CompileBlock has to be called instead of running it
+const u32 kLoopProfileInterval = 16;
+bool ProfileLoop(ARM* cpu);
+
 void ResetBlockCache();
 
+// the code memory is filled generation by generation, once it's full
+// the blocks in the oldest one are evicted to make space. its size is
+// set by Config::JIT_CodeCacheSize and applied on the next reset
+struct CodeCacheStats
+{
+    u32 Size, Used;
+    u32 NumBlocks;
+    u32 NumEvictions;
+    u32 NumEvictedBlocks;
+    // the whole cache is reset on emulator resets and savestate loads
+    u32 NumResets;
+    // blocks compiled as loops, see ProfileLoop
+    u32 NumLoops;
+};
+
+void GetCodeCacheStats(CodeCacheStats* stats);
+
+// persistent block cache, used if Config::JIT_PersistentCache is set
+// the compiled code and its blocks are written to disk, so that they don't
+// have to be compiled again the next time the same game runs. loaded blocks
+// are only used once their guest code and literals were verified to match.
+// LoadCache() has to be called right after a reset
+bool SaveCache(const char* path);
+bool LoadCache(const char* path);
+
 JitBlockEntry LookUpBlock(u32 num, u64* entries, u32 offset, u32 addr);
 bool SetupExecutableRegion(u32 num, u32 blockAddr, u64*& entry, u32& start, u32& size);
 
+// cached interpreter
+// used instead of the recompiler if Config::JIT_CachedInterpreter is set.
+// guest code is decoded into blocks of interpreter handlers, which are
+// tracked and invalidated the same way JIT blocks are. timing and
+// behaviour are the same as the regular interpreter's.
+struct CachedInstr
+{
+    void (*Handler)(ARM* cpu);
+    u32 Instr;
+    u8 Cond;
+    bool Thumb;
+};
+
+// a block is terminated by two entries without handler
+// which only hold the instructions that are in the pipeline
+// after the last one was executed
+extern CachedInstr CachedInstrs[];
+
+inline CachedInstr* LookUpCachedBlock(u32 num, u64* entries, u32 offset, u32 addr)
+{
+    u64 entry = entries[offset / 2];
+    if (entry >> 32 == (addr | num))
+        return &CachedInstrs[(u32)entry];
+    return NULL;
+}
+
+CachedInstr* CompileCachedBlock(ARM* cpu);
+
+void DecodeCachedInstr(u32 num, bool thumb, u32 instr, CachedInstr* res);
+
+// incremented whenever blocks get invalidated
+extern u32 NumInvalidations;
+
 }
 
 extern "C" void ARM_Dispatch(ARM* cpu, ARMJIT::JitBlockEntry entry);
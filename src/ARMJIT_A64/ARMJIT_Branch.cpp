@@ -2,9 +2,6 @@
 
 using namespace Arm64Gen;
 
-// hack
-const int kCodeCacheTiming = 3;
-
 namespace ARMJIT
 {
 
@@ -23,8 +20,8 @@ void Compiler::Comp_JumpTo(u32 addr, bool forceNonConstantCycles)
     IrregularCycles = true;
 
     u32 newPC;
-    u32 cycles = 0;
-    bool setupRegion = false;
+    // the timing was already looked up before compilation
+    u32 cycles = CurInstr.JumpCycles;
 
     if (addr & 0x1 && !Thumb)
     {
@@ -39,102 +36,25 @@ void Compiler::Comp_JumpTo(u32 addr, bool forceNonConstantCycles)
 
     if (Num == 0)
     {
-        ARMv5* cpu9 = (ARMv5*)CurCPU;
-
-        u32 oldregion = R15 >> 24;
-        u32 newregion = addr >> 24;
-
-        u32 regionCodeCycles = cpu9->MemTimings[addr >> 12][0];
-        u32 compileTimeCodeCycles = cpu9->RegionCodeCycles;
-        cpu9->RegionCodeCycles = regionCodeCycles;
-
-        MOVI2R(W0, regionCodeCycles);
+        MOVI2R(W0, CurInstr.JumpRegionCodeCycles);
         STR(INDEX_UNSIGNED, W0, RCPU, offsetof(ARMv5, RegionCodeCycles));
-
-        setupRegion = newregion != oldregion;
-        if (setupRegion)
-            cpu9->SetupCodeMem(addr);
-
-        if (addr & 0x1)
-        {
-            addr &= ~0x1;
-            newPC = addr+2;
-
-            // two-opcodes-at-once fetch
-            // doesn't matter if we put garbage in the MSbs there
-            if (addr & 0x2)
-            {
-                cpu9->CodeRead32(addr-2, true) >> 16;
-                cycles += cpu9->CodeCycles;
-                cpu9->CodeRead32(addr+2, false);
-                cycles += CurCPU->CodeCycles;
-            }
-            else
-            {
-                cpu9->CodeRead32(addr, true);
-                cycles += cpu9->CodeCycles;
-            }
-        }
-        else
-        {
-            addr &= ~0x3;
-            newPC = addr+4;
-
-            cpu9->CodeRead32(addr, true);
-            cycles += cpu9->CodeCycles;
-            cpu9->CodeRead32(addr+4, false);
-            cycles += cpu9->CodeCycles;
-        }
-
-        cpu9->RegionCodeCycles = compileTimeCodeCycles;
-        if (setupRegion)
-            cpu9->SetupCodeMem(R15);
     }
     else
     {
-        ARMv4* cpu7 = (ARMv4*)CurCPU;
-
         u32 codeRegion = addr >> 24;
         u32 codeCycles = addr >> 15; // cheato
 
-        cpu7->CodeRegion = codeRegion;
-        cpu7->CodeCycles = codeCycles;
-
         MOVI2R(W0, codeRegion);
         STR(INDEX_UNSIGNED, W0, RCPU, offsetof(ARM, CodeRegion));
         MOVI2R(W0, codeCycles);
         STR(INDEX_UNSIGNED, W0, RCPU, offsetof(ARM, CodeCycles));
-
-        if (addr & 0x1)
-        {
-            addr &= ~0x1;
-            newPC = addr+2;
-
-            // this is necessary because ARM7 bios protection
-            u32 compileTimePC = CurCPU->R[15];
-            CurCPU->R[15] = newPC;
-
-            cycles += NDS::ARM7MemTimings[codeCycles][0] + NDS::ARM7MemTimings[codeCycles][1];
-
-            CurCPU->R[15] = compileTimePC;
-        }
-        else
-        {
-            addr &= ~0x3;
-            newPC = addr+4;
-
-            u32 compileTimePC = CurCPU->R[15];
-            CurCPU->R[15] = newPC;
-
-            cycles += NDS::ARM7MemTimings[codeCycles][2] + NDS::ARM7MemTimings[codeCycles][3];
-
-            CurCPU->R[15] = compileTimePC;
-        }
-
-        cpu7->CodeRegion = R15 >> 24;
-        cpu7->CodeCycles = addr >> 15;
     }
 
+    if (addr & 0x1)
+        newPC = (addr & ~0x1) + 2;
+    else
+        newPC = (addr & ~0x3) + 4;
+
     if (Exit)
     {
         MOVI2R(W0, newPC);
@@ -417,6 +417,7 @@ Compiler::Compiler()
     JitMemMainSize -= JitMemSecondarySize;
 
     SetCodeBase((u8*)GetRWPtr(), (u8*)GetRXPtr());
+    RWBase = (u8*)GetRWPtr();
 }
 
 Compiler::~Compiler()
@@ -449,12 +450,12 @@ void Compiler::LoadReg(int reg, ARM64Reg nativeReg)
     if (reg == 15)
         MOVI2R(nativeReg, R15);
     else
-        LDR(INDEX_UNSIGNED, nativeReg, RCPU, offsetof(ARM, R[reg]));
+        LDR(INDEX_UNSIGNED, nativeReg, RCPU, offsetof(ARM, R) + reg*sizeof(u32));
 }
 
 void Compiler::SaveReg(int reg, ARM64Reg nativeReg)
 {
-    STR(INDEX_UNSIGNED, nativeReg, RCPU, offsetof(ARM, R[reg]));
+    STR(INDEX_UNSIGNED, nativeReg, RCPU, offsetof(ARM, R) + reg*sizeof(u32));
 }
 
 void Compiler::LoadCPSR()
@@ -639,20 +640,23 @@ void Compiler::Comp_BranchSpecialBehaviour(bool taken)
     }
 }
 
-JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount)
+JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, JitBlockCode* code)
 {
+    NewPatches.LoadStore.clear();
+
     if (JitMemMainSize - GetCodeOffset() < 1024 * 16)
     {
         printf("JIT near memory full, resetting...\n");
-        ResetBlockCache();
+        return NULL;
     }
     if ((JitMemMainSize +  JitMemSecondarySize) - OtherCodeRegion < 1024 * 8)
     {
         printf("JIT far memory full, resetting...\n");
-        ResetBlockCache();
+        return NULL;
     }
 
     JitBlockEntry res = (JitBlockEntry)GetRXPtr();
+    ptrdiff_t farStart = OtherCodeRegion;
 
     Thumb = thumb;
     Num = cpu->Num;
@@ -780,9 +784,26 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
 
     FlushIcache();
 
+    code->Near = (u8*)res;
+    code->NearSize = (u8*)GetRXPtr() - (u8*)res;
+    code->Far = (u8*)GetRXBase() + farStart;
+    code->FarSize = OtherCodeRegion - farStart;
+
     return res;
 }
 
+void Compiler::TakeNewPatches(CodePatches& patches)
+{
+    patches.LoadStore.swap(NewPatches.LoadStore);
+    NewPatches.LoadStore.clear();
+}
+
+void Compiler::CommitPatches(const CodePatches& patches)
+{
+    for (auto it : patches.LoadStore)
+        LoadStorePatches[it.first] = it.second;
+}
+
 void Compiler::Reset()
 {
     LoadStorePatches.clear();
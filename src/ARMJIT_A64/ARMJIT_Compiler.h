@@ -9,7 +9,9 @@
 #include "../ARMJIT_Internal.h"
 #include "../ARMJIT_RegisterCache.h"
 
+#include <stdio.h>
 #include <unordered_map>
+#include <vector>
 
 namespace ARMJIT
 {
@@ -73,6 +75,13 @@ struct LoadStorePatch
     u32 PatchSize;
 };
 
+// the patches of a newly compiled block, they're only
+// registered by the emulation thread, see Compiler::NewPatches
+struct CodePatches
+{
+    std::vector<std::pair<ptrdiff_t, LoadStorePatch>> LoadStore;
+};
+
 class Compiler : public Arm64Gen::ARM64XEmitter
 {
 public:
@@ -90,7 +99,11 @@ public:
         return RegCache.Mapping[reg];
     }
 
-    JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount);
+    JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, JitBlockCode* code);
+    // moves the patches of the last compiled block out
+    void TakeNewPatches(CodePatches& patches);
+    // has to be called on the emulation thread, before the block is entered
+    void CommitPatches(const CodePatches& patches);
 
     bool CanCompile(bool thumb, u16 kind);
 
@@ -101,6 +114,29 @@ public:
 
     void Reset();
 
+    // the code memory isn't split into generations here (yet),
+    // so once it's full all blocks are evicted
+    int GetGeneration(JitBlockEntry entry)
+    {
+        return 0;
+    }
+
+    int GetNextGeneration()
+    {
+        return 0;
+    }
+
+    void SwitchGeneration()
+    {
+        Reset();
+    }
+
+    void GetCodeMemUsage(u32& size, u32& used)
+    {
+        size = JitMemMainSize + JitMemSecondarySize;
+        used = GetCodeOffset() + (OtherCodeRegion - JitMemMainSize);
+    }
+
     void Comp_AddCycles_C(bool forceNonConstant = false);
     void Comp_AddCycles_CI(u32 numI);
     void Comp_AddCycles_CI(u32 c, Arm64Gen::ARM64Reg numI, Arm64Gen::ArithOption shift);
@@ -217,6 +253,10 @@ public:
     bool IsJITFault(u8* pc);
     u8* RewriteMemAccess(u8* pc);
 
+    // used by the persistent block cache
+    bool SaveCode(FILE* file);
+    bool LoadCode(FILE* file);
+
     void SwapCodeRegion()
     {
         ptrdiff_t offset = GetCodeOffset();
@@ -232,6 +272,8 @@ public:
     bool Thumb;
     u32 R15;
     u32 Num;
+    // may only be used to tell which CPU it is, with Config::JIT_AsyncCompile
+    // it keeps on running while its code is compiled
     ARM* CurCPU;
     u32 ConstantCycles;
     u32 CodeRegion;
@@ -246,7 +288,14 @@ public:
     void* JumpToFuncs9[3];
     void* JumpToFuncs7[3];
 
-    std::unordered_map<ptrdiff_t, LoadStorePatch> LoadStorePatches; 
+    // only touched by the emulation thread, so that the fault handler
+    // can use them without taking the compiler lock
+    std::unordered_map<ptrdiff_t, LoadStorePatch> LoadStorePatches;
+    // collected while compiling a block, possibly on the compile thread
+    CodePatches NewPatches;
+
+    // for patching code outside of the compiler's own emitter
+    u8* RWBase;
 
     // [Console Type][Num][Size][Sign Extend][Output register]
     void* PatchedLoadFuncs[2][2][3][2][8];
@@ -14,6 +14,18 @@ bool Compiler::IsJITFault(u8* pc)
     return (u64)pc >= (u64)GetRXBase() && (u64)pc - (u64)GetRXBase() < (JitMemMainSize + JitMemSecondarySize);
 }
 
+// the persistent block cache isn't supported yet: the code generated here
+// loads host addresses with MOVP2R, and those aren't tracked for relocation
+bool Compiler::SaveCode(FILE* file)
+{
+    return false;
+}
+
+bool Compiler::LoadCode(FILE* file)
+{
+    return false;
+}
+
 u8* Compiler::RewriteMemAccess(u8* pc)
 {
     ptrdiff_t pcOffset = pc - GetRXBase();
@@ -25,16 +37,13 @@ u8* Compiler::RewriteMemAccess(u8* pc)
         LoadStorePatch patch = it->second;
         LoadStorePatches.erase(it);
 
-        ptrdiff_t curCodeOffset = GetCodeOffset();
+        // not with our own emitter, a block might be compiled at the same time
+        ARM64XEmitter emitter(RWBase, GetRXBase(), pcOffset + patch.PatchOffset);
 
-        SetCodePtrUnsafe(pcOffset + patch.PatchOffset);
-
-        BL(patch.PatchFunc);
+        emitter.BL(patch.PatchFunc);
         for (int i = 0; i < patch.PatchSize / 4 - 1; i++)
-            HINT(HINT_NOP);
-        FlushIcacheSection((u8*)pc + patch.PatchOffset, (u8*)GetRXPtr());
-
-        SetCodePtrUnsafe(curCodeOffset);
+            emitter.HINT(HINT_NOP);
+        emitter.FlushIcacheSection((u8*)pc + patch.PatchOffset, (u8*)emitter.GetRXPtr());
 
         return pc + (ptrdiff_t)patch.PatchOffset;
     }
@@ -44,39 +53,28 @@ u8* Compiler::RewriteMemAccess(u8* pc)
 
 bool Compiler::Comp_MemLoadLiteral(int size, bool signExtend, int rd, u32 addr)
 {
-    u32 localAddr = LocaliseCodeAddress(Num, addr);
-
-    int invalidLiteralIdx = InvalidLiterals.Find(localAddr);
-    if (invalidLiteralIdx != -1)
-    {
-        InvalidLiterals.Remove(invalidLiteralIdx);
+    if (!CurInstr.HasLiteral)
         return false;
-    }
 
     Comp_AddCycles_CDI();
 
     u32 val;
-    // make sure arm7 bios is accessible
-    u32 tmpR15 = CurCPU->R[15];
-    CurCPU->R[15] = R15;
     if (size == 32)
     {
-        CurCPU->DataRead32(addr & ~0x3, &val);
-        val = ::ROR(val, (addr & 0x3) << 3);
+        val = ::ROR(CurInstr.LiteralValue, (addr & 0x3) << 3);
     }
     else if (size == 16)
     {
-        CurCPU->DataRead16(addr & ~0x1, &val);
+        val = (CurInstr.LiteralValue >> ((addr & 0x2) << 3)) & 0xFFFF;
         if (signExtend)
             val = ((s32)val << 16) >> 16;
     }
     else
     {
-        CurCPU->DataRead8(addr, &val);
+        val = (CurInstr.LiteralValue >> ((addr & 0x3) << 3)) & 0xFF;
         if (signExtend)
             val = ((s32)val << 24) >> 24;
     }
-    CurCPU->R[15] = tmpR15;
 
     MOVI2R(MapReg(rd), val);
 
@@ -161,9 +159,8 @@ void Compiler::Comp_MemAccess(int rd, int rn, Op2 offset, int size, int flags)
     if (!(flags & memop_Post) && (flags & memop_Writeback))
         MOV(rnMapped, W0);
 
-    u32 expectedTarget = Num == 0
-        ? ARMJIT_Memory::ClassifyAddress9(addrIsStatic ? staticAddress : CurInstr.DataRegion)
-        : ARMJIT_Memory::ClassifyAddress7(addrIsStatic ? staticAddress : CurInstr.DataRegion);
+    // for static addresses as well, the access went there when the block was fetched
+    u32 expectedTarget = CurInstr.DataMemRegion;
 
     if (Config::JIT_FastMemory && ((!Thumb && CurInstr.Cond() != 0xE) || ARMJIT_Memory::IsFastmemCompatible(expectedTarget)))
     {
@@ -198,7 +195,7 @@ void Compiler::Comp_MemAccess(int rd, int rn, Op2 offset, int size, int flags)
 
         patch.PatchOffset = memopStart - loadStorePosition;
         patch.PatchSize = GetCodeOffset() - memopStart;
-        LoadStorePatches[loadStorePosition] = patch;
+        NewPatches.LoadStore.push_back({loadStorePosition, patch});
     }
     else
     {
@@ -465,9 +462,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
     else
         Comp_AddCycles_CDI();
 
-    int expectedTarget = Num == 0
-        ? ARMJIT_Memory::ClassifyAddress9(CurInstr.DataRegion)
-        : ARMJIT_Memory::ClassifyAddress7(CurInstr.DataRegion);
+    int expectedTarget = CurInstr.DataMemRegion;
 
     bool compileFastPath = Config::JIT_FastMemory
         && store && !usermode && (CurInstr.Cond() < 0xE || ARMJIT_Memory::IsFastmemCompatible(expectedTarget));
@@ -569,7 +564,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
         for (i = 0; i < regsCount; i++)
         {
             patch.PatchOffset = fastPathStart - loadStoreOffsets[i];
-            LoadStorePatches[loadStoreOffsets[i]] = patch;
+            NewPatches.LoadStore.push_back({loadStoreOffsets[i], patch});
         }
 
         ABI_PushRegisters({30});
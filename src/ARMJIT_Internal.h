@@ -8,6 +8,7 @@
 
 #include "ARMJIT.h"
 #include "ARMJIT_Memory.h"
+#include "Platform.h"
 
 // here lands everything which doesn't fit into ARMJIT.h
 // where it would be included by pretty much everything
@@ -20,8 +21,28 @@ enum
     branch_FollowCondTaken = 1 << 1,
     branch_FollowCondNotTaken = 1 << 2,
     branch_StaticTarget = 1 << 3,
+    // jumps back to the start of a block compiled as loop
+    branch_LoopBack = 1 << 4,
+    // ends a copy or fill loop at the start of the block, see DecodeBulkLoop
+    branch_BulkLoop = 1 << 5,
 };
 
+// blocks which keep jumping back to their own start are profiled
+// and compiled again as loops, which only leave the JIT code
+// when the dispatcher would have to do something else
+enum
+{
+    // no static branch back to the start
+    loop_None,
+    loop_Candidate,
+    // is going to be compiled again
+    loop_Hot,
+    loop_Compiled,
+};
+
+// total iterations after which a candidate is compiled as loop
+const u32 kHotLoopThreshold = 256;
+
 struct FetchedInstr
 {
     u32 A_Reg(int pos) const
@@ -48,6 +69,20 @@ struct FetchedInstr
     u16 CodeCycles;
     u32 DataRegion;
 
+    // filled in before compilation, the compiler might run on another
+    // thread and thus can't access the CPU or memory itself
+
+    // the word containing the value loaded from a literal pool
+    bool HasLiteral;
+    u32 LiteralValue;
+    // timing of a jump to a constant target
+    u32 JumpCycles;
+    u32 JumpRegionCodeCycles;
+    // fast lookup entry of the block, for branch_LoopBack
+    u64* LoopEntry;
+    // memregion_* of DataRegion, it depends on the TCM and WRAM mappings
+    int DataMemRegion;
+
     ARMInstrInfo::Info Info;
 };
 
@@ -153,6 +188,16 @@ struct __attribute__((packed)) TinyVector
     }
 };
 
+// where the compiler put a block's code, the far code
+// contains the slow paths which are rarely taken
+struct JitBlockCode
+{
+    u8* Near;
+    u32 NearSize;
+    u8* Far;
+    u32 FarSize;
+};
+
 class JitBlock
 {
 public:
@@ -161,6 +206,8 @@ public:
         Num = num;
         NumAddresses = numAddresses;
         NumLiterals = numLiterals;
+        LoopState = loop_None;
+        LoopIterations = 0;
         Data.SetLength(numAddresses * 2 + numLiterals);
     }
 
@@ -168,10 +215,16 @@ public:
     u32 StartAddrLocal;
     u32 InstrHash, LiteralHash;
     u8 Num;
+    bool Thumb;
+    u8 LoopState;
     u16 NumAddresses;
     u16 NumLiterals;
 
     JitBlockEntry EntryPoint;
+    JitBlockCode Code;
+    // index of the first instruction when used by the cached interpreter
+    u32 CachedEntry;
+    u32 LoopIterations;
 
     u32* AddressRanges()
     { return &Data[0]; }
@@ -198,6 +251,10 @@ extern InterpreterFunc InterpretTHUMB[];
 
 extern TinyVector<u32> InvalidLiterals;
 
+// held while the compiler is in use, which might be on another thread
+// with Config::JIT_AsyncCompile
+extern Platform::Mutex* CompilerLock;
+
 extern AddressRange* const CodeMemRegions[ARMJIT_Memory::memregions_Count];
 
 inline bool PageContainsCode(AddressRange* range)
@@ -212,6 +269,36 @@ inline bool PageContainsCode(AddressRange* range)
 
 u32 LocaliseCodeAddress(u32 num, u32 addr);
 
+// a loop which does nothing but copy or fill memory, like
+//     LDMIA src!, {regs}; STMIA dst!, {regs}; SUBS counter, counter, #step; BNE
+// or the form used by the SDK
+//     CMP dst, end; LDMLTIA src!, {regs}; STMLTIA dst!, {regs}; BLT
+// the load is missing when memory is filled. in ARM code single
+// LDR/STR(B/H) with a post increment are also fine. it's packed into
+// a single value, so that the compiled code can pass it to RunBulkLoop
+struct BulkLoop
+{
+    u16 Regs;
+    // subtracted from CounterReg in every iteration. if it's 0,
+    // DstReg is compared with CounterReg at the start instead
+    u8 Step;
+    // 16 if memory is filled
+    u8 SrcReg;
+    u8 DstReg;
+    u8 CounterReg;
+    // size of every transfer in bytes
+    u8 Unit;
+    // condition of the branch back
+    u8 Cond;
+};
+static_assert(sizeof(BulkLoop) == 8, "BulkLoop has to fit into a register");
+
+bool DecodeBulkLoop(bool thumb, const FetchedInstr instrs[], int instrsCount, BulkLoop& loop);
+
+// does all but the last of the remaining iterations of a bulk loop at once, if its
+// memory is plain RAM without code, as many as fit in before the next event
+void RunBulkLoop(ARM* cpu, u64 loop, s32 iterationCycles);
+
 template <u32 Num>
 void LinkBlock(ARM* cpu, u32 codeOffset);
 
@@ -663,7 +663,11 @@ bool FaultHandler(FaultDescription& faultDesc)
             rewriteToSlowPath = !MapAtAddress(faultDesc.EmulatedFaultAddr);
 
         if (rewriteToSlowPath)
+        {
+            // no lock needed, the patches are only touched by this thread
+            // and the rewritten code doesn't overlap with new blocks
             faultDesc.FaultPC = ARMJIT::JITCompiler->RewriteMemAccess(faultDesc.FaultPC);
+        }
 
         return true;
     }
@@ -1033,6 +1037,30 @@ u32 LocaliseAddress(int region, u32 num, u32 addr)
     }
 }
 
+u8* GetHostRange(u32 num, u32 addr, u32 size, u32& localAddr)
+{
+    int region = num == 0 ? ClassifyAddress9(addr) : ClassifyAddress7(addr);
+    if (size == 0 || !IsFastmemCompatible(region))
+        return NULL;
+
+    u32 last = addr + size - 1;
+    if (last < addr || (num == 0 ? ClassifyAddress9(last) : ClassifyAddress7(last)) != region)
+        return NULL;
+    // DTCM might be in the middle of it
+    if (num == 0 && region != memregion_DTCM
+        && addr < NDS::ARM9->DTCMBase + NDS::ARM9->DTCMSize && last >= NDS::ARM9->DTCMBase)
+        return NULL;
+
+    u32 memoryOffset, mirrorStart, mirrorSize;
+    if (!GetMirrorLocation(region, num, addr, memoryOffset, mirrorStart, mirrorSize)
+        || last - mirrorStart >= mirrorSize)
+        return NULL;
+
+    u32 offset = memoryOffset + (addr - mirrorStart);
+    localAddr = offset | (region << 27);
+    return MemoryBase + OffsetsPerRegion[region] + offset;
+}
+
 int ClassifyAddress9(u32 addr)
 {
     if (addr < NDS::ARM9->ITCMSize)
@@ -1171,6 +1199,22 @@ T VRAMRead(u32 addr)
     }
 }
 
+// the table is only rebuilt on reset, so the handlers
+// stay valid for as long as the compiled code
+static void* GetIOHandlerFunc(NDS::IOHandlers* io, bool store, int size)
+{
+    switch (size | store)
+    {
+    case 8: return (void*)io->Read8;
+    case 9: return (void*)io->Write8;
+    case 16: return (void*)io->Read16;
+    case 17: return (void*)io->Write16;
+    case 32: return (void*)io->Read32;
+    case 33: return (void*)io->Write32;
+    }
+    return NULL;
+}
+
 void* GetFuncForAddr(ARM* cpu, u32 addr, bool store, int size)
 {
     if (cpu->Num == 0)
@@ -1181,24 +1225,8 @@ void* GetFuncForAddr(ARM* cpu, u32 addr, bool store, int size)
             if (!store && size == 32 && addr == 0x04100010 && NDS::ExMemCnt[0] & (1<<11))
                 return (void*)NDSCart::ReadROMData;
 
-            /*
-                unfortunately we can't map GPU2D this way
-                since it's hidden inside an object
-
-                though GPU3D registers are accessed much more intensive
-            */
-            if (addr >= 0x04000320 && addr < 0x040006A4)
-            {
-                switch (size | store)
-                {
-                case 8: return (void*)GPU3D::Read8;		
-                case 9: return (void*)GPU3D::Write8;		
-                case 16: return (void*)GPU3D::Read16;
-                case 17: return (void*)GPU3D::Write16;
-                case 32: return (void*)GPU3D::Read32;
-                case 33: return (void*)GPU3D::Write32;
-                }
-            }
+            if (NDS::IOHandlers* io = NDS::GetIOHandlers(0, addr))
+                return GetIOHandlerFunc(io, store, size);
 
             if (NDS::ConsoleType == 0)
             {
@@ -1243,18 +1271,8 @@ void* GetFuncForAddr(ARM* cpu, u32 addr, bool store, int size)
         switch (addr & 0xFF800000)
         {
         case 0x04000000:
-            if (addr >= 0x04000400 && addr < 0x04000520)
-            {
-                switch (size | store)
-                {
-                case 8: return (void*)SPU::Read8;		
-                case 9: return (void*)SPU::Write8;		
-                case 16: return (void*)SPU::Read16;
-                case 17: return (void*)SPU::Write16;
-                case 32: return (void*)SPU::Read32;
-                case 33: return (void*)SPU::Write32;
-                }
-            }
+            if (NDS::IOHandlers* io = NDS::GetIOHandlers(1, addr))
+                return GetIOHandlerFunc(io, store, size);
 
             if (NDS::ConsoleType == 0)
             {
@@ -48,6 +48,11 @@ int ClassifyAddress7(u32 addr);
 bool GetMirrorLocation(int region, u32 num, u32 addr, u32& memoryOffset, u32& mirrorStart, u32& mirrorSize);
 u32 LocaliseAddress(int region, u32 num, u32 addr);
 
+// the host memory behind the range if it lies within a single mirror of memory
+// accessible through fastmem, otherwise NULL. localAddr is set to the localised
+// address of its start
+u8* GetHostRange(u32 num, u32 addr, u32 size, u32& localAddr);
+
 bool IsFastmemCompatible(int region);
 
 void RemapDTCM(u32 newBase, u32 newSize);
@@ -0,0 +1,286 @@
+#include "ARMJIT_PerfMap.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <map>
+
+#ifdef __linux__
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include "ARMJIT_Compiler.h"
+#include "Config.h"
+
+namespace ARMJIT_PerfMap
+{
+
+using namespace ARMJIT;
+
+#ifdef __linux__
+
+struct Symbol
+{
+    u32 Size;
+    int Generation;
+    char Name[32];
+};
+
+// everything which is currently inside the code memory
+std::map<u8*, Symbol> Symbols;
+
+int Mode = 0;
+
+char PerfMapPath[64];
+FILE* PerfMap = NULL;
+
+FILE* JitDump = NULL;
+// perf only finds the dump file if it's mapped as executable
+void* JitDumpMarker = NULL;
+u64 JitDumpCodeIndex;
+
+// see tools/perf/Documentation/jitdump-specification.txt in the Linux sources
+struct JitDumpHeader
+{
+    u32 Magic;
+    u32 Version;
+    u32 TotalSize;
+    u32 ElfMach;
+    u32 Pad1;
+    u32 Pid;
+    u64 Timestamp;
+    u64 Flags;
+};
+
+struct JitDumpRecordHeader
+{
+    u32 ID;
+    u32 TotalSize;
+    u64 Timestamp;
+};
+
+struct JitDumpCodeLoad
+{
+    JitDumpRecordHeader Header;
+    u32 Pid;
+    u32 Tid;
+    u64 VMA;
+    u64 CodeAddr;
+    u64 CodeSize;
+    u64 CodeIndex;
+};
+
+enum
+{
+    jitdump_CodeLoad = 0,
+    jitdump_CodeClose = 3,
+};
+
+u64 GetTimestamp()
+{
+    // has to match perf record -k mono
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void WritePerfMapEntry(u8* start, const Symbol& symbol)
+{
+    fprintf(PerfMap, "%llx %x %s\n", (unsigned long long)start, symbol.Size, symbol.Name);
+}
+
+void RewritePerfMap()
+{
+    fclose(PerfMap);
+    PerfMap = fopen(PerfMapPath, "w");
+    if (!PerfMap)
+        return;
+
+    for (auto& it : Symbols)
+        WritePerfMapEntry(it.first, it.second);
+    fflush(PerfMap);
+}
+
+void OpenJitDump()
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/jit-%d.dump", getpid());
+
+    int fd = open(path, O_CREAT | O_TRUNC | O_RDWR, 0666);
+    if (fd == -1)
+        return;
+
+    JitDumpMarker = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0);
+    if (JitDumpMarker == MAP_FAILED)
+    {
+        JitDumpMarker = NULL;
+        close(fd);
+        return;
+    }
+
+    JitDump = fdopen(fd, "wb");
+
+    JitDumpHeader header;
+    memset(&header, 0, sizeof(header));
+    header.Magic = 0x4A695444;
+    header.Version = 1;
+    header.TotalSize = sizeof(header);
+#if defined(__x86_64__)
+    header.ElfMach = EM_X86_64;
+#else
+    header.ElfMach = EM_AARCH64;
+#endif
+    header.Pid = getpid();
+    header.Timestamp = GetTimestamp();
+    fwrite(&header, sizeof(header), 1, JitDump);
+    fflush(JitDump);
+
+    JitDumpCodeIndex = 0;
+}
+
+void CloseJitDump()
+{
+    JitDumpRecordHeader record;
+    record.ID = jitdump_CodeClose;
+    record.TotalSize = sizeof(record);
+    record.Timestamp = GetTimestamp();
+    fwrite(&record, sizeof(record), 1, JitDump);
+
+    fclose(JitDump);
+    munmap(JitDumpMarker, sysconf(_SC_PAGESIZE));
+    JitDump = NULL;
+    JitDumpMarker = NULL;
+}
+
+void AddSymbol(u8* start, u32 size, int generation, const char* name)
+{
+    Symbol& symbol = Symbols[start];
+    symbol.Size = size;
+    symbol.Generation = generation;
+    strncpy(symbol.Name, name, sizeof(symbol.Name) - 1);
+    symbol.Name[sizeof(symbol.Name) - 1] = '\0';
+
+    WritePerfMapEntry(start, symbol);
+    fflush(PerfMap);
+
+    if (JitDump)
+    {
+        u32 nameLen = strlen(symbol.Name) + 1;
+
+        JitDumpCodeLoad record;
+        record.Header.ID = jitdump_CodeLoad;
+        record.Header.TotalSize = sizeof(record) + nameLen + size;
+        record.Header.Timestamp = GetTimestamp();
+        record.Pid = getpid();
+        record.Tid = syscall(SYS_gettid);
+        record.VMA = (u64)start;
+        record.CodeAddr = (u64)start;
+        record.CodeSize = size;
+        record.CodeIndex = JitDumpCodeIndex++;
+
+        fwrite(&record, sizeof(record), 1, JitDump);
+        fwrite(symbol.Name, 1, nameLen, JitDump);
+        fwrite(start, 1, size, JitDump);
+        fflush(JitDump);
+    }
+}
+
+void Setup()
+{
+    if (Config::JIT_PerfMap == Mode)
+        return;
+
+    Close();
+
+    if (Config::JIT_PerfMap)
+    {
+        snprintf(PerfMapPath, sizeof(PerfMapPath), "/tmp/perf-%d.map", getpid());
+        PerfMap = fopen(PerfMapPath, "w");
+        if (!PerfMap)
+        {
+            printf("JIT: couldn't open %s\n", PerfMapPath);
+            return;
+        }
+
+        if (Config::JIT_PerfMap >= 2)
+            OpenJitDump();
+
+        Mode = Config::JIT_PerfMap;
+    }
+}
+
+void Close()
+{
+    if (JitDump)
+        CloseJitDump();
+    if (PerfMap)
+        fclose(PerfMap);
+    PerfMap = NULL;
+
+    Symbols.clear();
+    Mode = 0;
+}
+
+void AddBlock(JitBlock* block)
+{
+    if (!PerfMap)
+        return;
+
+    char name[32];
+    int generation = JITCompiler->GetGeneration(block->EntryPoint);
+
+    snprintf(name, sizeof(name), "ARM%d %s %08X",
+        block->Num ? 7 : 9, block->Thumb ? "Thumb" : "ARM", block->StartAddr);
+    AddSymbol(block->Code.Near, block->Code.NearSize, generation, name);
+
+    if (block->Code.FarSize)
+    {
+        snprintf(name, sizeof(name), "ARM%d %s %08X far",
+            block->Num ? 7 : 9, block->Thumb ? "Thumb" : "ARM", block->StartAddr);
+        AddSymbol(block->Code.Far, block->Code.FarSize, generation, name);
+    }
+}
+
+void EvictGeneration(int generation)
+{
+    if (!PerfMap)
+        return;
+
+    // the jitdump records don't need to be touched, newer
+    // ones for the same code addresses take precedence
+    for (auto it = Symbols.begin(); it != Symbols.end();)
+    {
+        if (it->second.Generation == generation)
+            it = Symbols.erase(it);
+        else
+            it++;
+    }
+
+    RewritePerfMap();
+}
+
+void Reset()
+{
+    if (!PerfMap)
+        return;
+
+    Symbols.clear();
+    RewritePerfMap();
+}
+
+#else
+
+// perf is Linux only
+void Setup() {}
+void Close() {}
+void AddBlock(JitBlock* block) {}
+void EvictGeneration(int generation) {}
+void Reset() {}
+
+#endif
+
+}
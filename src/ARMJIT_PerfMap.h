@@ -0,0 +1,31 @@
+#ifndef ARMJIT_PERFMAP_H
+#define ARMJIT_PERFMAP_H
+
+#include "ARMJIT_Internal.h"
+
+// symbols for the JIT code, so that profilers can tell which guest code is hot.
+// used on Linux if Config::JIT_PerfMap is set:
+// 1 writes /tmp/perf-<pid>.map, which perf report picks up by itself
+// 2 additionally writes jitdump records to /tmp/jit-<pid>.dump, which also
+//   contain the code and have to be merged into a recording made with
+//   perf record -k mono using perf inject --jit
+//
+// the code of a retired block stays where it is and it might be restored,
+// so its symbol is kept until its memory is reused by a newer block
+namespace ARMJIT_PerfMap
+{
+
+// opens or closes the files according to the current config
+void Setup();
+void Close();
+
+void AddBlock(ARMJIT::JitBlock* block);
+
+// all blocks in this generation of the code memory are about to be overwritten
+void EvictGeneration(int generation);
+// the whole code memory is going to be overwritten
+void Reset();
+
+}
+
+#endif
@@ -6,6 +6,8 @@
 #include <assert.h>
 
 #include "../dolphin/CommonFuncs.h"
+#define XXH_STATIC_LINKING_ONLY
+#include "../xxhash/xxhash.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -199,9 +201,9 @@ void Compiler::A_Comp_MSR()
 
 /*
     We'll repurpose this .bss memory
-
+    only the part of it selected by Config::JIT_CodeCacheSize is touched
  */
-u8 CodeMemory[1024 * 1024 * 32];
+u8 CodeMemory[1024 * 1024 * 128];
 
 Compiler::Compiler()
 {
@@ -222,7 +224,7 @@ Compiler::Compiler()
         DWORD dummy;
         VirtualProtect(pageAligned, alignedSize, PAGE_EXECUTE_READWRITE, &dummy);
     #elif defined(__APPLE__)
-        pageAligned = (u8*)mmap(NULL, 1024*1024*32, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS ,-1, 0);
+        pageAligned = (u8*)mmap(NULL, sizeof(CodeMemory), PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS ,-1, 0);
     #else
         mprotect(pageAligned, alignedSize, PROT_EXEC | PROT_READ | PROT_WRITE);
     #endif
@@ -420,11 +422,7 @@ Compiler::Compiler()
     CodeMemSize -= GetWritableCodePtr() - ResetStart;
     ResetStart = GetWritableCodePtr();
 
-    NearStart = ResetStart;
-    FarStart = ResetStart + 1024*1024*24;
-
-    NearSize = FarStart - ResetStart;
-    FarSize = (ResetStart + CodeMemSize) - FarStart;
+    Reset();
 }
 
 void Compiler::LoadCPSR()
@@ -447,14 +445,14 @@ void Compiler::SaveCPSR(bool flagClean)
 void Compiler::LoadReg(int reg, X64Reg nativeReg)
 {
     if (reg != 15)
-        MOV(32, R(nativeReg), MDisp(RCPU, offsetof(ARM, R[reg])));
+        MOV(32, R(nativeReg), MDisp(RCPU, offsetof(ARM, R) + reg*sizeof(u32)));
     else
         MOV(32, R(nativeReg), Imm32(R15));
 }
 
 void Compiler::SaveReg(int reg, X64Reg nativeReg)
 {
-    MOV(32, MDisp(RCPU, offsetof(ARM, R[reg])), R(nativeReg));
+    MOV(32, MDisp(RCPU, offsetof(ARM, R) + reg*sizeof(u32)), R(nativeReg));
 }
 
 // invalidates RSCRATCH and RSCRATCH3
@@ -610,13 +608,247 @@ bool Compiler::CanCompile(bool thumb, u16 kind)
 
 void Compiler::Reset()
 {
-    memset(ResetStart, 0xcc, CodeMemSize);
-    SetCodePtr(ResetStart);
+    // a new size is applied here, when there are no blocks left
+    if (Config::JIT_CodeCacheSize < 4)
+        Config::JIT_CodeCacheSize = 4;
+    if (Config::JIT_CodeCacheSize > (int)(sizeof(CodeMemory) / (1024 * 1024)))
+        Config::JIT_CodeCacheSize = sizeof(CodeMemory) / (1024 * 1024);
+    u32 size = Config::JIT_CodeCacheSize * 1024 * 1024;
+    if (size > CodeMemSize)
+        size = CodeMemSize;
+
+    // a quarter of it is used for far code
+    NearGenSize = (size / 4 * 3) / kCodeGenerations;
+    FarGenSize = (size / 4) / kCodeGenerations;
+    NearSize = NearGenSize * kCodeGenerations;
+    FarSize = FarGenSize * kCodeGenerations;
+    NearStart = ResetStart;
+    FarStart = ResetStart + NearSize;
+
+    memset(ResetStart, 0xcc, NearSize + FarSize);
+    SetCodePtr(NearStart);
 
     NearCode = NearStart;
     FarCode = FarStart;
 
+    CurGeneration = 0;
+    for (int i = 0; i < kCodeGenerations; i++)
+    {
+        GenNearEnd[i] = NearStart + i * NearGenSize;
+        GenFarEnd[i] = FarStart + i * FarGenSize;
+    }
+
     LoadStorePatches.clear();
+    FastMemBaseRelocs.clear();
+}
+
+void Compiler::SwitchGeneration()
+{
+    // blocks are always finished in near code
+    GenNearEnd[CurGeneration] = GetWritableCodePtr();
+    GenFarEnd[CurGeneration] = FarCode;
+
+    CurGeneration = GetNextGeneration();
+
+    u8* nearStart = NearStart + CurGeneration * NearGenSize;
+    u8* farStart = FarStart + CurGeneration * FarGenSize;
+    memset(nearStart, 0xcc, NearGenSize);
+    memset(farStart, 0xcc, FarGenSize);
+
+    for (auto it = LoadStorePatches.begin(); it != LoadStorePatches.end();)
+    {
+        if ((it->first >= nearStart && it->first < nearStart + NearGenSize)
+            || (it->first >= farStart && it->first < farStart + FarGenSize))
+            it = LoadStorePatches.erase(it);
+        else
+            it++;
+    }
+    FastMemBaseRelocs.erase(FastMemBaseRelocs.lower_bound(nearStart - ResetStart),
+        FastMemBaseRelocs.lower_bound(nearStart + NearGenSize - ResetStart));
+    FastMemBaseRelocs.erase(FastMemBaseRelocs.lower_bound(farStart - ResetStart),
+        FastMemBaseRelocs.lower_bound(farStart + FarGenSize - ResetStart));
+
+    SetCodePtr(nearStart);
+    NearCode = nearStart;
+    FarCode = farStart;
+    GenNearEnd[CurGeneration] = nearStart;
+    GenFarEnd[CurGeneration] = farStart;
+}
+
+void Compiler::GetCodeMemUsage(u32& size, u32& used)
+{
+    GenNearEnd[CurGeneration] = GetWritableCodePtr();
+    GenFarEnd[CurGeneration] = FarCode;
+
+    size = NearSize + FarSize;
+    used = 0;
+    for (int i = 0; i < kCodeGenerations; i++)
+    {
+        used += GenNearEnd[i] - (NearStart + i * NearGenSize);
+        used += GenFarEnd[i] - (FarStart + i * FarGenSize);
+    }
+}
+
+struct PersistentPatch
+{
+    u32 Location;
+    s32 PatchFunc;
+    s16 Offset;
+    u16 Size;
+};
+
+bool Compiler::SaveCode(FILE* file)
+{
+#ifdef __APPLE__
+    // the code memory isn't part of the executable there,
+    // so calls into the emulator can't be relative
+    return false;
+#endif
+
+    GenNearEnd[CurGeneration] = GetWritableCodePtr();
+    GenFarEnd[CurGeneration] = FarCode;
+
+    // the layout of the code memory has to be the same when loading
+    u32 layout[3] = {NearGenSize, FarGenSize, (u32)CurGeneration};
+    u32 sizes[kCodeGenerations][2];
+    u64 hash = 0;
+    for (int i = 0; i < kCodeGenerations; i++)
+    {
+        sizes[i][0] = GenNearEnd[i] - (NearStart + i * NearGenSize);
+        sizes[i][1] = GenFarEnd[i] - (FarStart + i * FarGenSize);
+        hash ^= XXH3_64bits(NearStart + i * NearGenSize, sizes[i][0]);
+        hash ^= XXH3_64bits(FarStart + i * FarGenSize, sizes[i][1]);
+    }
+    fwrite(layout, sizeof(u32), 3, file);
+    fwrite(sizes, sizeof(u32), kCodeGenerations * 2, file);
+    fwrite(&hash, sizeof(u64), 1, file);
+    for (int i = 0; i < kCodeGenerations; i++)
+    {
+        fwrite(NearStart + i * NearGenSize, 1, sizes[i][0], file);
+        fwrite(FarStart + i * FarGenSize, 1, sizes[i][1], file);
+    }
+
+    u32 numRelocs = FastMemBaseRelocs.size();
+    fwrite(&numRelocs, sizeof(u32), 1, file);
+    for (auto it : FastMemBaseRelocs)
+    {
+        u32 reloc[2] = {it.first, it.second};
+        fwrite(reloc, sizeof(u32), 2, file);
+    }
+
+    u32 numPatches = LoadStorePatches.size();
+    fwrite(&numPatches, sizeof(u32), 1, file);
+    for (auto it : LoadStorePatches)
+    {
+        PersistentPatch patch;
+        patch.Location = it.first - ResetStart;
+        patch.PatchFunc = (u8*)it.second.PatchFunc - ResetStart;
+        patch.Offset = it.second.Offset;
+        patch.Size = it.second.Size;
+        fwrite(&patch, sizeof(PersistentPatch), 1, file);
+    }
+
+    return !ferror(file);
+}
+
+bool Compiler::LoadCode(FILE* file)
+{
+#ifdef __APPLE__
+    return false;
+#endif
+
+    u32 layout[3];
+    u32 sizes[kCodeGenerations][2];
+    u64 hash;
+    if (fread(layout, sizeof(u32), 3, file) != 3
+        || layout[0] != NearGenSize || layout[1] != FarGenSize || layout[2] >= kCodeGenerations
+        || fread(sizes, sizeof(u32), kCodeGenerations * 2, file) != kCodeGenerations * 2
+        || fread(&hash, sizeof(u64), 1, file) != 1)
+        return false;
+
+    u64 loadedHash = 0;
+    for (int i = 0; i < kCodeGenerations; i++)
+    {
+        u8* nearStart = NearStart + i * NearGenSize;
+        u8* farStart = FarStart + i * FarGenSize;
+        if (sizes[i][0] > NearGenSize || sizes[i][1] > FarGenSize
+            || fread(nearStart, 1, sizes[i][0], file) != sizes[i][0]
+            || fread(farStart, 1, sizes[i][1], file) != sizes[i][1])
+            return false;
+
+        loadedHash ^= XXH3_64bits(nearStart, sizes[i][0]);
+        loadedHash ^= XXH3_64bits(farStart, sizes[i][1]);
+        GenNearEnd[i] = nearStart + sizes[i][0];
+        GenFarEnd[i] = farStart + sizes[i][1];
+    }
+
+    // never run code from a damaged file
+    if (hash != loadedHash)
+        return false;
+
+    CurGeneration = layout[2];
+    SetCodePtr(GenNearEnd[CurGeneration]);
+    NearCode = GenNearEnd[CurGeneration];
+    FarCode = GenFarEnd[CurGeneration];
+
+    auto isLoaded = [this](u32 offset, u32 size)
+    {
+        u8* start = ResetStart + offset;
+        for (int i = 0; i < kCodeGenerations; i++)
+        {
+            if ((start >= NearStart + i * NearGenSize && start + size <= GenNearEnd[i])
+                || (start >= FarStart + i * FarGenSize && start + size <= GenFarEnd[i]))
+                return true;
+        }
+        return false;
+    };
+
+    u32 numRelocs;
+    if (fread(&numRelocs, sizeof(u32), 1, file) != 1)
+        return false;
+    for (u32 i = 0; i < numRelocs; i++)
+    {
+        u32 reloc[2];
+        if (fread(reloc, sizeof(u32), 2, file) != 2 || !isLoaded(reloc[0], 8))
+            return false;
+
+        void* fastMemStart = reloc[1] == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start;
+        memcpy(ResetStart + reloc[0], &fastMemStart, 8);
+        FastMemBaseRelocs[reloc[0]] = reloc[1];
+    }
+
+    u32 numPatches;
+    if (fread(&numPatches, sizeof(u32), 1, file) != 1)
+        return false;
+    for (u32 i = 0; i < numPatches; i++)
+    {
+        PersistentPatch patch;
+        if (fread(&patch, sizeof(PersistentPatch), 1, file) != 1 || !isLoaded(patch.Location, 1))
+            return false;
+
+        LoadStorePatch& dst = LoadStorePatches[ResetStart + patch.Location];
+        dst.PatchFunc = ResetStart + patch.PatchFunc;
+        dst.Offset = patch.Offset;
+        dst.Size = patch.Size;
+    }
+
+    return true;
+}
+
+void Compiler::TakeNewPatches(CodePatches& patches)
+{
+    patches.LoadStore.swap(NewPatches.LoadStore);
+    patches.FastMemBaseRelocs.swap(NewPatches.FastMemBaseRelocs);
+    NewPatches.LoadStore.clear();
+    NewPatches.FastMemBaseRelocs.clear();
+}
+
+void Compiler::CommitPatches(const CodePatches& patches)
+{
+    for (auto it : patches.LoadStore)
+        LoadStorePatches[it.first] = it.second;
+    for (auto it : patches.FastMemBaseRelocs)
+        FastMemBaseRelocs[it.first] = it.second;
 }
 
 bool Compiler::IsJITFault(u8* addr)
@@ -639,19 +871,99 @@ void Compiler::Comp_SpecialBranchBehaviour(bool taken)
     }
 }
 
-JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount)
+// jumps back to the start of the block instead of returning to the dispatcher,
+// if it wouldn't do anything besides running this block again
+void Compiler::Comp_LoopBack(u32 blockAddr, u64* entry, JitBlockEntry head)
 {
-    if (NearSize - (GetCodePtr() - NearStart) < 1024 * 32) // guess...
+    u64* timestamp = Num == 0 ? &NDS::ARM9Timestamp : &NDS::ARM7Timestamp;
+    u64* target = Num == 0 ? &NDS::ARM9Target : &NDS::ARM7Target;
+
+    // they're addressed relative to the code, so that it can be reused by the persistent cache
+    for (const void* ptr : {(const void*)timestamp, (const void*)target, (const void*)entry})
     {
-        printf("near reset\n");
-        ResetBlockCache();
+        s64 distance = (s64)ptr - (s64)GetWritableCodePtr();
+        if (distance < -0x70000000LL || distance > 0x70000000LL)
+            return;
     }
-    if (FarSize - (FarCode - FarStart) < 1024 * 32) // guess...
+
+    // the branch back wasn't taken
+    CMP(32, MDisp(RCPU, offsetof(ARM, R[15])), Imm32(blockAddr + (Thumb ? 2 : 4)));
+    FixupBranch notTaken = J_CC(CC_NE);
+    CMP(32, MDisp(RCPU, offsetof(ARM, StopExecution)), Imm8(0));
+    FixupBranch stopExecution = J_CC(CC_NE);
+    TEST(32, R(RCPSR), Imm32(0x20));
+    FixupBranch modeChanged = J_CC(Thumb ? CC_Z : CC_NZ);
+
+    MOVSX(64, 32, RSCRATCH, MDisp(RCPU, offsetof(ARM, Cycles)));
+    MOV(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm32(0));
+    ADD(64, R(RSCRATCH), M(timestamp));
+    MOV(64, M(timestamp), R(RSCRATCH));
+    CMP(64, R(RSCRATCH), M(target));
+    FixupBranch timeUp = J_CC(CC_AE);
+
+    // the block might have been invalidated
+    MOV(64, R(RSCRATCH), Imm64((((u64)blockAddr | Num) << 32) | SubEntryOffset(head)));
+    CMP(64, R(RSCRATCH), M(entry));
+    FixupBranch invalidated = J_CC(CC_NE);
+
+    // the code at the start of the block assumes that CPSR is up to date
+    MOV(32, MDisp(RCPU, offsetof(ARM, CPSR)), R(RCPSR));
+    JMP((u8*)head, true);
+
+    SetJumpTarget(notTaken);
+    SetJumpTarget(stopExecution);
+    SetJumpTarget(modeChanged);
+    SetJumpTarget(timeUp);
+    SetJumpTarget(invalidated);
+}
+
+// a copy or fill loop at the start of the block does all but the last of its
+// iterations at once each time it's entered. it's charged as many cycles as the
+// compiled code would take for them, the last iteration runs normally so that
+// the loaded registers and the flags end up the same
+void Compiler::Comp_BulkLoop(FetchedInstr instrs[], int instrsCount)
+{
+    BulkLoop loop;
+    if (!DecodeBulkLoop(Thumb, instrs, instrsCount, loop))
+        return;
+    u64 packedLoop;
+    memcpy(&packedLoop, &loop, sizeof(BulkLoop));
+
+    s32 cycles = 0;
+    for (int i = 0; i < instrsCount; i++)
     {
-        printf("far reset\n");
-        ResetBlockCache();
+        CurInstr = instrs[i];
+        R15 = CurInstr.Addr + (Thumb ? 4 : 8);
+        CodeRegion = R15 >> 24;
+
+        if (i == instrsCount - 1)
+            cycles += CurInstr.JumpCycles;
+        else if (CurInstr.Info.SpecialKind == ARMInstrInfo::special_LoadMem)
+            cycles += CyclesCDI();
+        else if (CurInstr.Info.SpecialKind == ARMInstrInfo::special_WriteMem)
+            cycles += CyclesCD();
+        else
+            cycles += CyclesC();
     }
 
+    // nothing is loaded into host registers yet
+    MOV(64, R(ABI_PARAM1), R(RCPU));
+    MOV(64, R(ABI_PARAM2), Imm64(packedLoop));
+    MOV(32, R(ABI_PARAM3), Imm32(cycles));
+    ABI_CallFunction(RunBulkLoop);
+}
+
+JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, JitBlockCode* code)
+{
+    NewPatches.LoadStore.clear();
+    NewPatches.FastMemBaseRelocs.clear();
+
+    // the current generation is full
+    if (NearStart + (CurGeneration + 1) * NearGenSize - GetCodePtr() < 1024 * 32) // guess...
+        return NULL;
+    if (FarStart + (CurGeneration + 1) * FarGenSize - FarCode < 1024 * 32) // guess...
+        return NULL;
+
     ConstantCycles = 0;
     Thumb = thumb;
     Num = cpu->Num;
@@ -661,9 +973,19 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
     CPSRDirty = false;
 
     JitBlockEntry res = (JitBlockEntry)GetWritableCodePtr();
+    u8* farStart = FarCode;
 
     RegCache = RegisterCache<Compiler, X64Reg>(this, instrs, instrsCount);
 
+    for (int i = 0; i < instrsCount; i++)
+    {
+        if (instrs[i].BranchFlags & branch_BulkLoop)
+        {
+            Comp_BulkLoop(instrs, i + 1);
+            break;
+        }
+    }
+
     for (int i = 0; i < instrsCount; i++)
     {
         CurInstr = instrs[i];
@@ -768,6 +1090,8 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
     RegCache.Flush();
 
     ADD(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm32(ConstantCycles));
+    if (instrs[instrsCount - 1].BranchFlags & branch_LoopBack)
+        Comp_LoopBack(instrs[0].Addr, instrs[instrsCount - 1].LoopEntry, res);
     JMP((u8*)ARM_Ret, true);
 
     /*FILE* codeout = fopen("codeout", "a");
@@ -776,14 +1100,82 @@ JitBlockEntry Compiler::CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[]
 
     fclose(codeout);*/
 
+    code->Near = (u8*)res;
+    code->NearSize = GetWritableCodePtr() - (u8*)res;
+    code->Far = farStart;
+    code->FarSize = FarCode - farStart;
+
     return res;
 }
 
-void Compiler::Comp_AddCycles_C(bool forceNonConstant)
+s32 Compiler::CyclesC()
 {
-    s32 cycles = Num ?
+    return Num ?
         NDS::ARM7MemTimings[CurInstr.CodeCycles][Thumb ? 1 : 3]
         : ((R15 & 0x2) ? 0 : CurInstr.CodeCycles);
+}
+
+s32 Compiler::CyclesCI()
+{
+    return Num ?
+        NDS::ARM7MemTimings[CurInstr.CodeCycles][Thumb ? 0 : 2]
+        : ((R15 & 0x2) ? 0 : CurInstr.CodeCycles);
+}
+
+s32 Compiler::CyclesCDI()
+{
+    if (Num == 0)
+        return CyclesCD();
+
+    s32 numC = NDS::ARM7MemTimings[CurInstr.CodeCycles][Thumb ? 0 : 2];
+    s32 numD = CurInstr.DataCycles;
+
+    if ((CurInstr.DataRegion >> 24) == 0x02) // mainRAM
+    {
+        if (CodeRegion == 0x02)
+            return numC + numD;
+
+        numC++;
+        return std::max(numC + numD - 3, std::max(numC, numD));
+    }
+    else if (CodeRegion == 0x02)
+    {
+        numD++;
+        return std::max(numC + numD - 3, std::max(numC, numD));
+    }
+    return numC + numD + 1;
+}
+
+s32 Compiler::CyclesCD()
+{
+    if (Num == 0)
+    {
+        s32 numC = (R15 & 0x2) ? 0 : CurInstr.CodeCycles;
+        s32 numD = CurInstr.DataCycles;
+
+        //if (DataRegion != CodeRegion)
+            return std::max(numC + numD - 6, std::max(numC, numD));
+    }
+
+    s32 numC = NDS::ARM7MemTimings[CurInstr.CodeCycles][Thumb ? 0 : 2];
+    s32 numD = CurInstr.DataCycles;
+
+    if ((CurInstr.DataRegion >> 4) == 0x02)
+    {
+        if (CodeRegion == 0x02)
+            return numC + numD;
+        return std::max(numC + numD - 3, std::max(numC, numD));
+    }
+    else if (CodeRegion == 0x02)
+    {
+        return std::max(numC + numD - 3, std::max(numC, numD));
+    }
+    return numC + numD;
+}
+
+void Compiler::Comp_AddCycles_C(bool forceNonConstant)
+{
+    s32 cycles = CyclesC();
 
     if ((!Thumb && CurInstr.Cond() < 0xE) || forceNonConstant)
         ADD(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm8(cycles));
@@ -793,9 +1185,7 @@ void Compiler::Comp_AddCycles_C(bool forceNonConstant)
 
 void Compiler::Comp_AddCycles_CI(u32 i)
 {
-    s32 cycles = (Num ?
-        NDS::ARM7MemTimings[CurInstr.CodeCycles][Thumb ? 0 : 2]
-        : ((R15 & 0x2) ? 0 : CurInstr.CodeCycles)) + i;
+    s32 cycles = CyclesCI() + i;
 
     if (!Thumb && CurInstr.Cond() < 0xE)
         ADD(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm8(cycles));
@@ -805,9 +1195,7 @@ void Compiler::Comp_AddCycles_CI(u32 i)
 
 void Compiler::Comp_AddCycles_CI(Gen::X64Reg i, int add)
 {
-    s32 cycles = Num ?
-        NDS::ARM7MemTimings[CurInstr.CodeCycles][Thumb ? 0 : 2]
-        : ((R15 & 0x2) ? 0 : CurInstr.CodeCycles);
+    s32 cycles = CyclesCI();
     
     if (!Thumb && CurInstr.Cond() < 0xE)
     {
@@ -829,31 +1217,8 @@ void Compiler::Comp_AddCycles_CDI()
     {
         IrregularCycles = true;
 
-        s32 cycles;
-
-        s32 numC = NDS::ARM7MemTimings[CurInstr.CodeCycles][Thumb ? 0 : 2];
-        s32 numD = CurInstr.DataCycles;
+        s32 cycles = CyclesCDI();
 
-        if ((CurInstr.DataRegion >> 24) == 0x02) // mainRAM
-        {
-            if (CodeRegion == 0x02)
-                cycles = numC + numD;
-            else
-            {
-                numC++;
-                cycles = std::max(numC + numD - 3, std::max(numC, numD));
-            }
-        }
-        else if (CodeRegion == 0x02)
-        {
-            numD++;
-            cycles = std::max(numC + numD - 3, std::max(numC, numD));
-        }
-        else
-        {
-            cycles = numC + numD + 1;
-        }
-        
         if (!Thumb && CurInstr.Cond() < 0xE)
             ADD(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm8(cycles));
         else
@@ -863,40 +1228,8 @@ void Compiler::Comp_AddCycles_CDI()
 
 void Compiler::Comp_AddCycles_CD()
 {
-    u32 cycles = 0;
-    if (Num == 0)
-    {
-        s32 numC = (R15 & 0x2) ? 0 : CurInstr.CodeCycles;
-        s32 numD = CurInstr.DataCycles;
-
-        //if (DataRegion != CodeRegion)
-            cycles = std::max(numC + numD - 6, std::max(numC, numD));
-
-        IrregularCycles = cycles != numC;
-    }
-    else
-    {
-        s32 numC = NDS::ARM7MemTimings[CurInstr.CodeCycles][Thumb ? 0 : 2];
-        s32 numD = CurInstr.DataCycles;
-
-        if ((CurInstr.DataRegion >> 4) == 0x02)
-        {
-            if (CodeRegion == 0x02)
-                cycles += numC + numD;
-            else
-                cycles += std::max(numC + numD - 3, std::max(numC, numD));
-        }
-        else if (CodeRegion == 0x02)
-        {
-            cycles += std::max(numC + numD - 3, std::max(numC, numD));
-        }
-        else
-        {
-            cycles += numC + numD;
-        }
-
-        IrregularCycles = true;
-    }
+    s32 cycles = CyclesCD();
+    IrregularCycles = Num == 1 || cycles != ((R15 & 0x2) ? 0 : CurInstr.CodeCycles);
 
     if (IrregularCycles && !Thumb && CurInstr.Cond() < 0xE)
         ADD(32, MDisp(RCPU, offsetof(ARM, Cycles)), Imm8(cycles));
@@ -7,7 +7,10 @@
 #include "../ARMJIT_Internal.h"
 #include "../ARMJIT_RegisterCache.h"
 
+#include <stdio.h>
+#include <map>
 #include <unordered_map>
+#include <vector>
 
 namespace ARMJIT
 {
@@ -27,6 +30,14 @@ struct LoadStorePatch
     u16 Size;
 };
 
+// the patches and relocations of a newly compiled block, they're
+// only registered by the emulation thread, see Compiler::NewPatches
+struct CodePatches
+{
+    std::vector<std::pair<u8*, LoadStorePatch>> LoadStore;
+    std::vector<std::pair<u32, u32>> FastMemBaseRelocs;
+};
+
 struct Op2
 {
     Op2()
@@ -54,6 +65,10 @@ struct Op2
     };
 };
 
+// the code memory is split into generations which are filled one after another.
+// once the last one is full, the oldest one is freed and reused
+const int kCodeGenerations = 8;
+
 class Compiler : public Gen::XEmitter
 {
 public:
@@ -61,7 +76,26 @@ public:
 
     void Reset();
 
-    JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount);
+    int GetGeneration(JitBlockEntry entry)
+    {
+        return ((u8*)entry - NearStart) / NearGenSize;
+    }
+
+    int GetNextGeneration()
+    {
+        return (CurGeneration + 1) % kCodeGenerations;
+    }
+
+    // all blocks inside the next generation have to be removed before
+    void SwitchGeneration();
+
+    void GetCodeMemUsage(u32& size, u32& used);
+
+    JitBlockEntry CompileBlock(ARM* cpu, bool thumb, FetchedInstr instrs[], int instrsCount, JitBlockCode* code);
+    // moves the patches of the last compiled block out
+    void TakeNewPatches(CodePatches& patches);
+    // has to be called on the emulation thread, before the block is entered
+    void CommitPatches(const CodePatches& patches);
 
     void LoadReg(int reg, Gen::X64Reg nativeReg);
     void SaveReg(int reg, Gen::X64Reg nativeReg);
@@ -79,6 +113,12 @@ public:
     void Comp_AddCycles_CDI();
     void Comp_AddCycles_CD();
 
+    // the cycles added by the functions above for CurInstr
+    s32 CyclesC();
+    s32 CyclesCI();
+    s32 CyclesCDI();
+    s32 CyclesCD();
+
     enum
     {
         opSetsFlags = 1 << 0,
@@ -159,6 +199,8 @@ public:
     void Comp_RetriveFlags(bool sign, bool retriveCV, bool carryUsed);
 
     void Comp_SpecialBranchBehaviour(bool taken);
+    void Comp_LoopBack(u32 blockAddr, u64* entry, JitBlockEntry head);
+    void Comp_BulkLoop(FetchedInstr instrs[], int instrsCount);
 
 
     Gen::OpArg Comp_RegShiftImm(int op, int amount, Gen::OpArg rm, bool S, bool& carryUsed);
@@ -212,6 +254,12 @@ public:
 
     u8* RewriteMemAccess(u8* pc);
 
+    void LoadFastMemBase(Gen::X64Reg reg);
+
+    // used by the persistent block cache
+    bool SaveCode(FILE* file);
+    bool LoadCode(FILE* file);
+
     u8* FarCode;
     u8* NearCode;
     u32 FarSize;
@@ -220,12 +268,31 @@ public:
     u8* NearStart;
     u8* FarStart;
 
+    u32 NearGenSize;
+    u32 FarGenSize;
+    int CurGeneration;
+    // where the code inside each generation ends,
+    // updated for the current one once it's left
+    u8* GenNearEnd[kCodeGenerations];
+    u8* GenFarEnd[kCodeGenerations];
+
     void* PatchedStoreFuncs[2][2][3][16];
     void* PatchedLoadFuncs[2][2][3][2][16];
 
+    // only touched by the emulation thread, so that the fault handler
+    // can use them without taking the compiler lock
     std::unordered_map<u8*, LoadStorePatch> LoadStorePatches;
 
+    // code offsets of the fast memory base pointers embedded into the code
+    // and the CPU they belong to. they're patched when loading code from disk
+    std::map<u32, u32> FastMemBaseRelocs;
+
+    // collected while compiling a block, possibly on the compile thread
+    CodePatches NewPatches;
+
     u8* ResetStart;
+    // the whole space available for blocks, Config::JIT_CodeCacheSize
+    // of it is used
     u32 CodeMemSize;
 
     bool Exit;
@@ -247,6 +314,8 @@ public:
 
     u32 ConstantCycles;
 
+    // may only be used to tell which CPU it is, with Config::JIT_AsyncCompile
+    // it keeps on running while its code is compiled
     ARM* CurCPU;
 };
 
@@ -23,6 +23,10 @@ u8* Compiler::RewriteMemAccess(u8* pc)
         LoadStorePatch patch = it->second;
         LoadStorePatches.erase(it);
 
+        u32 patchStart = pc + (ptrdiff_t)patch.Offset - ResetStart;
+        FastMemBaseRelocs.erase(FastMemBaseRelocs.lower_bound(patchStart),
+            FastMemBaseRelocs.lower_bound(patchStart + patch.Size));
+
         //printf("rewriting memory access %p %d %d\n", (u8*)pc-ResetStart, patch.Offset, patch.Size);
 
         XEmitter emitter(pc + (ptrdiff_t)patch.Offset);
@@ -39,6 +43,16 @@ u8* Compiler::RewriteMemAccess(u8* pc)
     abort();
 }
 
+void Compiler::LoadFastMemBase(X64Reg reg)
+{
+    // always use the full 64-bit immediate, so that it can be patched
+    // if the code is loaded from disk and the fast memory area moved
+    Write8(0x48 | (reg >> 3));
+    Write8(0xB8 + (reg & 7));
+    NewPatches.FastMemBaseRelocs.push_back({(u32)(GetWritableCodePtr() - ResetStart), Num});
+    Write64((u64)(Num == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start));
+}
+
 /*
     According to DeSmuME and my own research, approx. 99% (seriously, that's an empirical number)
     of all memory load and store instructions always access addresses in the same region as
@@ -51,39 +65,28 @@ u8* Compiler::RewriteMemAccess(u8* pc)
 
 bool Compiler::Comp_MemLoadLiteral(int size, bool signExtend, int rd, u32 addr)
 {
-    u32 localAddr = LocaliseCodeAddress(Num, addr);
-
-    int invalidLiteralIdx = InvalidLiterals.Find(localAddr);
-    if (invalidLiteralIdx != -1)
-    {
-        InvalidLiterals.Remove(invalidLiteralIdx);
+    if (!CurInstr.HasLiteral)
         return false;
-    }
 
     Comp_AddCycles_CDI();
 
     u32 val;
-    // make sure arm7 bios is accessible
-    u32 tmpR15 = CurCPU->R[15];
-    CurCPU->R[15] = R15;
     if (size == 32)
     {
-        CurCPU->DataRead32(addr & ~0x3, &val);
-        val = ::ROR(val, (addr & 0x3) << 3);
+        val = ::ROR(CurInstr.LiteralValue, (addr & 0x3) << 3);
     }
     else if (size == 16)
     {
-        CurCPU->DataRead16(addr & ~0x1, &val);
+        val = (CurInstr.LiteralValue >> ((addr & 0x2) << 3)) & 0xFFFF;
         if (signExtend)
             val = ((s32)val << 16) >> 16;
     }
     else
     {
-        CurCPU->DataRead8(addr, &val);
+        val = (CurInstr.LiteralValue >> ((addr & 0x3) << 3)) & 0xFF;
         if (signExtend)
             val = ((s32)val << 24) >> 24;
     }
-    CurCPU->R[15] = tmpR15;
 
     MOV(32, MapReg(rd), Imm32(val));
 
@@ -173,9 +176,7 @@ void Compiler::Comp_MemAccess(int rd, int rn, const Op2& op2, int size, int flag
     if ((flags & memop_Writeback) && !(flags & memop_Post))
         MOV(32, rnMapped, R(finalAddr));
 
-    u32 expectedTarget = Num == 0
-        ? ARMJIT_Memory::ClassifyAddress9(CurInstr.DataRegion)
-        : ARMJIT_Memory::ClassifyAddress7(CurInstr.DataRegion);
+    u32 expectedTarget = CurInstr.DataMemRegion;
 
     if (Config::JIT_FastMemory && ((!Thumb && CurInstr.Cond() != 0xE) || ARMJIT_Memory::IsFastmemCompatible(expectedTarget)))
     {
@@ -195,7 +196,7 @@ void Compiler::Comp_MemAccess(int rd, int rn, const Op2& op2, int size, int flag
 
         assert(patch.PatchFunc != NULL);
 
-        MOV(64, R(RSCRATCH), ImmPtr(Num == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start));
+        LoadFastMemBase(RSCRATCH);
 
         X64Reg maskedAddr = RSCRATCH3;
         if (size > 8)
@@ -238,7 +239,7 @@ void Compiler::Comp_MemAccess(int rd, int rn, const Op2& op2, int size, int flag
 
         assert(patch.Size >= 5);
 
-        LoadStorePatches[memopLoadStoreLocation] = patch;
+        NewPatches.LoadStore.push_back({memopLoadStoreLocation, patch});
     }
     else
     {
@@ -396,9 +397,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
 
     s32 offset = (regsCount * 4) * (decrement ? -1 : 1);
 
-    int expectedTarget = Num == 0
-        ? ARMJIT_Memory::ClassifyAddress9(CurInstr.DataRegion)
-        : ARMJIT_Memory::ClassifyAddress7(CurInstr.DataRegion);
+    int expectedTarget = CurInstr.DataMemRegion;
 
     if (!store)
         Comp_AddCycles_CDI();
@@ -429,7 +428,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
         u8* fastPathStart = GetWritableCodePtr();
         u8* loadStoreAddr[16];
 
-        MOV(64, R(RSCRATCH2), ImmPtr(Num == 0 ? ARMJIT_Memory::FastMem9Start : ARMJIT_Memory::FastMem7Start));
+        LoadFastMemBase(RSCRATCH2);
         ADD(64, R(RSCRATCH2), R(RSCRATCH4));
 
         u32 offset = 0;
@@ -476,7 +475,7 @@ s32 Compiler::Comp_MemAccessBlock(int rn, BitSet16 regs, bool store, bool preinc
         for (i = 0; i < regsCount; i++)
         {
             patch.Offset = fastPathStart - loadStoreAddr[i];
-            LoadStorePatches[loadStoreAddr[i]] = patch;
+            NewPatches.LoadStore.push_back({loadStoreAddr[i], patch});
         }
     }
 
@@ -0,0 +1,132 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// threaded interpreter loop, included in the body of ARMv5::Execute() and ARMv4::Execute()
+//
+// every handler gets its own label which calls it directly, followed by its own
+// copy of the loop tail: timestamp update, prefetch, condition check and an
+// indirect jump to the next handler. the host branch predictor thus gets one
+// dispatch site per handler instead of a single shared one.
+//
+// the including function has to define:
+// * TD_TIMESTAMP, TD_TARGET: timestamp and target of the CPU
+// * TD_PREFETCH_THUMB(), TD_PREFETCH_ARM(): advance the pipeline, like Execute() does
+// * TD_CONDFAILED(): what to do with an ARM instruction whose condition failed
+//
+// handlers which aren't in INTERP_ARM_HANDLERS/INTERP_THUMB_HANDLERS go
+// through the regular function tables
+
+{
+    static void* armDispatch[4096];
+    static void* thumbDispatch[1024];
+    static bool dispatchInit = false;
+
+#define TD_LABEL(f) &&label_##f,
+#define TD_FUNC(f) &ARMInterpreter::f,
+
+    if (!dispatchInit)
+    {
+        static void* const armLabels[] = { INTERP_ARM_HANDLERS(TD_LABEL) };
+        static const InterpreterFunc armFuncs[] = { INTERP_ARM_HANDLERS(TD_FUNC) };
+        static void* const thumbLabels[] = { INTERP_THUMB_HANDLERS(TD_LABEL) };
+        static const InterpreterFunc thumbFuncs[] = { INTERP_THUMB_HANDLERS(TD_FUNC) };
+
+        BuildDispatchTable(armDispatch, ARMInterpreter::ARMInstrTable, 4096,
+                           armLabels, armFuncs, sizeof(armFuncs) / sizeof(armFuncs[0]), &&armFallback);
+        BuildDispatchTable(thumbDispatch, ARMInterpreter::THUMBInstrTable, 1024,
+                           thumbLabels, thumbFuncs, sizeof(thumbFuncs) / sizeof(thumbFuncs[0]), &&thumbFallback);
+        dispatchInit = true;
+    }
+
+#undef TD_LABEL
+#undef TD_FUNC
+
+#define TD_DISPATCH() \
+    if (CPSR & 0x20) \
+    { \
+        TD_PREFETCH_THUMB(); \
+        goto *thumbDispatch[(CurInstr >> 6) & 0x3FF]; \
+    } \
+    TD_PREFETCH_ARM(); \
+    if (CheckCondition(CurInstr >> 28)) \
+        goto *armDispatch[((CurInstr >> 4) & 0xF) | ((CurInstr >> 16) & 0xFF0)]; \
+    goto condFailed;
+
+#define TD_NEXT() \
+    if (StopExecution) goto stopExecution; \
+    TD_TIMESTAMP += Cycles; \
+    Cycles = 0; \
+    if (TD_TIMESTAMP >= TD_TARGET) goto done; \
+    TD_DISPATCH()
+
+#define TD_HANDLER(f) \
+    label_##f: \
+    ARMInterpreter::f(this); \
+    TD_NEXT()
+
+    if (TD_TIMESTAMP >= TD_TARGET) goto done;
+    TD_DISPATCH()
+
+    INTERP_ARM_HANDLERS(TD_HANDLER)
+    INTERP_THUMB_HANDLERS(TD_HANDLER)
+
+armFallback:
+    ARMInterpreter::ARMInstrTable[((CurInstr >> 4) & 0xF) | ((CurInstr >> 16) & 0xFF0)](this);
+    TD_NEXT()
+
+thumbFallback:
+    ARMInterpreter::THUMBInstrTable[(CurInstr >> 6) & 0x3FF](this);
+    TD_NEXT()
+
+condFailed:
+    TD_CONDFAILED();
+    TD_NEXT()
+
+stopExecution:
+    if (Halted)
+    {
+        if (Halted == 1 && TD_TIMESTAMP < TD_TARGET)
+        {
+            TD_TIMESTAMP = TD_TARGET;
+        }
+        goto done;
+    }
+    if (IRQ) TriggerIRQ();
+
+    if (IdleLoop)
+    {
+        // nothing will change before the end of this timeslice
+        IdleLoop = 0;
+        TD_TIMESTAMP += Cycles;
+        Cycles = 0;
+        if (TD_TIMESTAMP < TD_TARGET)
+            TD_TIMESTAMP = TD_TARGET;
+        goto done;
+    }
+
+    TD_TIMESTAMP += Cycles;
+    Cycles = 0;
+    if (TD_TIMESTAMP >= TD_TARGET) goto done;
+    TD_DISPATCH()
+
+#undef TD_HANDLER
+#undef TD_NEXT
+#undef TD_DISPATCH
+
+done:;
+}
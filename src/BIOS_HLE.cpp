@@ -0,0 +1,506 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "BIOS_HLE.h"
+#include "Config.h"
+#include "NDS.h"
+#include "ARM.h"
+#ifdef JIT_ENABLED
+#include "ARMJIT.h"
+#include "ARMJIT_Memory.h"
+#endif
+
+
+namespace BIOS_HLE
+{
+
+// costs of the BIOS routines, in cycles of the CPU running them. they were
+// fitted to LLE runs with --bios-hle-validate: 256 and 128 unit copies/fills
+// and 1KB decompressions, into VRAM on the ARM9 and main RAM on the ARM7.
+// the fit is within 1.5x of every run.
+// no retail BIOS was available, so the runs used the hand-written test BIOS
+// (swibios9.bin/swibios7.bin). the numbers are provisional until they're
+// fitted again against retail ARM9 and ARM7 BIOS runs with --bios-hle-validate
+struct CycleCosts
+{
+    s32 Call;
+    s32 Div;
+    s32 Sqrt;
+    s32 CpuSetUnit;
+    s32 CpuFastSetWord;
+    s32 LZ77Byte;
+    s32 RLByte;
+};
+
+const CycleCosts Costs[2] =
+{
+    {250, 2050, 950, 66, 78, 99, 75}, // ARM9
+    {40, 270, 125, 21, 23, 25, 17}, // ARM7
+};
+
+enum
+{
+    swi_Div = 0x09,
+    swi_CpuSet = 0x0B,
+    swi_CpuFastSet = 0x0C,
+    swi_Sqrt = 0x0D,
+    swi_LZ77UnCompWram = 0x11,
+    swi_RLUnCompWram = 0x14,
+};
+
+// what a SWI does, so that it can either be applied or compared
+// against what the BIOS did
+struct Result
+{
+    u32 Regs[4];
+    u32 RegsMask;
+
+    // written memory, accessed in units of OutUnit bytes
+    u32 OutAddr;
+    u32 OutUnit;
+    std::vector<u8> Out;
+
+    s32 Cycles;
+};
+
+struct Validation
+{
+    bool Pending;
+    u32 SWI;
+    u32 ReturnAddr;
+    u64 StartTime;
+    Result Expected;
+};
+
+Validation Validations[2];
+// timing differences are only reported once per SWI and CPU
+u32 TimingReported[2];
+
+
+void Reset()
+{
+    Validations[0].Pending = false;
+    Validations[1].Pending = false;
+    TimingReported[0] = 0;
+    TimingReported[1] = 0;
+}
+
+u64 GetTime(ARM* cpu)
+{
+    return (cpu->Num == 0 ? NDS::ARM9Timestamp : NDS::ARM7Timestamp) + cpu->Cycles;
+}
+
+// number of bytes starting at addr which can be accessed without side effects,
+// everything else (I/O, the BIOS itself, ...) is left to the BIOS code
+u32 PlainMemorySize(ARM* cpu, u32 addr)
+{
+    if (cpu->Num == 0)
+    {
+        ARMv5* cpuv5 = (ARMv5*)cpu;
+        if (addr < cpuv5->ITCMSize)
+            return cpuv5->ITCMSize - addr;
+        if (addr >= cpuv5->DTCMBase && addr - cpuv5->DTCMBase < cpuv5->DTCMSize)
+            return cpuv5->DTCMSize - (addr - cpuv5->DTCMBase);
+    }
+
+    switch (addr >> 24)
+    {
+    case 0x02:
+    case 0x03:
+    case 0x06:
+        break;
+    case 0x05: // palette and OAM
+    case 0x07:
+        if (cpu->Num == 0)
+            break;
+        return 0;
+    default:
+        return 0;
+    }
+    return 0x1000000 - (addr & 0xFFFFFF);
+}
+
+bool IsPlainMemory(ARM* cpu, u32 addr, u32 len)
+{
+    return len <= PlainMemorySize(cpu, addr);
+}
+
+// main RAM which can be accessed directly, the DTCM might lie over it
+u8* GetMainRAM(ARM* cpu, u32 addr, u32 len)
+{
+    if ((addr >> 24) != 0x02 || (addr & NDS::MainRAMMask) + len > NDS::MainRAMMask + 1)
+        return NULL;
+
+    if (cpu->Num == 0)
+    {
+        ARMv5* cpuv5 = (ARMv5*)cpu;
+        if (addr < cpuv5->DTCMBase + cpuv5->DTCMSize && addr + len > cpuv5->DTCMBase)
+            return NULL;
+    }
+
+    return &NDS::MainRAM[addr & NDS::MainRAMMask];
+}
+
+void ReadMemory(ARM* cpu, u32 addr, u8* data, u32 len, u32 unit)
+{
+    u8* ptr = GetMainRAM(cpu, addr, len);
+    if (ptr)
+    {
+        memcpy(data, ptr, len);
+        return;
+    }
+
+    for (u32 i = 0; i < len; i += unit)
+    {
+        u32 val;
+        switch (unit)
+        {
+        case 1: cpu->DataRead8(addr + i, &val); data[i] = val; break;
+        case 2: cpu->DataRead16(addr + i, &val); *(u16*)&data[i] = val; break;
+        case 4: cpu->DataRead32(addr + i, &val); *(u32*)&data[i] = val; break;
+        }
+    }
+}
+
+void WriteMemory(ARM* cpu, u32 addr, const u8* data, u32 len, u32 unit)
+{
+    u8* ptr = GetMainRAM(cpu, addr, len);
+    if (ptr)
+    {
+        memcpy(ptr, data, len);
+#ifdef JIT_ENABLED
+        for (u32 i = addr & ~0xF; i < addr + len; i += 16)
+        {
+            if (cpu->Num == 0)
+                ARMJIT::CheckAndInvalidate<0, ARMJIT_Memory::memregion_MainRAM>(i);
+            else
+                ARMJIT::CheckAndInvalidate<1, ARMJIT_Memory::memregion_MainRAM>(i);
+        }
+#endif
+        return;
+    }
+
+    for (u32 i = 0; i < len; i += unit)
+    {
+        switch (unit)
+        {
+        case 1: cpu->DataWrite8(addr + i, data[i]); break;
+        case 2: cpu->DataWrite16(addr + i, *(u16*)&data[i]); break;
+        case 4: cpu->DataWrite32(addr + i, *(u32*)&data[i]); break;
+        }
+    }
+}
+
+bool Div(ARM* cpu, Result& res)
+{
+    s32 num = (s32)cpu->R[0];
+    s32 den = (s32)cpu->R[1];
+    if (den == 0 || (num == INT32_MIN && den == -1))
+        return false;
+
+    s32 quot = num / den;
+    res.Regs[0] = quot;
+    res.Regs[1] = num % den;
+    res.Regs[3] = quot < 0 ? -quot : quot;
+    res.RegsMask = (1 << 0) | (1 << 1) | (1 << 3);
+    res.Cycles = Costs[cpu->Num].Div;
+    return true;
+}
+
+bool Sqrt(ARM* cpu, Result& res)
+{
+    u32 val = cpu->R[0];
+    u32 root = 0;
+    for (u32 bit = 1 << 30; bit; bit >>= 2)
+    {
+        if (val >= root + bit)
+        {
+            val -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+            root >>= 1;
+    }
+
+    res.Regs[0] = root;
+    res.RegsMask = 1 << 0;
+    res.Cycles = Costs[cpu->Num].Sqrt;
+    return true;
+}
+
+// CpuSet and CpuFastSet
+bool Copy(ARM* cpu, Result& res, u32 count, u32 unit, bool fill)
+{
+    u32 src = cpu->R[0] & ~(unit - 1);
+    u32 dst = cpu->R[1] & ~(unit - 1);
+    u32 len = count * unit;
+    u32 srcLen = fill ? unit : len;
+
+    if (count == 0 || !IsPlainMemory(cpu, src, srcLen) || !IsPlainMemory(cpu, dst, len))
+        return false;
+    // the BIOS copies upwards one by one
+    if (!fill && src < dst + len && dst < src + len)
+        return false;
+
+    res.OutAddr = dst;
+    res.OutUnit = unit;
+    res.Out.resize(len);
+    ReadMemory(cpu, src, res.Out.data(), srcLen, unit);
+    if (fill)
+    {
+        for (u32 i = unit; i < len; i += unit)
+            memcpy(&res.Out[i], &res.Out[0], unit);
+    }
+    return true;
+}
+
+bool CpuSet(ARM* cpu, Result& res)
+{
+    u32 count = cpu->R[2] & 0x1FFFFF;
+    res.Cycles = count * Costs[cpu->Num].CpuSetUnit;
+    return Copy(cpu, res, count, (cpu->R[2] & (1 << 26)) ? 4 : 2, cpu->R[2] & (1 << 24));
+}
+
+bool CpuFastSet(ARM* cpu, Result& res)
+{
+    // always done in blocks of 8 words
+    u32 count = ((cpu->R[2] & 0x1FFFFF) + 7) & ~7;
+    res.Cycles = count * Costs[cpu->Num].CpuFastSetWord;
+    return Copy(cpu, res, count, 4, cpu->R[2] & (1 << 24));
+}
+
+// reads the header and the compressed data as far as it could be needed
+bool ReadCompressed(ARM* cpu, u32 type, std::vector<u8>& in, u32& size, u32& inAddr)
+{
+    u32 src = cpu->R[0];
+    if ((src & 0x3) || !IsPlainMemory(cpu, src, 4))
+        return false;
+
+    u32 header;
+    ReadMemory(cpu, src, (u8*)&header, 4, 4);
+    size = header >> 8;
+    if ((header & 0xF0) != type || size == 0)
+        return false;
+
+    // nothing takes more than 9 bits per decompressed byte
+    inAddr = src + 4;
+    u32 inLen = std::min(PlainMemorySize(cpu, inAddr), size + (size + 7) / 8 + 1);
+    in.resize(inLen);
+    ReadMemory(cpu, inAddr, in.data(), inLen, 1);
+    return true;
+}
+
+// the input must be fully read before the output overwrites it
+bool Overlaps(u32 inAddr, u32 inLen, u32 outAddr, u32 outLen)
+{
+    return inAddr < outAddr + outLen && outAddr < inAddr + inLen;
+}
+
+bool LZ77UnComp(ARM* cpu, Result& res)
+{
+    std::vector<u8> in;
+    u32 size, inAddr;
+    if (!ReadCompressed(cpu, 0x10, in, size, inAddr) || !IsPlainMemory(cpu, cpu->R[1], size))
+        return false;
+
+    std::vector<u8>& out = res.Out;
+    out.resize(size);
+    u32 inPos = 0, outPos = 0;
+    while (outPos < size)
+    {
+        if (inPos >= in.size())
+            return false;
+        u8 flags = in[inPos++];
+
+        for (int i = 0; i < 8 && outPos < size; i++, flags <<= 1)
+        {
+            if (flags & 0x80)
+            {
+                if (inPos + 2 > in.size())
+                    return false;
+                u32 len = (in[inPos] >> 4) + 3;
+                u32 disp = (((in[inPos] & 0xF) << 8) | in[inPos + 1]) + 1;
+                inPos += 2;
+
+                // references in front of the output or past its end
+                if (disp > outPos || outPos + len > size)
+                    return false;
+                for (u32 j = 0; j < len; j++, outPos++)
+                    out[outPos] = out[outPos - disp];
+            }
+            else
+            {
+                if (inPos >= in.size())
+                    return false;
+                out[outPos++] = in[inPos++];
+            }
+        }
+    }
+
+    if (Overlaps(inAddr, inPos, cpu->R[1], size))
+        return false;
+
+    res.OutAddr = cpu->R[1];
+    res.OutUnit = 1;
+    res.Cycles = size * Costs[cpu->Num].LZ77Byte;
+    return true;
+}
+
+bool RLUnComp(ARM* cpu, Result& res)
+{
+    std::vector<u8> in;
+    u32 size, inAddr;
+    if (!ReadCompressed(cpu, 0x30, in, size, inAddr) || !IsPlainMemory(cpu, cpu->R[1], size))
+        return false;
+
+    std::vector<u8>& out = res.Out;
+    out.resize(size);
+    u32 inPos = 0, outPos = 0;
+    while (outPos < size)
+    {
+        if (inPos >= in.size())
+            return false;
+        u8 flag = in[inPos++];
+
+        if (flag & 0x80)
+        {
+            u32 len = (flag & 0x7F) + 3;
+            if (inPos >= in.size() || outPos + len > size)
+                return false;
+            memset(&out[outPos], in[inPos++], len);
+            outPos += len;
+        }
+        else
+        {
+            u32 len = (flag & 0x7F) + 1;
+            if (inPos + len > in.size() || outPos + len > size)
+                return false;
+            memcpy(&out[outPos], &in[inPos], len);
+            inPos += len;
+            outPos += len;
+        }
+    }
+
+    if (Overlaps(inAddr, inPos, cpu->R[1], size))
+        return false;
+
+    res.OutAddr = cpu->R[1];
+    res.OutUnit = 1;
+    res.Cycles = size * Costs[cpu->Num].RLByte;
+    return true;
+}
+
+bool HandleSWI(ARM* cpu, u32 num)
+{
+    // the DSi BIOS is different, and the ARM9 might have its vectors in the ITCM
+    if (NDS::ConsoleType != 0 || (cpu->Num == 0 && cpu->ExceptionBase != 0xFFFF0000))
+        return false;
+
+    Result res;
+    res.RegsMask = 0;
+    res.Cycles = 0;
+
+    bool handled;
+    switch (num)
+    {
+    case swi_Div: handled = Div(cpu, res); break;
+    case swi_CpuSet: handled = CpuSet(cpu, res); break;
+    case swi_CpuFastSet: handled = CpuFastSet(cpu, res); break;
+    case swi_Sqrt: handled = Sqrt(cpu, res); break;
+    case swi_LZ77UnCompWram: handled = LZ77UnComp(cpu, res); break;
+    case swi_RLUnCompWram: handled = RLUnComp(cpu, res); break;
+    default: handled = false; break;
+    }
+    if (!handled)
+        return false;
+
+    if (Config::BIOS_HLE == 2)
+    {
+        Validation& validation = Validations[cpu->Num];
+        validation.Pending = true;
+        validation.SWI = num;
+        validation.ReturnAddr = cpu->R[15] - ((cpu->CPSR & 0x20) ? 2 : 4);
+        validation.StartTime = GetTime(cpu);
+        validation.Expected = std::move(res);
+        return false;
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (res.RegsMask & (1 << i))
+            cpu->R[i] = res.Regs[i];
+    }
+    if (res.Out.size())
+        WriteMemory(cpu, res.OutAddr, res.Out.data(), res.Out.size(), res.OutUnit);
+
+    cpu->Cycles += Costs[cpu->Num].Call + res.Cycles;
+    return true;
+}
+
+void CheckReturn(ARM* cpu, u32 addr)
+{
+    Validation& validation = Validations[cpu->Num];
+    if (!validation.Pending || (addr & ~0x1) != validation.ReturnAddr)
+        return;
+    validation.Pending = false;
+
+    Result& expected = validation.Expected;
+    s32 cycles = GetTime(cpu) - validation.StartTime;
+    s32 expectedCycles = Costs[cpu->Num].Call + expected.Cycles;
+
+    for (int i = 0; i < 4; i++)
+    {
+        if ((expected.RegsMask & (1 << i)) && cpu->R[i] != expected.Regs[i])
+        {
+            printf("BIOS HLE: SWI %02X on ARM%d returned R%d=%08X instead of %08X\n",
+                validation.SWI, cpu->Num ? 7 : 9, i, cpu->R[i], expected.Regs[i]);
+        }
+    }
+
+    u32 len = expected.Out.size();
+    if (len)
+    {
+        std::vector<u8> out(len);
+        ReadMemory(cpu, expected.OutAddr, out.data(), len, expected.OutUnit);
+        for (u32 i = 0; i < len; i++)
+        {
+            if (out[i] != expected.Out[i])
+            {
+                printf("BIOS HLE: SWI %02X on ARM%d wrote %02X instead of %02X to %08X (%u bytes from %08X)\n",
+                    validation.SWI, cpu->Num ? 7 : 9, out[i], expected.Out[i],
+                    expected.OutAddr + i, len, expected.OutAddr);
+                break;
+            }
+        }
+    }
+
+    u32 swiBit = 1 << (validation.SWI & 0x1F);
+    if ((cycles > expectedCycles * 2 || cycles * 2 < expectedCycles)
+        && !(TimingReported[cpu->Num] & swiBit))
+    {
+        TimingReported[cpu->Num] |= swiBit;
+        printf("BIOS HLE: SWI %02X on ARM%d took %d cycles, estimated %d\n",
+            validation.SWI, cpu->Num ? 7 : 9, cycles, expectedCycles);
+    }
+}
+
+}
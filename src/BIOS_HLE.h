@@ -0,0 +1,50 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef BIOS_HLE_H
+#define BIOS_HLE_H
+
+#include "types.h"
+
+class ARM;
+
+// high level emulation of the BIOS SWIs which games use for bulk work,
+// used in DS mode if Config::BIOS_HLE is set:
+// 1 performs them natively instead of running the BIOS code
+// 2 still runs the BIOS code, but compares its results with what
+//   the HLE would have done and reports differences
+//
+// handled are Div, Sqrt, CpuSet, CpuFastSet, LZ77UnCompWram and
+// RLUnCompWram. the decompression SWIs which read their input through
+// callbacks (LZ77 and RL to VRAM, Huffman) would have to run game code
+// and are left to the BIOS, like everything with unusual parameters
+namespace BIOS_HLE
+{
+
+void Reset();
+
+// called by the SWI instructions with the number of the SWI. returns
+// true if it was handled, otherwise the exception has to be taken
+bool HandleSWI(ARM* cpu, u32 num);
+
+// called on every return from an exception, for the validation
+void CheckReturn(ARM* cpu, u32 addr);
+
+}
+
+#endif // BIOS_HLE_H
@@ -27,14 +27,6 @@
 #include "ARMJIT_Memory.h"
 #endif
 
-// access timing for cached regions
-// this would be an average between cache hits and cache misses
-// this was measured to be close to hardware average
-// a value of 1 would represent a perfect cache, but that causes
-// games to run too fast, causing a number of issues
-const int kDataCacheTiming = 3;//2;
-const int kCodeCacheTiming = 3;//5;
-
 
 void ARMv5::CP15Reset()
 {
@@ -43,12 +43,23 @@ char DSiSDPath[1024];
 
 int RandomizeMAC;
 
+int BIOS_HLE;
+
+int SkipIdle;
+
 #ifdef JIT_ENABLED
 int JIT_Enable = false;
 int JIT_MaxBlockSize = 32;
 int JIT_BranchOptimisations = true;
 int JIT_LiteralOptimisations = true;
 int JIT_FastMemory = true;
+int JIT_CachedInterpreter = false;
+int JIT_PersistentCache = false;
+int JIT_AsyncCompile = false;
+int JIT_CodeCacheSize = 32;
+int JIT_PerfMap = 0;
+int JIT_HotLoops = true;
+int JIT_BulkLoops = true;
 #endif
 
 ConfigEntry ConfigFile[] =
@@ -68,6 +79,10 @@ ConfigEntry ConfigFile[] =
 
     {"RandomizeMAC", 0, &RandomizeMAC, 0, NULL, 0},
 
+    {"BIOS_HLE", 0, &BIOS_HLE, 0, NULL, 0},
+
+    {"SkipIdle", 0, &SkipIdle, 0, NULL, 0},
+
 #ifdef JIT_ENABLED
     {"JIT_Enable", 0, &JIT_Enable, 0, NULL, 0},
     {"JIT_MaxBlockSize", 0, &JIT_MaxBlockSize, 32, NULL, 0},
@@ -78,6 +93,13 @@ ConfigEntry ConfigFile[] =
     #else
         {"JIT_FastMemory", 0, &JIT_FastMemory, 1, NULL, 0},
     #endif
+    {"JIT_CachedInterpreter", 0, &JIT_CachedInterpreter, 0, NULL, 0},
+    {"JIT_PersistentCache", 0, &JIT_PersistentCache, 0, NULL, 0},
+    {"JIT_AsyncCompile", 0, &JIT_AsyncCompile, 0, NULL, 0},
+    {"JIT_CodeCacheSize", 0, &JIT_CodeCacheSize, 32, NULL, 0},
+    {"JIT_PerfMap", 0, &JIT_PerfMap, 0, NULL, 0},
+    {"JIT_HotLoops", 0, &JIT_HotLoops, 1, NULL, 0},
+    {"JIT_BulkLoops", 0, &JIT_BulkLoops, 1, NULL, 0},
 #endif
 
     {"", -1, NULL, 0, NULL, 0}
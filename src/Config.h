@@ -56,12 +56,25 @@ extern char DSiSDPath[1024];
 
 extern int RandomizeMAC;
 
+extern int BIOS_HLE;
+
+extern int SkipIdle;
+
 #ifdef JIT_ENABLED
 extern int JIT_Enable;
 extern int JIT_MaxBlockSize;
 extern int JIT_BranchOptimisations;
 extern int JIT_LiteralOptimisations;
 extern int JIT_FastMemory;
+// only in JIT builds, it uses the block lookup and the code write
+// tracking of the JIT, which are only built for x64 and ARM64
+extern int JIT_CachedInterpreter;
+extern int JIT_PersistentCache;
+extern int JIT_AsyncCompile;
+extern int JIT_CodeCacheSize;
+extern int JIT_PerfMap;
+extern int JIT_HotLoops;
+extern int JIT_BulkLoops;
 #endif
 
 }
@@ -17,11 +17,17 @@
 */
 
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
 #include "NDS.h"
 #include "DSi.h"
 #include "DMA.h"
 #include "GPU.h"
 
+#ifdef JIT_ENABLED
+#include "ARMJIT.h"
+#include "ARMJIT_Memory.h"
+#endif
 
 
 // DMA TIMINGS
@@ -183,6 +189,111 @@ void DMA::Start()
     NDS::StopCPU(CPU, 1<<Num);
 }
 
+void DMA::RunBulk(u64& timestamp, u64 limit, u32 unitcycles, u32 unitsize)
+{
+    // only forward transfers from plain memory, to either plain
+    // memory or the VRAM of the ARM9. everything else has side effects
+    if (DstAddrInc != 1 || (SrcAddrInc != 0 && SrcAddrInc != 1))
+        return;
+    if ((CurSrcAddr | CurDstAddr) & (unitsize - 1))
+        return;
+
+    NDS::MemMap& map = NDS::MemMaps[CPU];
+    const u32 pagesize = 1 << NDS::MemMapPageShift;
+
+    while (IterCount > 0 && timestamp + unitcycles < limit)
+    {
+        if (CurSrcAddr >= 0x10000000 || CurDstAddr >= 0x10000000)
+            return;
+
+        u8* src = map.Mem[CurSrcAddr >> NDS::MemMapPageShift];
+        if (!src)
+            return;
+        src += CurSrcAddr & NDS::MemMapPageMask;
+
+        u64 units = std::min<u64>(IterCount, (limit - timestamp - 1) / unitcycles);
+        units = std::min<u64>(units, (pagesize - (CurDstAddr & NDS::MemMapPageMask)) / unitsize);
+        if (SrcAddrInc)
+            units = std::min<u64>(units, (pagesize - (CurSrcAddr & NDS::MemMapPageMask)) / unitsize);
+        u32 len = units * unitsize;
+
+        u32 dstpage = CurDstAddr >> NDS::MemMapPageShift;
+        if (u8* dst = map.Mem[dstpage])
+        {
+#ifdef JIT_ENABLED
+            if (ARMJIT::RangeContainsCode(map.CodeAddr[dstpage] + (CurDstAddr & NDS::MemMapPageMask), len))
+                return;
+#endif
+            dst += CurDstAddr & NDS::MemMapPageMask;
+
+            if (SrcAddrInc)
+            {
+                // copying unit by unit is only the same as memmove
+                // if the destination isn't ahead of the source
+                if (dst > src && dst < src + len)
+                    return;
+                memmove(dst, src, len);
+            }
+            else
+            {
+                u32 val;
+                memcpy(&val, src, unitsize);
+                for (u32 i = 0; i < len; i += unitsize)
+                    memcpy(&dst[i], &val, unitsize);
+            }
+        }
+        else
+        {
+            if (CPU != 0 || (CurDstAddr >> 24) != 0x06 || !SrcAddrInc)
+                return;
+#ifdef JIT_ENABLED
+            if (ARMJIT::RangeContainsCode(ARMJIT_Memory::LocaliseAddress(ARMJIT_Memory::memregion_VRAM, 0, CurDstAddr), len))
+                return;
+#endif
+            if (!GPU::CopyToVRAM(CurDstAddr, src, len))
+                return;
+        }
+
+        timestamp += units * unitcycles;
+        CurSrcAddr += SrcAddrInc * len;
+        CurDstAddr += len;
+        IterCount -= units;
+        RemCount -= units;
+    }
+}
+
+void DMA::RunGXFIFO(u32 unitcycles)
+{
+    if (SrcAddrInc != 1 || (CurSrcAddr & 3))
+        return;
+
+    NDS::MemMap& map = NDS::MemMaps[0];
+    const u32 pagesize = 1 << NDS::MemMapPageShift;
+
+    while (IterCount > 0 && !Stall && NDS::ARM9Timestamp < NDS::ARM9Target)
+    {
+        if (CurSrcAddr >= 0x10000000)
+            return;
+
+        u8* src = map.Mem[CurSrcAddr >> NDS::MemMapPageShift];
+        if (!src)
+            return;
+        src += CurSrcAddr & NDS::MemMapPageMask;
+
+        // the geometry engine only runs after the DMA, so like the unit
+        // loop this has to stop after the word which reaches the target
+        u64 words = std::min<u64>(IterCount, (NDS::ARM9Target - NDS::ARM9Timestamp + unitcycles - 1) / unitcycles);
+        words = std::min<u64>(words, (pagesize - (CurSrcAddr & NDS::MemMapPageMask)) / 4);
+
+        u32 written = GPU3D::WriteToGXFIFOBlock((u32*)src, words);
+
+        NDS::ARM9Timestamp += written * unitcycles;
+        CurSrcAddr += written * 4;
+        IterCount -= written;
+        RemCount -= written;
+    }
+}
+
 template <int ConsoleType>
 void DMA::Run9()
 {
@@ -217,7 +328,10 @@ void DMA::Run9()
             }*/
         }
 
-        while (IterCount > 0 && !Stall)
+        if (ConsoleType == 0)
+            RunBulk(NDS::ARM9Timestamp, NDS::NextEventTimestamp() << NDS::ARM9ClockShift, unitcycles << NDS::ARM9ClockShift, 2);
+
+        while (IterCount > 0 && !Stall && NDS::ARM9Timestamp < NDS::ARM9Target)
         {
             NDS::ARM9Timestamp += (unitcycles << NDS::ARM9ClockShift);
 
@@ -256,7 +370,15 @@ void DMA::Run9()
             }*/
         }
 
-        while (IterCount > 0 && !Stall)
+        if (ConsoleType == 0)
+        {
+            if (IsGXFIFODMA)
+                RunGXFIFO(unitcycles << NDS::ARM9ClockShift);
+            else
+                RunBulk(NDS::ARM9Timestamp, NDS::NextEventTimestamp() << NDS::ARM9ClockShift, unitcycles << NDS::ARM9ClockShift, 4);
+        }
+
+        while (IterCount > 0 && !Stall && NDS::ARM9Timestamp < NDS::ARM9Target)
         {
             NDS::ARM9Timestamp += (unitcycles << NDS::ARM9ClockShift);
 
@@ -336,7 +458,10 @@ void DMA::Run7()
             }*/
         }
 
-        while (IterCount > 0 && !Stall)
+        if (ConsoleType == 0)
+            RunBulk(NDS::ARM7Timestamp, NDS::NextEventTimestamp(), unitcycles, 2);
+
+        while (IterCount > 0 && !Stall && NDS::ARM7Timestamp < NDS::ARM7Target)
         {
             NDS::ARM7Timestamp += unitcycles;
 
@@ -375,7 +500,10 @@ void DMA::Run7()
             }*/
         }
 
-        while (IterCount > 0 && !Stall)
+        if (ConsoleType == 0)
+            RunBulk(NDS::ARM7Timestamp, NDS::NextEventTimestamp(), unitcycles, 4);
+
+        while (IterCount > 0 && !Stall && NDS::ARM7Timestamp < NDS::ARM7Target)
         {
             NDS::ARM7Timestamp += unitcycles;
 
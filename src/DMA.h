@@ -73,6 +73,14 @@ public:
 private:
     u32 CPU, Num;
 
+    // moves the units which only involve plain memory at once. like with the
+    // JIT's bulk loops, they may run past the target, but end before the next
+    // event. the other CPU catches up afterwards
+    void RunBulk(u64& timestamp, u64 limit, u32 unitcycles, u32 unitsize);
+    // feeds the geometry FIFO from plain memory without going through the
+    // bus for every word, still up to the target or a stall
+    void RunGXFIFO(u32 unitcycles);
+
     u32 StartMode;
     u32 CurSrcAddr;
     u32 CurDstAddr;
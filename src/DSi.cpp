@@ -715,6 +715,8 @@ void ApplyNewRAMSize(u32 size)
         printf("RAM: 16MB\n");
         break;
     }
+
+    NDS::UpdateMemMap();
 }
 
 
@@ -781,6 +783,8 @@ u8 ARM9Read8(u32 addr)
         return NDS::ARM9Read8(addr);
 
     case 0x04000000:
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(0, addr))
+            return io->Read8(addr);
         return ARM9IORead8(addr);
     }
 
@@ -818,6 +822,8 @@ u16 ARM9Read16(u32 addr)
         return NDS::ARM9Read16(addr);
 
     case 0x04000000:
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(0, addr))
+            return io->Read16(addr);
         return ARM9IORead16(addr);
     }
 
@@ -861,6 +867,8 @@ u32 ARM9Read32(u32 addr)
         return NDS::ARM9Read32(addr);
 
     case 0x04000000:
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(0, addr))
+            return io->Read32(addr);
         return ARM9IORead32(addr);
     }
 
@@ -911,7 +919,10 @@ void ARM9Write8(u32 addr, u8 val)
         return NDS::ARM9Write8(addr, val);
 
     case 0x04000000:
-        ARM9IOWrite8(addr, val);
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(0, addr))
+            io->Write8(addr, val);
+        else
+            ARM9IOWrite8(addr, val);
         return;
 
     case 0x06000000:
@@ -976,7 +987,10 @@ void ARM9Write16(u32 addr, u16 val)
         return NDS::ARM9Write16(addr, val);
 
     case 0x04000000:
-        ARM9IOWrite16(addr, val);
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(0, addr))
+            io->Write16(addr, val);
+        else
+            ARM9IOWrite16(addr, val);
         return;
     }
 
@@ -1027,7 +1041,10 @@ void ARM9Write32(u32 addr, u32 val)
         return NDS::ARM9Write32(addr, val);
 
     case 0x04000000:
-        ARM9IOWrite32(addr, val);
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(0, addr))
+            io->Write32(addr, val);
+        else
+            ARM9IOWrite32(addr, val);
         return;
     }
 
@@ -1106,6 +1123,8 @@ u8 ARM7Read8(u32 addr)
         return NDS::ARM7Read8(addr);
 
     case 0x04000000:
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(1, addr))
+            return io->Read8(addr);
         return ARM7IORead8(addr);
     }
 
@@ -1147,6 +1166,8 @@ u16 ARM7Read16(u32 addr)
         return NDS::ARM7Read16(addr);
 
     case 0x04000000:
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(1, addr))
+            return io->Read16(addr);
         return ARM7IORead16(addr);
     }
 
@@ -1188,6 +1209,8 @@ u32 ARM7Read32(u32 addr)
         return NDS::ARM7Read32(addr);
 
     case 0x04000000:
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(1, addr))
+            return io->Read32(addr);
         return ARM7IORead32(addr);
     }
 
@@ -1238,7 +1261,10 @@ void ARM7Write8(u32 addr, u8 val)
         return NDS::ARM7Write8(addr, val);
 
     case 0x04000000:
-        ARM7IOWrite8(addr, val);
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(1, addr))
+            io->Write8(addr, val);
+        else
+            ARM7IOWrite8(addr, val);
         return;
     }
 
@@ -1289,7 +1315,10 @@ void ARM7Write16(u32 addr, u16 val)
         return NDS::ARM7Write16(addr, val);
 
     case 0x04000000:
-        ARM7IOWrite16(addr, val);
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(1, addr))
+            io->Write16(addr, val);
+        else
+            ARM7IOWrite16(addr, val);
         return;
     }
 
@@ -1340,7 +1369,10 @@ void ARM7Write32(u32 addr, u32 val)
         return NDS::ARM7Write32(addr, val);
 
     case 0x04000000:
-        ARM7IOWrite32(addr, val);
+        if (NDS::IOHandlers* io = NDS::GetIOHandlers(1, addr))
+            io->Write32(addr, val);
+        else
+            ARM7IOWrite32(addr, val);
         return;
     }
 
@@ -0,0 +1,165 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include "FrameProfiler.h"
+
+namespace FrameProfiler
+{
+
+Report CurFrame;
+Report History[kHistoryLength];
+u32 HistoryPos;
+u32 HistoryCount;
+
+u64 FrameStart;
+
+u32 ReportInterval;
+u32 FramesSinceReport;
+
+
+void Reset()
+{
+    memset(&CurFrame, 0, sizeof(CurFrame));
+    memset(History, 0, sizeof(History));
+    HistoryPos = 0;
+    HistoryCount = 0;
+    FramesSinceReport = 0;
+}
+
+void BeginFrame()
+{
+    memset(&CurFrame, 0, sizeof(CurFrame));
+    CurFrame.NumFrames = 1;
+    FrameStart = HostTime();
+}
+
+void EndFrame()
+{
+    CurFrame.FrameHostTime = HostTime() - FrameStart;
+
+    History[HistoryPos] = CurFrame;
+    HistoryPos = (HistoryPos + 1) % kHistoryLength;
+    if (HistoryCount < kHistoryLength) HistoryCount++;
+
+    if (ReportInterval)
+    {
+        FramesSinceReport++;
+        if (FramesSinceReport >= ReportInterval)
+        {
+            FramesSinceReport = 0;
+
+            Report report;
+            GetRollingReport(&report);
+            PrintReport(stdout, report);
+        }
+    }
+}
+
+const Report& GetLastFrame()
+{
+    return History[(HistoryPos + kHistoryLength - 1) % kHistoryLength];
+}
+
+void GetRollingReport(Report* report)
+{
+    memset(report, 0, sizeof(Report));
+
+    for (u32 i = 0; i < HistoryCount; i++)
+    {
+        const Report& frame = History[i];
+
+        for (int j = 0; j < Section_MAX; j++)
+        {
+            report->Sections[j].HostTime += frame.Sections[j].HostTime;
+            report->Sections[j].Cycles += frame.Sections[j].Cycles;
+            report->Sections[j].Calls += frame.Sections[j].Calls;
+        }
+        for (int j = 0; j < NDS::Event_MAX; j++)
+        {
+            report->Events[j].HostTime += frame.Events[j].HostTime;
+            report->Events[j].Cycles += frame.Events[j].Cycles;
+            report->Events[j].Calls += frame.Events[j].Calls;
+        }
+
+        report->FrameHostTime += frame.FrameHostTime;
+        report->NumFrames += frame.NumFrames;
+    }
+}
+
+void SetReportInterval(u32 frames)
+{
+    ReportInterval = frames;
+    FramesSinceReport = 0;
+}
+
+const char* GetSectionName(int section)
+{
+    const char* names[Section_MAX] =
+    {
+        "ARM9", "ARM7", "DMA", "Timers", "GPU3D", "System", "SPU output"
+    };
+
+    return names[section];
+}
+
+const char* GetEventName(int event)
+{
+    const char* names[NDS::Event_MAX] =
+    {
+        "LCD", "SPU", "Wifi",
+        "DisplayFIFO", "ROMTransfer", "ROMSPITransfer", "SPITransfer", "Div", "Sqrt",
+        "DSi_SDMMCTransfer", "DSi_SDIOTransfer", "DSi_NWifi", "DSi_CamIRQ", "DSi_CamTransfer",
+        "DSi_RAMSizeChange"
+    };
+
+    return names[event];
+}
+
+void PrintCounter(FILE* out, const char* name, const Counter& counter, u64 total, u32 numframes)
+{
+    if (!counter.Calls) return;
+
+    double ms = counter.HostTime / (1000000.0 * numframes);
+    double pct = total ? (counter.HostTime * 100.0 / total) : 0.0;
+
+    fprintf(out, "  %-20s %8.3f ms %5.1f%% %10llu cycles %8u calls\n",
+            name, ms, pct,
+            (unsigned long long)(counter.Cycles / numframes),
+            counter.Calls / numframes);
+}
+
+void PrintReport(FILE* out, const Report& report)
+{
+    if (!report.NumFrames) return;
+
+    fprintf(out, "frame profile (%u frames, %.3f ms/frame avg):\n",
+            report.NumFrames, report.FrameHostTime / (1000000.0 * report.NumFrames));
+
+    for (int i = 0; i < Section_MAX; i++)
+        PrintCounter(out, GetSectionName(i), report.Sections[i], report.FrameHostTime, report.NumFrames);
+
+    for (int i = 0; i < NDS::Event_MAX; i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "  Event_%s", GetEventName(i));
+        PrintCounter(out, name, report.Events[i], report.FrameHostTime, report.NumFrames);
+    }
+}
+
+}
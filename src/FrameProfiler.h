@@ -0,0 +1,138 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef FRAMEPROFILER_H
+#define FRAMEPROFILER_H
+
+#include <stdio.h>
+#include "types.h"
+#include "NDS.h"
+
+// per-subsystem frame time profiler
+// accumulates host time and guest cycles spent in each part of NDS::RunFrame()
+//
+// only built with FRAMEPROFILER_ENABLED (cmake -DENABLE_FRAMEPROFILER=ON)
+// the FRAMEPROF_* macros compile to nothing otherwise, and their arguments
+// aren't evaluated
+
+#ifdef FRAMEPROFILER_ENABLED
+
+#include <chrono>
+
+namespace FrameProfiler
+{
+
+enum
+{
+    Section_ARM9 = 0,
+    Section_ARM7,
+    Section_DMA,
+    Section_Timers,
+    Section_GPU3D,
+    Section_System,
+    Section_SPUOutput,
+
+    Section_MAX
+};
+
+struct Counter
+{
+    u64 HostTime; // nanoseconds
+    u64 Cycles;   // system clock cycles (33MHz)
+    u32 Calls;
+};
+
+struct Report
+{
+    Counter Sections[Section_MAX];
+    Counter Events[NDS::Event_MAX];
+
+    u64 FrameHostTime;
+    u32 NumFrames;
+};
+
+struct Sample
+{
+    u64 HostStart;
+    u64 CycleStart;
+};
+
+extern Report CurFrame;
+
+// number of frames kept for the rolling report
+const int kHistoryLength = 60;
+
+void Reset();
+
+void BeginFrame();
+void EndFrame();
+
+// statistics for the last completed frame
+const Report& GetLastFrame();
+
+// sum of the last kHistoryLength frames (or less if not enough frames ran yet)
+// NumFrames tells how many frames were accumulated
+void GetRollingReport(Report* report);
+
+// print the rolling report every 'frames' frames to stdout. 0 disables it
+void SetReportInterval(u32 frames);
+
+void PrintReport(FILE* out, const Report& report);
+
+const char* GetSectionName(int section);
+const char* GetEventName(int event);
+
+inline u64 HostTime()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline Sample Begin(u64 cycles)
+{
+    return {HostTime(), cycles};
+}
+
+inline void Accumulate(Counter& counter, const Sample& sample, u64 cycles)
+{
+    counter.HostTime += HostTime() - sample.HostStart;
+    counter.Cycles += cycles - sample.CycleStart;
+    counter.Calls++;
+}
+
+}
+
+#define FRAMEPROF_FRAME_BEGIN() FrameProfiler::BeginFrame()
+#define FRAMEPROF_FRAME_END() FrameProfiler::EndFrame()
+#define FRAMEPROF_BEGIN(name, cycles) FrameProfiler::Sample name = FrameProfiler::Begin(cycles)
+#define FRAMEPROF_END(name, section, cycles) \
+    FrameProfiler::Accumulate(FrameProfiler::CurFrame.Sections[section], name, cycles)
+#define FRAMEPROF_END_EVENT(name, event, cycles) \
+    FrameProfiler::Accumulate(FrameProfiler::CurFrame.Events[event], name, cycles)
+
+#else
+
+#define FRAMEPROF_FRAME_BEGIN()
+#define FRAMEPROF_FRAME_END()
+#define FRAMEPROF_BEGIN(name, cycles)
+#define FRAMEPROF_END(name, section, cycles)
+#define FRAMEPROF_END_EVENT(name, event, cycles)
+
+#endif // FRAMEPROFILER_ENABLED
+
+#endif // FRAMEPROFILER_H
@@ -20,6 +20,7 @@
 #include <string.h>
 #include "NDS.h"
 #include "GPU.h"
+#include "Platform.h"
 
 
 namespace GPU
@@ -142,8 +143,185 @@ u8 VRAMFlat_BOBJExtPal[8*1024];
 u8 VRAMFlat_Texture[512*1024];
 u8 VRAMFlat_TexPal[128*1024];
 
-u32 OAMDirty;
-u32 PaletteDirty;
+bool OAMDirty[2];
+u32 PaletteDirty[2];
+
+// engine B can draw its lines on another thread while engine A draws them on
+// this one. the lines are handed over in bands of up to Band2DLines, together
+// with the writes to engine B's registers in between, which are replayed at
+// the VCount they were done at. engine B's VRAM, palette and OAM don't change
+// while it has lines pending, everything which changes them, maps VRAM or
+// reads engine B's registers waits for the band first
+
+bool Threaded2D;
+Platform::Thread* Render2DThread;
+bool Render2DThreadRunning;
+Platform::Semaphore* Sema_Render2DStart;
+Platform::Semaphore* Sema_Render2DDone;
+
+struct Band2DEntry
+{
+    u8 Type;
+    u32 Addr;
+    u32 Val;
+};
+
+const u32 Band2DLines = 16;
+const u32 Band2DSize = 1024;
+
+struct Band2D
+{
+    Band2DEntry Entries[Band2DSize];
+    u32 Length;
+    u32 Lines;
+
+    // whether engine B sees its palette and OAM dirty flags in this band
+    bool DrawsLine;
+    bool DrawsSprites;
+};
+
+// one band is logged while the thread draws the other one
+Band2D Bands2D[2];
+u32 CurBand2D;
+u32 Render2DBand;
+bool Render2DBusy;
+bool Band2DPending;
+
+void DrawLine2D(GPU2D* gpu, u32 line);
+void Render2DThreadFunc();
+
+void RunBand2D(Band2D& band)
+{
+    for (u32 i = 0; i < band.Length; i++)
+    {
+        Band2DEntry& entry = band.Entries[i];
+
+        switch (entry.Type)
+        {
+        case band2D_Line:
+            GPU2D_B->CurVCount = entry.Val;
+            GPU2D_B->CheckWindows(entry.Val);
+            break;
+        case band2D_Draw: DrawLine2D(GPU2D_B, entry.Val); break;
+        case band2D_VBlank: GPU2D_B->VBlank(); break;
+        case band2D_VBlankEnd: GPU2D_B->VBlankEnd(); break;
+        case band2D_Write8: GPU2D_B->WriteReg8(entry.Addr, entry.Val); break;
+        case band2D_Write16: GPU2D_B->WriteReg16(entry.Addr, entry.Val); break;
+        case band2D_Write32: GPU2D_B->WriteReg32(entry.Addr, entry.Val); break;
+        }
+    }
+}
+
+void EndBand2D(Band2D& band)
+{
+    // engine B has seen the changes to its standard palette and OAM, they
+    // can't have changed again while the band was pending
+    if (band.DrawsLine)
+        PaletteDirty[1] &= ~(1 << 0);
+    if (band.DrawsSprites)
+        OAMDirty[1] = false;
+
+    band.Length = 0;
+    band.Lines = 0;
+    band.DrawsLine = false;
+    band.DrawsSprites = false;
+}
+
+void WaitBand2D()
+{
+    if (!Render2DBusy) return;
+
+    Platform::Semaphore_Wait(Sema_Render2DDone);
+    Render2DBusy = false;
+    EndBand2D(Bands2D[Render2DBand]);
+
+    Band2DPending = Bands2D[CurBand2D].Length != 0;
+}
+
+void SubmitBand2D()
+{
+    if (Bands2D[CurBand2D].Length == 0) return;
+
+    WaitBand2D();
+
+    Render2DBand = CurBand2D;
+    Render2DBusy = true;
+    Platform::Semaphore_Post(Sema_Render2DStart);
+
+    CurBand2D ^= 1;
+    Band2DPending = true;
+}
+
+void FinishBand2D()
+{
+    WaitBand2D();
+
+    // the lines still logged are drawn right away, the thread is idle anyway
+    Band2D& band = Bands2D[CurBand2D];
+    RunBand2D(band);
+    EndBand2D(band);
+
+    Band2DPending = false;
+}
+
+void LogBand2D(u32 type, u32 addr, u32 val)
+{
+    if (Bands2D[CurBand2D].Length == Band2DSize)
+        SubmitBand2D();
+
+    Band2D& band = Bands2D[CurBand2D];
+    Band2DEntry& entry = band.Entries[band.Length++];
+    entry.Type = type;
+    entry.Addr = addr;
+    entry.Val = val;
+
+    if (type == band2D_Draw)
+    {
+        band.Lines++;
+        if (val < 192) band.DrawsLine = true;
+        if (val < 191) band.DrawsSprites = true;
+    }
+
+    Band2DPending = true;
+}
+
+void StopRender2DThread()
+{
+    if (Render2DThreadRunning)
+    {
+        SyncBand2D();
+
+        Render2DThreadRunning = false;
+        Platform::Semaphore_Post(Sema_Render2DStart);
+        Platform::Thread_Wait(Render2DThread);
+        Platform::Thread_Free(Render2DThread);
+    }
+}
+
+void SetupRender2DThread()
+{
+    if (Threaded2D)
+    {
+        if (!Render2DThreadRunning)
+        {
+            Platform::Semaphore_Reset(Sema_Render2DStart);
+            Platform::Semaphore_Reset(Sema_Render2DDone);
+
+            EndBand2D(Bands2D[0]);
+            EndBand2D(Bands2D[1]);
+            CurBand2D = 0;
+            Render2DBusy = false;
+            Band2DPending = false;
+
+            Render2DThreadRunning = true;
+            Render2DThread = Platform::Thread_Create(Render2DThreadFunc);
+        }
+    }
+    else
+    {
+        StopRender2DThread();
+    }
+}
 
 bool Init()
 {
@@ -151,6 +329,13 @@ bool Init()
     GPU2D_B = new GPU2D_Soft(1);
     if (!GPU3D::Init()) return false;
 
+    Sema_Render2DStart = Platform::Semaphore_Create();
+    Sema_Render2DDone = Platform::Semaphore_Create();
+    Threaded2D = false;
+    Render2DThreadRunning = false;
+    Render2DBusy = false;
+    Band2DPending = false;
+
     FrontBuffer = 0;
     Framebuffer[0][0] = NULL; Framebuffer[0][1] = NULL;
     Framebuffer[1][0] = NULL; Framebuffer[1][1] = NULL;
@@ -162,6 +347,10 @@ bool Init()
 
 void DeInit()
 {
+    StopRender2DThread();
+    Platform::Semaphore_Free(Sema_Render2DStart);
+    Platform::Semaphore_Free(Sema_Render2DDone);
+
     delete GPU2D_A;
     delete GPU2D_B;
     GPU3D::DeInit();
@@ -202,6 +391,8 @@ void ResetVRAMCache()
 
 void Reset()
 {
+    SyncBand2D();
+
     VCount = 0;
     NextVCount = -1;
     TotalScanlines = 0;
@@ -276,12 +467,14 @@ void Reset()
 
     ResetVRAMCache();
 
-    OAMDirty = 0x3;
-    PaletteDirty = 0xF;
+    OAMDirty[0] = OAMDirty[1] = true;
+    PaletteDirty[0] = PaletteDirty[1] = 0x3;
 }
 
 void Stop()
 {
+    SyncBand2D();
+
     int fbsize;
     if (Accelerated) fbsize = (256*3 + 1) * 192;
     else             fbsize = 256 * 192;
@@ -293,6 +486,8 @@ void Stop()
 
 void DoSavestate(Savestate* file)
 {
+    SyncBand2D();
+
     file->Section("GPUG");
 
     file->Var16(&VCount);
@@ -348,10 +543,15 @@ void DoSavestate(Savestate* file)
             VRAMPtr_BBG[i] = GetUniqueBankPtr(VRAMMap_BBG[i], i << 14);
         for (int i = 0; i < 0x8; i++)
             VRAMPtr_BOBJ[i] = GetUniqueBankPtr(VRAMMap_BOBJ[i], i << 14);
+
+        OAMDirty[0] = OAMDirty[1] = true;
+        PaletteDirty[0] = PaletteDirty[1] = 0x3;
     }
 
     GPU2D_A->DoSavestate(file);
     GPU2D_B->DoSavestate(file);
+    GPU2D_A->CurVCount = VCount;
+    GPU2D_B->CurVCount = VCount;
     GPU3D::DoSavestate(file);
 
     ResetVRAMCache();
@@ -359,6 +559,8 @@ void DoSavestate(Savestate* file)
 
 void AssignFramebuffers()
 {
+    SyncBand2D();
+
     int backbuf = FrontBuffer ? 0 : 1;
     if (NDS::PowerControl9 & (1<<15))
     {
@@ -429,6 +631,8 @@ void ResetRenderer()
 
 void SetRenderSettings(int renderer, RenderSettings& settings)
 {
+    SyncBand2D();
+
     if (renderer != Renderer)
     {
         DeInitRenderer();
@@ -456,8 +660,11 @@ void SetRenderSettings(int renderer, RenderSettings& settings)
 
     AssignFramebuffers();
 
-    GPU2D_A->SetRenderSettings(accel);
-    GPU2D_B->SetRenderSettings(accel);
+    GPU2D_A->SetRenderSettings(accel, settings.Scalar2D);
+    GPU2D_B->SetRenderSettings(accel, settings.Scalar2D);
+
+    Threaded2D = settings.Threaded2D;
+    SetupRender2DThread();
 
     if (Renderer == 0)
     {
@@ -510,6 +717,72 @@ u8* GetUniqueBankPtr(u32 mask, u32 offset)
     return &VRAM[num][offset & VRAMMask[num]];
 }
 
+template <u32 Size>
+void SetWrittenRange(NonStupidBitField<Size>& written, u32 offset, u32 len)
+{
+    for (u32 i = offset / VRAMDirtyGranularity; i <= (offset + len - 1) / VRAMDirtyGranularity; i++)
+        written[i] = true;
+}
+
+bool CopyToVRAM(u32 addr, const u8* src, u32 len)
+{
+    if (!len || (addr & 0x3FFF) + len > 0x4000)
+        return false;
+
+    u32 mask;
+    switch (addr & 0x00E00000)
+    {
+    case 0x00000000:
+        mask = VRAMMap_ABG[(addr >> 14) & 0x1F];
+        SetWrittenRange(VRAMWritten_ABG, addr & 0x7FFFF, len);
+        break;
+    case 0x00200000:
+        SyncBand2D();
+        mask = VRAMMap_BBG[(addr >> 14) & 0x7];
+        SetWrittenRange(VRAMWritten_BBG, addr & 0x1FFFF, len);
+        break;
+    case 0x00400000:
+        mask = VRAMMap_AOBJ[(addr >> 14) & 0xF];
+        SetWrittenRange(VRAMWritten_AOBJ, addr & 0x3FFFF, len);
+        break;
+    case 0x00600000:
+        SyncBand2D();
+        mask = VRAMMap_BOBJ[(addr >> 14) & 0x7];
+        SetWrittenRange(VRAMWritten_BOBJ, addr & 0x1FFFF, len);
+        break;
+    default:
+        {
+            // the banks in the order of their LCDC addresses, in 16 KB steps
+            static const u8 lcdcBanks[41] =
+            {
+                0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
+                2, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3,
+                4, 4, 4, 4, 5, 6, 7, 7, 8
+            };
+            u32 page = (addr & 0xFFFFF) >> 14;
+            if (page >= 41)
+                return false;
+
+            u32 bank = lcdcBanks[page];
+            if (VRAMMap_LCDC & (1<<bank))
+            {
+                u32 offset = addr & VRAMMask[bank];
+                memcpy(&VRAM[bank][offset], src, len);
+                SetWrittenRange(VRAMDirty[bank], offset, len);
+            }
+            return true;
+        }
+    }
+
+    while (mask)
+    {
+        int bank = __builtin_ctz(mask);
+        mask &= mask - 1;
+        memcpy(&VRAM[bank][addr & VRAMMask[bank]], src, len);
+    }
+    return true;
+}
+
 #define MAP_RANGE(map, base, n)    for (int i = 0; i < n; i++) VRAMMap_##map[(base)+i] |= bankmask;
 #define UNMAP_RANGE(map, base, n)  for (int i = 0; i < n; i++) VRAMMap_##map[(base)+i] &= ~bankmask;
 
@@ -585,6 +858,9 @@ void MapVRAM_CD(u32 bank, u8 cnt)
 
     if (oldcnt == cnt) return;
 
+    // engine B might use the bank
+    SyncBand2D();
+
     u8 oldofs = (oldcnt >> 3) & 0x7;
     u8 ofs = (cnt >> 3) & 0x7;
     u32 bankmask = 1 << bank;
@@ -826,6 +1102,8 @@ void MapVRAM_H(u32 bank, u8 cnt)
 
     if (oldcnt == cnt) return;
 
+    SyncBand2D();
+
     u32 bankmask = 1 << bank;
 
     if (oldcnt & (1<<7))
@@ -886,6 +1164,8 @@ void MapVRAM_I(u32 bank, u8 cnt)
 
     if (oldcnt == cnt) return;
 
+    SyncBand2D();
+
     u32 bankmask = 1 << bank;
 
     if (oldcnt & (1<<7))
@@ -960,6 +1240,8 @@ void SetPowerCnt(u32 val)
 
     if (!(val & (1<<0))) printf("!!! CLEARING POWCNT BIT0. DANGER\n");
 
+    SyncBand2D();
+
     GPU2D_A->SetEnabled(val & (1<<1));
     GPU2D_B->SetEnabled(val & (1<<9));
     GPU3D::SetEnabled(val & (1<<3), val & (1<<2));
@@ -1002,6 +1284,29 @@ void StartFrame()
     StartScanline(0);
 }
 
+void DrawLine2D(GPU2D* gpu, u32 line)
+{
+    if (line < 192)
+        gpu->DrawScanline(line);
+
+    // sprites are pre-rendered one scanline in advance
+    if (line < 191)
+        gpu->DrawSprites(line+1);
+}
+
+void Render2DThreadFunc()
+{
+    for (;;)
+    {
+        Platform::Semaphore_Wait(Sema_Render2DStart);
+        if (!Render2DThreadRunning) return;
+
+        RunBand2D(Bands2D[Render2DBand]);
+
+        Platform::Semaphore_Post(Sema_Render2DDone);
+    }
+}
+
 void StartHBlank(u32 line)
 {
     DispStat[0] |= (1<<1);
@@ -1013,17 +1318,31 @@ void StartHBlank(u32 line)
     {
         // draw
         // note: this should start 48 cycles after the scanline start
-        if (line < 192)
+        if (Render2DThreadRunning)
         {
-            GPU2D_A->DrawScanline(line);
-            GPU2D_B->DrawScanline(line);
+            LogBand2D(band2D_Draw, 0, line);
+            if (Bands2D[CurBand2D].Lines == Band2DLines)
+                SubmitBand2D();
         }
 
-        // sprites are pre-rendered one scanline in advance
+        DrawLine2D(GPU2D_A, line);
+
+        // engine A has seen the changes to its standard palette and OAM, see
+        // GPU2D_Soft::InvalidateBGTiles and GPU2D_Soft::DrawSprites. engine B's
+        // flags are cleared once its band is drawn
+        if (line < 192)
+            PaletteDirty[0] &= ~(1 << 0);
         if (line < 191)
+            OAMDirty[0] = false;
+
+        if (!Render2DThreadRunning)
         {
-            GPU2D_A->DrawSprites(line+1);
-            GPU2D_B->DrawSprites(line+1);
+            DrawLine2D(GPU2D_B, line);
+
+            if (line < 192)
+                PaletteDirty[1] &= ~(1 << 0);
+            if (line < 191)
+                OAMDirty[1] = false;
         }
 
         NDS::CheckDMAs(0, 0x02);
@@ -1035,7 +1354,9 @@ void StartHBlank(u32 line)
     else if (VCount == 262)
     {
         GPU2D_A->DrawSprites(0);
+        SyncBand2D();
         GPU2D_B->DrawSprites(0);
+        OAMDirty[0] = OAMDirty[1] = false;
     }
 
     if (DispStat[0] & (1<<4)) NDS::SetIRQ(0, NDS::IRQ_HBlank);
@@ -1049,6 +1370,8 @@ void StartHBlank(u32 line)
 
 void FinishFrame(u32 lines)
 {
+    SyncBand2D();
+
     FrontBuffer = FrontBuffer ? 0 : 1;
     AssignFramebuffers();
 
@@ -1087,8 +1410,15 @@ void StartScanline(u32 line)
     else
         DispStat[1] &= ~(1<<2);
 
+    GPU2D_A->CurVCount = VCount;
     GPU2D_A->CheckWindows(VCount);
-    GPU2D_B->CheckWindows(VCount);
+    if (Render2DThreadRunning)
+        LogBand2D(band2D_Line, 0, VCount);
+    else
+    {
+        GPU2D_B->CurVCount = VCount;
+        GPU2D_B->CheckWindows(VCount);
+    }
 
     if (VCount >= 2 && VCount < 194)
         NDS::CheckDMAs(0, 0x03);
@@ -1100,7 +1430,10 @@ void StartScanline(u32 line)
         if (line == 0)
         {
             GPU2D_A->VBlankEnd();
-            GPU2D_B->VBlankEnd();
+            if (Render2DThreadRunning)
+                LogBand2D(band2D_VBlankEnd, 0, 0);
+            else
+                GPU2D_B->VBlankEnd();
         }
 
         if (RunFIFO)
@@ -1131,11 +1464,22 @@ void StartScanline(u32 line)
             if (DispStat[1] & (1<<3)) NDS::SetIRQ(1, NDS::IRQ_VBlank);
 
             GPU2D_A->VBlank();
-            GPU2D_B->VBlank();
+            if (Render2DThreadRunning)
+            {
+                // the last lines are drawn while VBlank runs
+                LogBand2D(band2D_VBlank, 0, 0);
+                SubmitBand2D();
+            }
+            else
+                GPU2D_B->VBlank();
             GPU3D::VBlank();
 
 #ifdef OGLRENDERER_ENABLED
-            if (Accelerated) GLCompositor::RenderFrame();
+            if (Accelerated)
+            {
+                SyncBand2D();
+                GLCompositor::RenderFrame();
+            }
 #endif
         }
         else if (VCount == 144)
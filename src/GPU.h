@@ -147,12 +147,47 @@ bool MakeVRAMFlat_TexPalCoherent(NonStupidBitField<128*1024/VRAMDirtyGranularity
 
 void SyncDirtyFlags();
 
-extern u32 OAMDirty;
-extern u32 PaletteDirty;
+// per engine, so that one engine's flags can change while the other one
+// draws on another thread. bit 0 of PaletteDirty is the BG palette, bit 1
+// the OBJ palette
+extern bool OAMDirty[2];
+extern u32 PaletteDirty[2];
+
+// with Threaded2D engine B draws its lines in bands on another thread. the
+// lines and its register writes in between are logged until a band is full,
+// anything else engine B uses or which is read from it waits for the band
+// to be drawn, see SyncBand2D
+
+enum
+{
+    band2D_Line,
+    band2D_Draw,
+    band2D_VBlank,
+    band2D_VBlankEnd,
+    band2D_Write8,
+    band2D_Write16,
+    band2D_Write32,
+};
+
+// engine B has logged lines or writes or a band is being drawn
+extern bool Band2DPending;
+
+void LogBand2D(u32 type, u32 addr, u32 val);
+void FinishBand2D();
+
+// before engine B's registers, VRAM, palette or OAM are changed or read
+inline void SyncBand2D()
+{
+    if (Band2DPending) FinishBand2D();
+}
 
 struct RenderSettings
 {
     bool Soft_Threaded;
+    // draw the lines of both 2D engines at the same time
+    bool Threaded2D;
+    // don't use the vectorised loops of GPU2D_Composite
+    bool Scalar2D;
 
     int GL_ScaleFactor;
     bool GL_BetterPolygons;
@@ -175,6 +210,10 @@ void SetRenderSettings(int renderer, RenderSettings& settings);
 
 u8* GetUniqueBankPtr(u32 mask, u32 offset);
 
+// copies a block within one 16 KB page to the ARM9 VRAM mapping, like
+// the same number of WriteVRAM calls. false if it's beyond the banks
+bool CopyToVRAM(u32 addr, const u8* src, u32 len);
+
 void MapVRAM_AB(u32 bank, u8 cnt);
 void MapVRAM_CD(u32 bank, u8 cnt);
 void MapVRAM_E(u32 bank, u8 cnt);
@@ -405,6 +444,8 @@ T ReadVRAM_BBG(u32 addr)
 template<typename T>
 void WriteVRAM_BBG(u32 addr, T val)
 {
+    SyncBand2D();
+
     u32 mask = VRAMMap_BBG[(addr >> 14) & 0x7];
 
     VRAMWritten_BBG[(addr & 0x1FFFF) / VRAMDirtyGranularity] = true;
@@ -433,6 +474,8 @@ T ReadVRAM_BOBJ(u32 addr)
 template<typename T>
 void WriteVRAM_BOBJ(u32 addr, T val)
 {
+    SyncBand2D();
+
     u32 mask = VRAMMap_BOBJ[(addr >> 14) & 0x7];
 
     VRAMWritten_BOBJ[(addr & 0x1FFFF) / VRAMDirtyGranularity] = true;
@@ -521,9 +564,10 @@ template<typename T>
 void WritePalette(u32 addr, T val)
 {
     addr &= 0x7FF;
+    if (addr & 0x400) SyncBand2D();
 
     *(T*)&Palette[addr] = val;
-    PaletteDirty |= 1 << (addr / VRAMDirtyGranularity);
+    PaletteDirty[addr >> 10] |= 1 << ((addr / VRAMDirtyGranularity) & 0x1);
 }
 
 template<typename T>
@@ -536,9 +580,10 @@ template<typename T>
 void WriteOAM(u32 addr, T val)
 {
     addr &= 0x7FF;
+    if (addr & 0x400) SyncBand2D();
 
     *(T*)&OAM[addr] = val;
-    OAMDirty |= 1 << (addr / 1024);
+    OAMDirty[addr >> 10] = true;
 }
 
 void SetPowerCnt(u32 val);
@@ -88,6 +88,7 @@ GPU2D::GPU2D(u32 num)
 
 void GPU2D::Reset()
 {
+    CurVCount = 0;
     Enabled = false;
     DispCnt = 0;
     memset(BGCnt, 0, 4*2);
@@ -196,6 +197,8 @@ void GPU2D::SetFramebuffer(u32* buf)
 
 u8 GPU2D::Read8(u32 addr)
 {
+    if (Num) GPU::SyncBand2D();
+
     switch (addr & 0x00000FFF)
     {
     case 0x000: return DispCnt & 0xFF;
@@ -229,6 +232,8 @@ u8 GPU2D::Read8(u32 addr)
 
 u16 GPU2D::Read16(u32 addr)
 {
+    if (Num) GPU::SyncBand2D();
+
     switch (addr & 0x00000FFF)
     {
     case 0x000: return DispCnt & 0xFFFF;
@@ -258,6 +263,8 @@ u16 GPU2D::Read16(u32 addr)
 
 u32 GPU2D::Read32(u32 addr)
 {
+    if (Num) GPU::SyncBand2D();
+
     switch (addr & 0x00000FFF)
     {
     case 0x000: return DispCnt;
@@ -269,6 +276,18 @@ u32 GPU2D::Read32(u32 addr)
 }
 
 void GPU2D::Write8(u32 addr, u8 val)
+{
+    // engine B's writes go after the lines it still has to draw
+    if (Num && GPU::Band2DPending)
+    {
+        GPU::LogBand2D(GPU::band2D_Write8, addr, val);
+        return;
+    }
+
+    WriteReg8(addr, val);
+}
+
+void GPU2D::WriteReg8(u32 addr, u8 val)
 {
     switch (addr & 0x00000FFF)
     {
@@ -375,6 +394,18 @@ void GPU2D::Write8(u32 addr, u8 val)
 }
 
 void GPU2D::Write16(u32 addr, u16 val)
+{
+    // engine B's writes go after the lines it still has to draw
+    if (Num && GPU::Band2DPending)
+    {
+        GPU::LogBand2D(GPU::band2D_Write16, addr, val);
+        return;
+    }
+
+    WriteReg16(addr, val);
+}
+
+void GPU2D::WriteReg16(u32 addr, u16 val)
 {
     switch (addr & 0x00000FFF)
     {
@@ -427,21 +458,21 @@ void GPU2D::Write16(u32 addr, u16 val)
     case 0x026: BGRotD[0] = val; return;
     case 0x028:
         BGXRef[0] = (BGXRef[0] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGXRefInternal[0] = BGXRef[0];
+        if (CurVCount < 192) BGXRefInternal[0] = BGXRef[0];
         return;
     case 0x02A:
         if (val & 0x0800) val |= 0xF000;
         BGXRef[0] = (BGXRef[0] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGXRefInternal[0] = BGXRef[0];
+        if (CurVCount < 192) BGXRefInternal[0] = BGXRef[0];
         return;
     case 0x02C:
         BGYRef[0] = (BGYRef[0] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGYRefInternal[0] = BGYRef[0];
+        if (CurVCount < 192) BGYRefInternal[0] = BGYRef[0];
         return;
     case 0x02E:
         if (val & 0x0800) val |= 0xF000;
         BGYRef[0] = (BGYRef[0] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGYRefInternal[0] = BGYRef[0];
+        if (CurVCount < 192) BGYRefInternal[0] = BGYRef[0];
         return;
 
     case 0x030: BGRotA[1] = val; return;
@@ -450,21 +481,21 @@ void GPU2D::Write16(u32 addr, u16 val)
     case 0x036: BGRotD[1] = val; return;
     case 0x038:
         BGXRef[1] = (BGXRef[1] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGXRefInternal[1] = BGXRef[1];
+        if (CurVCount < 192) BGXRefInternal[1] = BGXRef[1];
         return;
     case 0x03A:
         if (val & 0x0800) val |= 0xF000;
         BGXRef[1] = (BGXRef[1] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGXRefInternal[1] = BGXRef[1];
+        if (CurVCount < 192) BGXRefInternal[1] = BGXRef[1];
         return;
     case 0x03C:
         BGYRef[1] = (BGYRef[1] & 0xFFFF0000) | val;
-        if (GPU::VCount < 192) BGYRefInternal[1] = BGYRef[1];
+        if (CurVCount < 192) BGYRefInternal[1] = BGYRef[1];
         return;
     case 0x03E:
         if (val & 0x0800) val |= 0xF000;
         BGYRef[1] = (BGYRef[1] & 0xFFFF) | (val << 16);
-        if (GPU::VCount < 192) BGYRefInternal[1] = BGYRef[1];
+        if (CurVCount < 192) BGYRefInternal[1] = BGYRef[1];
         return;
 
     case 0x040:
@@ -520,6 +551,18 @@ void GPU2D::Write16(u32 addr, u16 val)
 }
 
 void GPU2D::Write32(u32 addr, u32 val)
+{
+    // engine B's writes go after the lines it still has to draw
+    if (Num && GPU::Band2DPending)
+    {
+        GPU::LogBand2D(GPU::band2D_Write32, addr, val);
+        return;
+    }
+
+    WriteReg32(addr, val);
+}
+
+void GPU2D::WriteReg32(u32 addr, u32 val)
 {
     switch (addr & 0x00000FFF)
     {
@@ -549,28 +592,28 @@ void GPU2D::Write32(u32 addr, u32 val)
     case 0x028:
         if (val & 0x08000000) val |= 0xF0000000;
         BGXRef[0] = val;
-        if (GPU::VCount < 192) BGXRefInternal[0] = BGXRef[0];
+        if (CurVCount < 192) BGXRefInternal[0] = BGXRef[0];
         return;
     case 0x02C:
         if (val & 0x08000000) val |= 0xF0000000;
         BGYRef[0] = val;
-        if (GPU::VCount < 192) BGYRefInternal[0] = BGYRef[0];
+        if (CurVCount < 192) BGYRefInternal[0] = BGYRef[0];
         return;
 
     case 0x038:
         if (val & 0x08000000) val |= 0xF0000000;
         BGXRef[1] = val;
-        if (GPU::VCount < 192) BGXRefInternal[1] = BGXRef[1];
+        if (CurVCount < 192) BGXRefInternal[1] = BGXRef[1];
         return;
     case 0x03C:
         if (val & 0x08000000) val |= 0xF0000000;
         BGYRef[1] = val;
-        if (GPU::VCount < 192) BGYRefInternal[1] = BGYRef[1];
+        if (CurVCount < 192) BGYRefInternal[1] = BGYRef[1];
         return;
     }
 
-    Write16(addr, val&0xFFFF);
-    Write16(addr+2, val>>16);
+    WriteReg16(addr, val&0xFFFF);
+    WriteReg16(addr+2, val>>16);
 }
 
 void GPU2D::UpdateMosaicCounters(u32 line)
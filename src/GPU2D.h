@@ -21,6 +21,8 @@
 
 #include "types.h"
 #include "Savestate.h"
+#include "NonStupidBitfield.h"
+#include "GPU2D_Composite.h"
 
 class GPU2D
 {
@@ -34,7 +36,7 @@ public:
 
     void SetEnabled(bool enable) { Enabled = enable; }
     void SetFramebuffer(u32* buf);
-    virtual void SetRenderSettings(bool accel) = 0;
+    virtual void SetRenderSettings(bool accel, bool scalar) = 0;
 
     u8 Read8(u32 addr);
     u16 Read16(u32 addr);
@@ -42,6 +44,10 @@ public:
     void Write8(u32 addr, u8 val);
     void Write16(u32 addr, u16 val);
     void Write32(u32 addr, u32 val);
+    // without logging them for a pending band, see GPU::Band2DPending
+    void WriteReg8(u32 addr, u8 val);
+    void WriteReg16(u32 addr, u16 val);
+    void WriteReg32(u32 addr, u32 val);
 
     bool UsesFIFO()
     {
@@ -62,6 +68,10 @@ public:
 
     void CheckWindows(u32 line);
 
+    // GPU::VCount of the line the engine is at, engine B can be behind it
+    // while its lines are drawn on another thread
+    u32 CurVCount;
+
     u16* GetBGExtPal(u32 slot, u32 pal);
     u16* GetOBJExtPal();
 
@@ -130,12 +140,18 @@ public:
     GPU2D_Soft(u32 num);
     ~GPU2D_Soft() override {}
 
-    void SetRenderSettings(bool accel) override;
+    void SetRenderSettings(bool accel, bool scalar) override;
     
     void DrawScanline(u32 line) override;
     void DrawSprites(u32 line) override;
     void VBlankEnd() override;
 
+    // the color effects, master brightness and conversion to BGRA of
+    // DrawScanline() on its own, for comparing the vectorised loops to the
+    // scalar ones (--selftest-2d). line holds the top two layers (512 pixels)
+    // and receives the 256 final pixels
+    void CompositeTestLine(u32* line, const u8* windowMask, u16 blendCnt, u8 eva, u8 evb, u8 evy, u16 masterBrightness);
+
 protected:
     void MosaicXSizeChanged() override;
 
@@ -150,16 +166,83 @@ private:
 
     u32 NumSprites;
 
+    // the sprites which can be visible, in the order they're drawn and with
+    // their attributes decoded. it's only built again after OAM was written
+    struct OBJEntry
+    {
+        u8 Num;
+        bool Rotscale;
+        bool Window;
+        bool Mosaic;
+        u32 YPos;
+        s32 XPos;
+        u32 Width, Height;
+        u32 BoundWidth, BoundHeight;
+    };
+
+    OBJEntry OBJList[128];
+    u32 OBJListLength;
+    bool OBJListDirty;
+    // for every line, the indices into OBJList of the sprites without Y
+    // mosaic which cover it. the ones with Y mosaic are in OBJMosaicList
+    u8 OBJBins[256][128];
+    u8 OBJBinLength[256];
+    u8 OBJMosaicList[128];
+    u32 OBJMosaicListLength;
+
+    void BuildOBJList();
+
     u8 MosaicTable[16][256];
     u8* CurBGXMosaicTable;
     u8* CurOBJXMosaicTable;
     
+    // rows of the 8x8 tiles of the text BGs, already flipped and with the
+    // colors from their palette like they're put into BGOBJLine. bit 31 is
+    // set for transparent pixels. an entry is still valid if neither its
+    // 512 byte block of BG VRAM nor its palette changed after it was
+    // decoded, which is told by the stamps
+    struct BGTile
+    {
+        u32 Key;
+        u32 Stamp;
+        // the rows which are decoded
+        u32 Rows;
+        u32 Pixels[64];
+    };
+
+    static const u32 BGTileCacheBits = 12;
+    BGTile BGTileCache[1 << BGTileCacheBits];
+
+    u32 BGTileStamp;
+    u32 BGVRAMStamp[512*1024 / 512];
+    u32 BGExtPalStamp[32*1024 / 512];
+    // the standard palette is compared with its last state, so that
+    // only the tiles using the 16 color banks which changed are decoded again
+    u16 BGPalCopy[256];
+    u32 BGPalStamp[16];
+    u32 BGPalStampAll;
+
+    void ResetBGTileCache();
+    template<u32 Size> void InvalidateBGTiles(NonStupidBitField<Size>& vramDirty, NonStupidBitField<64>& extPalDirty);
+    template<bool bpp8> const u32* GetBGTileRow(u8* bgvram, u32 tileaddr, u32 palkey, u16* pal, u32 row, bool hflip);
+    template<bool accel> void DrawBGTileRow(u32* dst, const u32* src, u32 count, u32 flag);
+    // whether the window lets the BG through everywhere on this line
+    bool BGWindowFull(u32 bgnum);
+    
     u32 ColorBlend4(u32 val1, u32 val2, u32 eva, u32 evb);
     u32 ColorBlend5(u32 val1, u32 val2);
     u32 ColorBrightnessUp(u32 val, u32 factor);
     u32 ColorBrightnessDown(u32 val, u32 factor);
     u32 ColorComposite(int i, u32 val1, u32 val2);
 
+    void ApplyColorEffects();
+    void ApplyMasterBrightness(u32* dst);
+    void ConvertToBGRA(u32* dst);
+
+    // vectorised versions of the loops over whole lines, NULL if there are
+    // none or the scalar loops are forced (RenderSettings::Scalar2D)
+    const GPU2D_Composite::Funcs* CompositeFuncs;
+
     template<u32 bgmode> void DrawScanlineBGMode(u32 line);
     void DrawScanlineBGMode6(u32 line);
     void DrawScanlineBGMode7(u32 line);
@@ -0,0 +1,260 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#include <string.h>
+#include "GPU2D_Composite.h"
+
+namespace GPU2D_Composite
+{
+
+#if defined(__x86_64__) || defined(__aarch64__)
+
+// the loops are written with the vector extensions of GCC and clang, so that
+// the same code becomes AVX2 or NEON. the colors stay in their bytes,
+// only widened to 16 bits for multiplying, every decision about the effect
+// of a pixel is made on whole 32-bit pixels
+
+// a vector of Size bytes, 16 for NEON, 32 for AVX2
+template <int Size>
+struct Vec
+{
+    static const int Pixels = Size / 4;
+    typedef u8 U8 __attribute__((vector_size(Size)));
+    typedef u16 U16 __attribute__((vector_size(Size * 2)));
+    typedef u32 U32 __attribute__((vector_size(Size)));
+    // one byte per pixel
+    typedef u8 Bytes __attribute__((vector_size(Size / 4)));
+};
+
+// the helpers are only inlined into the functions of DEFINE_FUNCS,
+// so they're compiled for the same target
+#ifdef __x86_64__
+#define INLINE inline __attribute__((always_inline, target("avx2")))
+#else
+#define INLINE inline __attribute__((always_inline))
+#endif
+
+template <typename T>
+INLINE T Select(const T& mask, const T& a, const T& b)
+{
+    return (a & mask) | (b & ~mask);
+}
+
+template <typename V>
+INLINE typename V::U32 Load(const u32* src)
+{
+    typename V::U32 ret;
+    memcpy(&ret, src, sizeof(ret));
+    return ret;
+}
+
+template <typename V>
+INLINE void Store(u32* dst, const typename V::U32& val)
+{
+    memcpy(dst, &val, sizeof(val));
+}
+
+// the color channels, each in 16 bits. with AVX2 these take 64 bytes,
+// which are returned differently with AVX-512, so they're never returned
+template <typename V>
+INLINE void Widen(typename V::U16& ret, const typename V::U32& val)
+{
+    ret = __builtin_convertvector((typename V::U8)(val & 0x3F3F3F), typename V::U16);
+}
+
+template <typename V>
+INLINE typename V::U32 Narrow(const typename V::U16& val)
+{
+    return (typename V::U32)__builtin_convertvector(val, typename V::U8);
+}
+
+// the same value for every channel of the pixel, it has to fit into a byte
+template <typename V>
+INLINE void PerChannel(typename V::U16& ret, const typename V::U32& val)
+{
+    Widen<V>(ret, val | (val << 8) | (val << 16));
+}
+
+template <typename V>
+INLINE void CompositeLine(u32* line, const u8* windowMask, u32 blendCnt, u32 eva, u32 evb, u32 evy)
+{
+    typedef typename V::U32 U32;
+    typedef typename V::U16 U16;
+
+    u32 mode = (blendCnt >> 6) & 0x3;
+    // without second targets only brightness changes are left, if any
+    if (!(blendCnt & 0x3F00) && (mode < 2 || !(blendCnt & 0x3F)))
+        return;
+
+    // every effect is done as (c1 * a + c2 * b + k) >> 5. the factors for
+    // blending with EVA and EVB are doubled for that, for brightness changes
+    // c2 is white when brightening and k rounds up when darkening
+    U32 modeA = {}, modeB = {}, modeK = {};
+    switch (mode)
+    {
+    case 1: modeA += eva * 2; modeB += evb * 2; break;
+    case 2: modeA += (16 - evy) * 2; modeB += evy * 2; break;
+    case 3: modeA += (16 - evy) * 2; modeK += 30; break;
+    }
+
+    const U32 target1Mask = (U32){} + (blendCnt & 0x3F);
+    const U32 target2Mask = (U32){} + (blendCnt >> 8);
+
+    for (int i = 0; i < 256; i += V::Pixels)
+    {
+        U32 val1 = Load<V>(&line[i]);
+        U32 val2 = Load<V>(&line[256+i]);
+        typename V::Bytes window;
+        memcpy(&window, &windowMask[i], sizeof(window));
+
+        U32 flag1 = val1 >> 24;
+        U32 flag2 = val2 >> 24;
+        U32 sprite1 = (U32)((flag1 & 0x80) != 0);
+        U32 layer3D1 = (U32)((flag1 & 0x40) != 0);
+
+        // the bits of BLDCNT for the layers, sprites are 0x10, 3D is BG0
+        U32 target1 = Select(sprite1, (U32){} + 0x10, Select(layer3D1, (U32){} + 0x01, flag1));
+        U32 target2 = Select((U32)((flag2 & 0x80) != 0), (U32){} + 0x10,
+            Select((U32)((flag2 & 0x40) != 0), (U32){} + 0x01, flag2));
+        U32 isTarget1 = (U32)((target1 & target1Mask) != 0);
+        U32 isTarget2 = (U32)((target2 & target2Mask) != 0);
+        U32 inWindow = (U32)((__builtin_convertvector(window, U32) & 0x20) != 0);
+
+        // semi-transparent sprites and the 3D layer blend regardless of the window
+        U32 blend4 = sprite1 & isTarget2;
+        U32 blend5 = ~sprite1 & layer3D1 & isTarget2;
+        U32 effect = ~blend4 & ~blend5 & isTarget1 & inWindow;
+        if (mode == 1)
+            effect &= isTarget2;
+        else if (mode == 0)
+            effect = (U32){};
+
+        U32 alpha = flag1 & 0x1F;
+        U32 spriteAlpha = sprite1 & layer3D1;
+        U32 eva5 = alpha + 1;
+        // fully opaque 3D pixels are left alone
+        blend5 &= (U32)(eva5 != 32);
+
+        U32 a = Select(effect, modeA, (U32){} + 32);
+        U32 b = effect & modeB;
+        U32 k = effect & modeK;
+        a = Select(blend4, Select(spriteAlpha, alpha * 2, (U32){} + eva * 2), a);
+        b = Select(blend4, Select(spriteAlpha, (16 - alpha) * 2, (U32){} + evb * 2), b);
+        a = Select(blend5, eva5, a);
+        b = Select(blend5, 32 - eva5, b);
+        k = Select(blend5, (U32)(eva5 <= 16) & 32, k);
+
+        // brightening blends with white
+        if (mode == 2)
+            val2 = Select(effect, (U32){} + 0x3F3F3F, val2);
+
+        U16 c1, c2, a16, b16, k16;
+        Widen<V>(c1, val1);
+        Widen<V>(c2, val2);
+        PerChannel<V>(a16, a);
+        PerChannel<V>(b16, b);
+        PerChannel<V>(k16, k);
+        U16 res = (c1 * a16 + c2 * b16 + k16) >> 5;
+        // clamped to 63 without comparing, which GCC would do one by one
+        // for vectors wider than a register. res is at most 126 here
+        res = (res | (0 - ((res + 64) >> 7))) & 63;
+
+        U32 any = blend4 | blend5 | effect;
+        Store<V>(&line[i], Select(any, (Narrow<V>(res) & 0xFFFFFF) | 0xFF000000, val1));
+    }
+}
+
+template <typename V, bool up>
+INLINE void BrightnessLine(u32* line, u32 factor)
+{
+    typedef typename V::U16 U16;
+
+    for (int i = 0; i < 256; i += V::Pixels)
+    {
+        U16 c;
+        Widen<V>(c, Load<V>(&line[i]));
+        if (up)
+            c += ((63 - c) * (u16)factor) >> 4;
+        else
+            c -= (c * (u16)factor) >> 4;
+
+        Store<V>(&line[i], (Narrow<V>(c) & 0xFFFFFF) | 0xFF000000);
+    }
+}
+
+template <typename V>
+INLINE void ConvertLine(u32* line)
+{
+    typedef typename V::U32 U32;
+
+    for (int i = 0; i < 256; i += V::Pixels)
+    {
+        U32 c = Load<V>(&line[i]);
+
+        U32 r = (c << 18) & 0xFC0000;
+        U32 g = (c << 2) & 0xFC00;
+        U32 b = (c >> 14) & 0xFC;
+        c = r | g | b;
+        c = c | ((c & 0xC0C0C0) >> 6) | 0xFF000000;
+
+        Store<V>(&line[i], c);
+    }
+}
+
+#define DEFINE_FUNCS(name, vec, attrib) \
+    attrib static void Composite_##name(u32* line, const u8* windowMask, u32 blendCnt, u32 eva, u32 evb, u32 evy) \
+    { CompositeLine<vec>(line, windowMask, blendCnt, eva, evb, evy); } \
+    attrib static void BrightnessUp_##name(u32* line, u32 factor) \
+    { BrightnessLine<vec, true>(line, factor); } \
+    attrib static void BrightnessDown_##name(u32* line, u32 factor) \
+    { BrightnessLine<vec, false>(line, factor); } \
+    attrib static void ConvertToBGRA_##name(u32* line) \
+    { ConvertLine<vec>(line); } \
+    static const Funcs Funcs_##name = \
+    { #name, Composite_##name, BrightnessUp_##name, BrightnessDown_##name, ConvertToBGRA_##name };
+
+#ifdef __x86_64__
+DEFINE_FUNCS(AVX2, Vec<32>, __attribute__((target("avx2"))))
+#else
+DEFINE_FUNCS(NEON, Vec<16>, )
+#endif
+
+const Funcs* Get()
+{
+#ifdef __x86_64__
+    // with only SSE2 these aren't faster than the scalar
+    // loops, which the compiler vectorises well enough
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return &Funcs_AVX2;
+    return NULL;
+#else
+    return &Funcs_NEON;
+#endif
+}
+
+#else
+
+const Funcs* Get()
+{
+    return NULL;
+}
+
+#endif
+
+}
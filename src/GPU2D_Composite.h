@@ -0,0 +1,48 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef GPU2D_COMPOSITE_H
+#define GPU2D_COMPOSITE_H
+
+#include "types.h"
+
+// vectorised versions of the per pixel loops of GPU2D_Soft, which
+// work on whole lines of 256 pixels and give exactly the same results
+namespace GPU2D_Composite
+{
+
+struct Funcs
+{
+    const char* Name;
+
+    // ColorComposite for every pixel, line is BGOBJLine. the first 256
+    // pixels are replaced with the result, the next 256 are the layer below
+    void (*Composite)(u32* line, const u8* windowMask, u32 blendCnt, u32 eva, u32 evb, u32 evy);
+    void (*BrightnessUp)(u32* line, u32 factor);
+    void (*BrightnessDown)(u32* line, u32 factor);
+    // to the 32-bit BGRA of the framebuffer
+    void (*ConvertToBGRA)(u32* line);
+};
+
+// AVX2 on x64 and NEON on ARM64, if the host CPU supports them.
+// NULL otherwise, the scalar loops are used then, as with Scalar2D
+const Funcs* Get();
+
+}
+
+#endif // GPU2D_COMPOSITE_H
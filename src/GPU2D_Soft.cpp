@@ -13,11 +13,18 @@ GPU2D_Soft::GPU2D_Soft(u32 num)
             MosaicTable[m][x] = offset;
         }
     }
+
+    CompositeFuncs = GPU2D_Composite::Get();
+
+    ResetBGTileCache();
+
+    OBJListDirty = true;
 }
 
-void GPU2D_Soft::SetRenderSettings(bool accel)
+void GPU2D_Soft::SetRenderSettings(bool accel, bool scalar)
 {
     Accelerated = accel;
+    CompositeFuncs = scalar ? NULL : GPU2D_Composite::Get();
 }
 
 u32 GPU2D_Soft::ColorBlend4(u32 val1, u32 val2, u32 eva, u32 evb)
@@ -150,13 +157,47 @@ u32 GPU2D_Soft::ColorComposite(int i, u32 val1, u32 val2)
     return val1;
 }
 
+void GPU2D_Soft::ApplyColorEffects()
+{
+    if (CompositeFuncs)
+    {
+        CompositeFuncs->Composite(BGOBJLine, WindowMask, BlendCnt, EVA, EVB, EVY);
+        return;
+    }
+
+    for (int i = 0; i < 256; i++)
+    {
+        u32 val1 = BGOBJLine[i];
+        u32 val2 = BGOBJLine[256+i];
+
+        BGOBJLine[i] = ColorComposite(i, val1, val2);
+    }
+}
+
+void GPU2D_Soft::CompositeTestLine(u32* line, const u8* windowMask, u16 blendCnt, u8 eva, u8 evb, u8 evy, u16 masterBrightness)
+{
+    memcpy(BGOBJLine, line, 512*4);
+    memcpy(WindowMask, windowMask, 256);
+    BlendCnt = blendCnt;
+    EVA = eva;
+    EVB = evb;
+    EVY = evy;
+    MasterBrightness = masterBrightness;
+
+    ApplyColorEffects();
+
+    memcpy(line, BGOBJLine, 256*4);
+    ApplyMasterBrightness(line);
+    ConvertToBGRA(line);
+}
+
 void GPU2D_Soft::DrawScanline(u32 line)
 {
     int stride = Accelerated ? (256*3 + 1) : 256;
     u32* dst = &Framebuffer[stride * line];
 
     int n3dline = line;
-    line = GPU::VCount;
+    line = CurVCount;
 
     if (Num == 0)
     {
@@ -166,6 +207,8 @@ void GPU2D_Soft::DrawScanline(u32 line)
         GPU::MakeVRAMFlat_ABGExtPalCoherent(bgExtPalDirty);
         auto objExtPalDirty = GPU::VRAMDirty_AOBJExtPal.DeriveState(&GPU::VRAMMap_AOBJExtPal);
         GPU::MakeVRAMFlat_AOBJExtPalCoherent(objExtPalDirty);
+
+        InvalidateBGTiles(bgDirty, bgExtPalDirty);
     }
     else
     {
@@ -175,6 +218,8 @@ void GPU2D_Soft::DrawScanline(u32 line)
         GPU::MakeVRAMFlat_BBGExtPalCoherent(bgExtPalDirty);
         auto objExtPalDirty = GPU::VRAMDirty_BOBJExtPal.DeriveState(&GPU::VRAMMap_BOBJExtPal);
         GPU::MakeVRAMFlat_BOBJExtPalCoherent(objExtPalDirty);
+
+        InvalidateBGTiles(bgDirty, bgExtPalDirty);
     }
 
     bool forceblank = false;
@@ -304,34 +349,58 @@ void GPU2D_Soft::DrawScanline(u32 line)
 
     // master brightness
     if (dispmode != 0)
+        ApplyMasterBrightness(dst);
+
+    ConvertToBGRA(dst);
+}
+
+void GPU2D_Soft::ApplyMasterBrightness(u32* dst)
+{
+    if ((MasterBrightness >> 14) == 1)
     {
-        if ((MasterBrightness >> 14) == 1)
-        {
-            // up
-            u32 factor = MasterBrightness & 0x1F;
-            if (factor > 16) factor = 16;
+        // up
+        u32 factor = MasterBrightness & 0x1F;
+        if (factor > 16) factor = 16;
 
+        if (CompositeFuncs)
+            CompositeFuncs->BrightnessUp(dst, factor);
+        else
+        {
             for (int i = 0; i < 256; i++)
             {
                 dst[i] = ColorBrightnessUp(dst[i], factor);
             }
         }
-        else if ((MasterBrightness >> 14) == 2)
-        {
-            // down
-            u32 factor = MasterBrightness & 0x1F;
-            if (factor > 16) factor = 16;
+    }
+    else if ((MasterBrightness >> 14) == 2)
+    {
+        // down
+        u32 factor = MasterBrightness & 0x1F;
+        if (factor > 16) factor = 16;
 
+        if (CompositeFuncs)
+            CompositeFuncs->BrightnessDown(dst, factor);
+        else
+        {
             for (int i = 0; i < 256; i++)
             {
                 dst[i] = ColorBrightnessDown(dst[i], factor);
             }
         }
     }
+}
 
+void GPU2D_Soft::ConvertToBGRA(u32* dst)
+{
     // convert to 32-bit BGRA
     // note: 32-bit RGBA would be more straightforward, but
     // BGRA seems to be more compatible (Direct2D soft, cairo...)
+    if (CompositeFuncs)
+    {
+        CompositeFuncs->ConvertToBGRA(dst);
+        return;
+    }
+
     for (int i = 0; i < 256; i+=2)
     {
         u64 c = *(u64*)&dst[i];
@@ -768,13 +837,7 @@ void GPU2D_Soft::DrawScanline_BGOBJ(u32 line)
 
     if (!Accelerated)
     {
-        for (int i = 0; i < 256; i++)
-        {
-            u32 val1 = BGOBJLine[i];
-            u32 val2 = BGOBJLine[256+i];
-
-            BGOBJLine[i] = ColorComposite(i, val1, val2);
-        }
+        ApplyColorEffects();
     }
     else
     {
@@ -938,6 +1001,135 @@ void GPU2D_Soft::DrawBG_3D()
     }
 }
 
+void GPU2D_Soft::ResetBGTileCache()
+{
+    for (u32 i = 0; i < (1 << BGTileCacheBits); i++)
+        BGTileCache[i].Key = 0xFFFFFFFF;
+
+    BGTileStamp = 0;
+    memset(BGVRAMStamp, 0, sizeof(BGVRAMStamp));
+    memset(BGExtPalStamp, 0, sizeof(BGExtPalStamp));
+    memset(BGPalStamp, 0, sizeof(BGPalStamp));
+    BGPalStampAll = 0;
+    memset(BGPalCopy, 0, sizeof(BGPalCopy));
+}
+
+template<u32 Size>
+void GPU2D_Soft::InvalidateBGTiles(NonStupidBitField<Size>& vramDirty, NonStupidBitField<64>& extPalDirty)
+{
+    if (BGTileStamp == 0xFFFFFFFF)
+        ResetBGTileCache();
+
+    u32 stamp = BGTileStamp + 1;
+    bool changed = false;
+
+    for (typename NonStupidBitField<Size>::Iterator it = vramDirty.Begin(); it != vramDirty.End(); it++)
+    {
+        BGVRAMStamp[*it] = stamp;
+        changed = true;
+    }
+    for (NonStupidBitField<64>::Iterator it = extPalDirty.Begin(); it != extPalDirty.End(); it++)
+    {
+        BGExtPalStamp[*it] = stamp;
+        changed = true;
+    }
+
+    // the standard BG palette is the first 512 bytes of either half. the
+    // flag is cleared by GPU once the engine drew the line
+    if (GPU::PaletteDirty[Num] & (1 << 0))
+    {
+        u16* pal = (u16*)&GPU::Palette[Num ? 0x400 : 0];
+        for (int i = 0; i < 16; i++)
+        {
+            if (memcmp(&BGPalCopy[i*16], &pal[i*16], 32))
+            {
+                memcpy(&BGPalCopy[i*16], &pal[i*16], 32);
+                BGPalStamp[i] = stamp;
+                BGPalStampAll = stamp;
+                changed = true;
+            }
+        }
+    }
+
+    if (changed)
+        BGTileStamp = stamp;
+}
+
+// palkey is the palette bank for 16 colors, 0 for the standard palette with 256 colors
+// and 16 + the index of the 512 byte block for extended palettes
+template<bool bpp8>
+const u32* GPU2D_Soft::GetBGTileRow(u8* bgvram, u32 tileaddr, u32 palkey, u16* pal, u32 row, bool hflip)
+{
+    u32 key = (tileaddr >> 5) | (bpp8 << 14) | (hflip << 15) | (palkey << 16);
+    BGTile& tile = BGTileCache[(key * 0x9E3779B1) >> (32 - BGTileCacheBits)];
+
+    u32 palStamp;
+    if (palkey >= 16) palStamp = BGExtPalStamp[palkey - 16];
+    else if (bpp8)    palStamp = BGPalStampAll;
+    else              palStamp = BGPalStamp[palkey];
+    if (tile.Key != key || tile.Stamp < BGVRAMStamp[tileaddr / GPU::VRAMDirtyGranularity] || tile.Stamp < palStamp)
+    {
+        tile.Key = key;
+        tile.Stamp = BGTileStamp;
+        tile.Rows = 0;
+    }
+
+    u32* pixels = &tile.Pixels[row << 3];
+    if (!(tile.Rows & (1 << row)))
+    {
+        // rows are only decoded once they're drawn, the other
+        // ones might change or be evicted before that
+        tile.Rows |= 1 << row;
+        for (int i = 0; i < 8; i++)
+        {
+            u32 x = hflip ? (7-i) : i;
+            u8 color;
+            if (bpp8) color = bgvram[tileaddr + (row << 3) + x];
+            else      color = (bgvram[tileaddr + (row << 2) + (x >> 1)] >> ((x & 0x1) << 2)) & 0x0F;
+
+            if (color)
+            {
+                u16 val = pal[color];
+                u8 r = (val & 0x001F) << 1;
+                u8 g = (val & 0x03E0) >> 4;
+                u8 b = (val & 0x7C00) >> 9;
+                pixels[i] = r | (g << 8) | (b << 16);
+            }
+            else
+                pixels[i] = 0x80000000;
+        }
+    }
+    return pixels;
+}
+
+// DrawPixel for a run of pixels, without any branches so that it's vectorised
+template<bool accel>
+void GPU2D_Soft::DrawBGTileRow(u32* dst, const u32* src, u32 count, u32 flag)
+{
+    for (u32 i = 0; i < count; i++)
+    {
+        u32 transparent = (u32)((s32)src[i] >> 31);
+        u32 top = dst[i];
+        u32 below = dst[256+i];
+
+        if (accel) dst[512+i] = (dst[512+i] & transparent) | (below & ~transparent);
+        dst[256+i] = (below & transparent) | (top & ~transparent);
+        dst[i] = (top & transparent) | ((src[i] | flag) & ~transparent);
+    }
+}
+
+bool GPU2D_Soft::BGWindowFull(u32 bgnum)
+{
+    if (!(DispCnt & 0xE000))
+        return true;
+
+    u64 mask = 0x0101010101010101ULL << bgnum;
+    u64 all = mask;
+    for (int i = 0; i < 256; i += 8)
+        all &= *(u64*)&WindowMask[i];
+    return all == mask;
+}
+
 template<bool mosaic, GPU2D_Soft::DrawPixel drawPixel>
 void GPU2D_Soft::DrawBG_Text(u32 line, u32 bgnum)
 {
@@ -989,6 +1181,58 @@ void GPU2D_Soft::DrawBG_Text(u32 line, u32 bgnum)
     else
         tilemapaddr += ((yoff & 0xF8) << 3);
 
+    if (!mosaic && BGWindowFull(bgnum))
+    {
+        // nothing decides per pixel whether it's drawn, so the rows
+        // of the tiles are taken whole from the cache
+        u32 flag = 0x01000000<<bgnum;
+        bool bpp8 = bgcnt & 0x0080;
+        u32 lasttile = 0xFFFFFFFF;
+        const u32* pixels;
+        u32 i = 0;
+        while (i < 256)
+        {
+            u16 tile = *(u16*)&bgvram[(tilemapaddr + ((xoff & 0xF8) >> 2) + ((xoff & widexmask) << 3)) & bgvrammask];
+            // runs of the same tile are common, nothing else
+            // could have taken its place in the cache in between
+            if (tile != lasttile)
+            {
+                lasttile = tile;
+                u32 row = (tile & 0x0800) ? (7-(yoff&0x7)) : (yoff&0x7);
+                bool hflip = tile & 0x0400;
+
+                if (bpp8)
+                {
+                    u32 tileaddr = (tilesetaddr + ((tile & 0x03FF) << 6)) & bgvrammask;
+                    if (extpal) pixels = GetBGTileRow<true>(bgvram, tileaddr, 16 + extpalslot*16 + (tile>>12), GetBGExtPal(extpalslot, tile>>12), row, hflip);
+                    else        pixels = GetBGTileRow<true>(bgvram, tileaddr, 0, pal, row, hflip);
+                }
+                else
+                {
+                    u32 tileaddr = (tilesetaddr + ((tile & 0x03FF) << 5)) & bgvrammask;
+                    pixels = GetBGTileRow<false>(bgvram, tileaddr, tile>>12, pal + ((tile & 0xF000) >> 8), row, hflip);
+                }
+            }
+
+            u32 start = xoff & 0x7;
+            if (start == 0 && i <= 248)
+            {
+                DrawBGTileRow<drawPixel == DrawPixel_Accel>(&BGOBJLine[i], pixels, 8, flag);
+                i += 8;
+                xoff += 8;
+            }
+            else
+            {
+                u32 count = 8 - start;
+                if (count > 256 - i) count = 256 - i;
+                DrawBGTileRow<drawPixel == DrawPixel_Accel>(&BGOBJLine[i], pixels + start, count, flag);
+                i += count;
+                xoff += count;
+            }
+        }
+        return;
+    }
+
     u16 curtile;
     u16* curpal;
     u32 pixelsaddr;
@@ -1609,48 +1853,18 @@ void GPU2D_Soft::InterleaveSprites(u32 prio)
         DrawSprite_##type<false>(__VA_ARGS__); \
     }
 
-void GPU2D_Soft::DrawSprites(u32 line)
+void GPU2D_Soft::BuildOBJList()
 {
-    if (line == 0)
-    {
-        // reset those counters here
-        // TODO: find out when those are supposed to be reset
-        // it would make sense to reset them at the end of VBlank
-        // however, sprites are rendered one scanline in advance
-        // so they need to be reset a bit earlier
-
-        OBJMosaicY = 0;
-        OBJMosaicYCount = 0;
-    }
-
-    if (Num == 0)
-    {
-        auto objDirty = GPU::VRAMDirty_AOBJ.DeriveState(GPU::VRAMMap_AOBJ);
-        GPU::MakeVRAMFlat_AOBJCoherent(objDirty);
-    }
-    else
-    {
-        auto objDirty = GPU::VRAMDirty_BOBJ.DeriveState(GPU::VRAMMap_BOBJ);
-        GPU::MakeVRAMFlat_BOBJCoherent(objDirty);
-    }
-
-    NumSprites = 0;
-    memset(OBJLine, 0, 256*4);
-    memset(OBJWindow, 0, 256);
-    if (!(DispCnt & 0x1000)) return;
-
-    memset(OBJIndex, 0xFF, 256);
-
     u16* oam = (u16*)&GPU::OAM[Num ? 0x400 : 0];
 
-    const s32 spritewidth[16] =
+    const u32 spritewidth[16] =
     {
         8, 16, 8, 8,
         16, 32, 8, 8,
         32, 32, 16, 8,
         64, 64, 32, 8
     };
-    const s32 spriteheight[16] =
+    const u32 spriteheight[16] =
     {
         8, 8, 16, 8,
         16, 8, 32, 8,
@@ -1658,6 +1872,10 @@ void GPU2D_Soft::DrawSprites(u32 line)
         64, 32, 64, 8
     };
 
+    OBJListLength = 0;
+    OBJMosaicListLength = 0;
+    memset(OBJBinLength, 0, 256);
+
     for (int bgnum = 0x0C00; bgnum >= 0x0000; bgnum -= 0x0400)
     {
         for (int sprnum = 127; sprnum >= 0; sprnum--)
@@ -1667,69 +1885,131 @@ void GPU2D_Soft::DrawSprites(u32 line)
             if ((attrib[2] & 0x0C00) != bgnum)
                 continue;
 
-            bool iswin = (((attrib[0] >> 10) & 0x3) == 2);
+            // disabled
+            if ((attrib[0] & 0x0300) == 0x0200)
+                continue;
+
+            OBJEntry& entry = OBJList[OBJListLength];
+            entry.Num = sprnum;
+            entry.Rotscale = attrib[0] & 0x0100;
+            entry.Window = ((attrib[0] >> 10) & 0x3) == 2;
+            entry.Mosaic = (attrib[0] & 0x1000) && !entry.Window;
+
+            u32 sizeparam = (attrib[0] >> 14) | ((attrib[1] & 0xC000) >> 12);
+            entry.Width = spritewidth[sizeparam];
+            entry.Height = spriteheight[sizeparam];
+            entry.BoundWidth = entry.Width;
+            entry.BoundHeight = entry.Height;
 
-            u32 sprline;
-            if ((attrib[0] & 0x1000) && !iswin)
+            if (entry.Rotscale && (attrib[0] & 0x0200))
             {
-                // apply Y mosaic
-                sprline = OBJMosaicY;
+                entry.BoundWidth <<= 1;
+                entry.BoundHeight <<= 1;
             }
-            else
-                sprline = line;
 
-            if (attrib[0] & 0x0100)
-            {
-                u32 sizeparam = (attrib[0] >> 14) | ((attrib[1] & 0xC000) >> 12);
-                s32 width = spritewidth[sizeparam];
-                s32 height = spriteheight[sizeparam];
-                s32 boundwidth = width;
-                s32 boundheight = height;
+            entry.YPos = attrib[0] & 0xFF;
+            entry.XPos = (s32)(attrib[1] << 23) >> 23;
+            if (entry.XPos <= -(s32)entry.BoundWidth)
+                continue;
 
-                if (attrib[0] & 0x0200)
+            if (entry.Mosaic)
+            {
+                OBJMosaicList[OBJMosaicListLength++] = OBJListLength;
+            }
+            else
+            {
+                for (u32 y = 0; y < entry.BoundHeight; y++)
                 {
-                    boundwidth <<= 1;
-                    boundheight <<= 1;
+                    u32 line = (entry.YPos + y) & 0xFF;
+                    OBJBins[line][OBJBinLength[line]++] = OBJListLength;
                 }
+            }
+
+            OBJListLength++;
+        }
+    }
+}
 
-                u32 ypos = attrib[0] & 0xFF;
-                ypos = (sprline - ypos) & 0xFF;
-                if (ypos >= (u32)boundheight)
-                    continue;
+void GPU2D_Soft::DrawSprites(u32 line)
+{
+    if (line == 0)
+    {
+        // reset those counters here
+        // TODO: find out when those are supposed to be reset
+        // it would make sense to reset them at the end of VBlank
+        // however, sprites are rendered one scanline in advance
+        // so they need to be reset a bit earlier
 
-                s32 xpos = (s32)(attrib[1] << 23) >> 23;
-                if (xpos <= -boundwidth)
-                    continue;
+        OBJMosaicY = 0;
+        OBJMosaicYCount = 0;
+    }
 
-                u32 rotparamgroup = (attrib[1] >> 9) & 0x1F;
+    // GPU clears the flag once the engine saw it
+    if (GPU::OAMDirty[Num])
+        OBJListDirty = true;
 
-                DoDrawSprite(Rotscale, sprnum, boundwidth, boundheight, width, height, xpos, ypos);
+    if (Num == 0)
+    {
+        auto objDirty = GPU::VRAMDirty_AOBJ.DeriveState(GPU::VRAMMap_AOBJ);
+        GPU::MakeVRAMFlat_AOBJCoherent(objDirty);
+    }
+    else
+    {
+        auto objDirty = GPU::VRAMDirty_BOBJ.DeriveState(GPU::VRAMMap_BOBJ);
+        GPU::MakeVRAMFlat_BOBJCoherent(objDirty);
+    }
 
-                NumSprites++;
-            }
-            else
-            {
-                if (attrib[0] & 0x0200)
-                    continue;
+    NumSprites = 0;
+    memset(OBJLine, 0, 256*4);
+    memset(OBJWindow, 0, 256);
+    if (!(DispCnt & 0x1000)) return;
+
+    memset(OBJIndex, 0xFF, 256);
+
+    if (OBJListDirty)
+    {
+        BuildOBJList();
+        OBJListDirty = false;
+    }
 
-                u32 sizeparam = (attrib[0] >> 14) | ((attrib[1] & 0xC000) >> 12);
-                s32 width = spritewidth[sizeparam];
-                s32 height = spriteheight[sizeparam];
+    // both lists are in the order the sprites are drawn
+    u8* bin = OBJBins[line];
+    u32 binlength = OBJBinLength[line];
+    u32 i = 0, j = 0;
+    while (i < binlength || j < OBJMosaicListLength)
+    {
+        u32 index;
+        if (j == OBJMosaicListLength || (i < binlength && bin[i] < OBJMosaicList[j]))
+            index = bin[i++];
+        else
+            index = OBJMosaicList[j++];
 
-                u32 ypos = attrib[0] & 0xFF;
-                ypos = (sprline - ypos) & 0xFF;
-                if (ypos >= (u32)height)
-                    continue;
+        OBJEntry& entry = OBJList[index];
 
-                s32 xpos = (s32)(attrib[1] << 23) >> 23;
-                if (xpos <= -width)
-                    continue;
+        u32 sprline;
+        if (entry.Mosaic)
+        {
+            // apply Y mosaic
+            sprline = OBJMosaicY;
+        }
+        else
+            sprline = line;
 
-                DoDrawSprite(Normal, sprnum, width, height, xpos, ypos);
+        u32 ypos = (sprline - entry.YPos) & 0xFF;
+        if (ypos >= entry.BoundHeight)
+            continue;
 
-                NumSprites++;
-            }
+        bool iswin = entry.Window;
+        if (entry.Rotscale)
+        {
+            DoDrawSprite(Rotscale, entry.Num, entry.BoundWidth, entry.BoundHeight, entry.Width, entry.Height, entry.XPos, ypos);
+        }
+        else
+        {
+            DoDrawSprite(Normal, entry.Num, entry.Width, entry.Height, entry.XPos, ypos);
         }
+
+        NumSprites++;
     }
 }
 
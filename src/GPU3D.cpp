@@ -1756,6 +1756,9 @@ void CmdFIFOWrite(CmdFIFOEntry& entry)
         GXStat |= (1<<0); // box/pos/vec test
         NumTestCommands++;
     }
+
+    // the FIFO might not be less than half full anymore
+    CheckFIFOIRQ();
 }
 
 CmdFIFOEntry CmdFIFORead()
@@ -2641,7 +2644,27 @@ u32* GetLine(int line)
 }
 
 
-void WriteToGXFIFO(u32 val)
+// CmdFIFOWrite for when the FIFO is known to have room and not to be empty,
+// so that it can't go to the pipe or the stall queue. the IRQ is left alone
+inline void CmdFIFOQueue(CmdFIFOEntry& entry)
+{
+    CmdFIFO.Write(entry);
+
+    if (entry.Command == 0x11 || entry.Command == 0x12)
+    {
+        GXStat |= (1<<14); // push/pop matrix
+        NumPushPopCommands++;
+    }
+    else if (entry.Command == 0x70 || entry.Command == 0x71 || entry.Command == 0x72)
+    {
+        GXStat |= (1<<0); // box/pos/vec test
+        NumTestCommands++;
+    }
+}
+
+// unpacks one word written to GXFIFO into up to four entries
+template <void (*Write)(CmdFIFOEntry&)>
+inline void UnpackGXFIFOWord(u32 val)
 {
     if (NumCommands == 0)
     {
@@ -2662,7 +2685,7 @@ void WriteToGXFIFO(u32 val)
             CmdFIFOEntry entry;
             entry.Command = CurCommand & 0xFF;
             entry.Param = val;
-            CmdFIFOWrite(entry);
+            Write(entry);
         }
 
         if (ParamCount >= TotalParams)
@@ -2679,6 +2702,45 @@ void WriteToGXFIFO(u32 val)
     }
 }
 
+void WriteToGXFIFO(u32 val)
+{
+    UnpackGXFIFOWord<CmdFIFOWrite>(val);
+}
+
+u32 WriteToGXFIFOBlock(const u32* vals, u32 count)
+{
+    if (!GeometryEnabled)
+        return count;
+
+    u32 i = 0;
+    while (i < count)
+    {
+        // a word makes at most four entries. while they're sure to fit
+        // they're queued directly, otherwise one word is written normally
+        if (!CmdFIFO.IsEmpty() && CmdFIFO.CanFit(4))
+        {
+            do
+            {
+                UnpackGXFIFOWord<CmdFIFOQueue>(vals[i++]);
+            }
+            while (i < count && CmdFIFO.CanFit(4));
+
+            GXStat |= (1<<27);
+        }
+        else
+        {
+            UnpackGXFIFOWord<CmdFIFOWrite>(vals[i++]);
+
+            // the stall queue is only used while the system is stalled
+            if (!CmdStallQueue.IsEmpty())
+                break;
+        }
+    }
+
+    // the CPU can't see the IRQ in between
+    CheckFIFOIRQ();
+    return i;
+}
 
 u8 Read8(u32 addr)
 {
@@ -121,6 +121,9 @@ void SetRenderXPos(u16 xpos);
 u32* GetLine(int line);
 
 void WriteToGXFIFO(u32 val);
+// the same as writing the words to GXFIFO one after another, up to
+// the one which stalls the system. returns how many were written
+u32 WriteToGXFIFOBlock(const u32* vals, u32 count);
 
 u8 Read8(u32 addr);
 u16 Read16(u32 addr);
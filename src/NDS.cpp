@@ -31,7 +31,9 @@
 #include "RTC.h"
 #include "Wifi.h"
 #include "AREngine.h"
+#include "BIOS_HLE.h"
 #include "Platform.h"
+#include "FrameProfiler.h"
 
 #ifdef JIT_ENABLED
 #include "ARMJIT.h"
@@ -81,8 +83,6 @@ u64 FrameStartTimestamp;
 
 int CurCPU;
 
-const s32 kMaxIterationCycles = 64;
-
 u32 ARM9ClockShift;
 
 // no need to worry about those overflowing, they can keep going for atleast 4350 years
@@ -93,6 +93,19 @@ u64 SysTimestamp;
 SchedEvent SchedList[Event_MAX];
 u32 SchedListMask;
 
+// scheduled events, as a binary min-heap ordered by timestamp (then event ID)
+// gives the next deadline without scanning the whole SchedList. the entries
+// are (timestamp << 4) | event ID, so that they're ordered by one comparison,
+// the timestamps won't need the upper 4 bits in over 1000 years
+// see --bench-scheduler of the headless runner for how it compares to the
+// linear scan it replaced
+static_assert(Event_MAX <= 16, "event IDs have to fit into 4 bits");
+// past the end are all-ones sentinels, down to the children of the last entry
+u64 SchedQueue[Event_MAX*2+1];
+u8 SchedQueuePos[Event_MAX];
+u32 SchedQueueLen;
+const u8 kNotQueued = 0xFF;
+
 u32 CPUStop;
 
 u8 ARM9BIOS[0x1000];
@@ -110,6 +123,10 @@ MemRegion SWRAM_ARM7;
 
 u8* ARM7WRAM;
 
+MemMap MemMaps[2];
+
+IOHandlers IOMap[2][IOMapSize / 4];
+
 u16 ExMemCnt[2];
 
 // TODO: these belong in NDSCart!
@@ -164,6 +181,7 @@ bool RunningGame;
 void DivDone(u32 param);
 void SqrtDone(u32 param);
 void RunTimer(u32 tid, s32 cycles);
+void RebuildSchedQueue();
 void SetWifiWaitCnt(u16 val);
 void SetGBASlotTimings();
 
@@ -181,6 +199,9 @@ bool Init()
     SharedWRAM = new u8[SharedWRAMSize];
 #endif
 
+    SchedListMask = 0;
+    RebuildSchedQueue();
+
     DMAs[0] = new DMA(0, 0);
     DMAs[1] = new DMA(0, 1);
     DMAs[2] = new DMA(0, 2);
@@ -492,6 +513,12 @@ void Reset()
     ARMJIT::Reset();
 #endif
 
+    BIOS_HLE::Reset();
+
+#ifdef FRAMEPROFILER_ENABLED
+    FrameProfiler::Reset();
+#endif
+
     if (ConsoleType == 1)
     {
         DSi::LoadBIOS();
@@ -521,6 +548,8 @@ void Reset()
     memset(ARM7WRAM, 0, 0x10000);
 
     MapSharedWRAM(0);
+    UpdateMemMap();
+    InitIOMap();
 
     ExMemCnt[0] = 0x4000;
     ExMemCnt[1] = 0x4000;
@@ -573,6 +602,7 @@ void Reset()
 
     memset(SchedList, 0, sizeof(SchedList));
     SchedListMask = 0;
+    RebuildSchedQueue();
 
     KeyInput = 0x007F03FF;
     KeyCnt = 0;
@@ -754,6 +784,7 @@ bool DoSavestate(Savestate* file)
 
     if (!DoSavestate_Scheduler(file)) return false;
     file->Var32(&SchedListMask);
+    if (!file->Saving) RebuildSchedQueue();
     file->Var64(&ARM9Timestamp);
     file->Var64(&ARM9Target);
     file->Var64(&ARM7Timestamp);
@@ -776,6 +807,7 @@ bool DoSavestate(Savestate* file)
         // 'dept of redundancy dept'
         // but we do need to update the mappings
         MapSharedWRAM(WRAMCnt);
+        UpdateMemMap();
 
         InitTimings();
         SetGBASlotTimings();
@@ -861,44 +893,155 @@ void RelocateSave(const char* path, bool write)
 
 
 
-u64 NextTarget()
+inline u64 SchedQueueKey(u32 id)
 {
-    u64 ret = SysTimestamp + kMaxIterationCycles;
+    return (SchedList[id].Timestamp << 4) | id;
+}
 
-    u32 mask = SchedListMask;
-    for (int i = 0; i < Event_MAX; i++)
+void SchedQueueSiftUp(u32 pos, u64 key)
+{
+    while (pos > 0)
     {
-        if (!mask) break;
-        if (mask & 0x1)
-        {
-            if (SchedList[i].Timestamp < ret)
-                ret = SchedList[i].Timestamp;
-        }
+        u32 parent = (pos - 1) >> 1;
+        if (key >= SchedQueue[parent]) break;
+
+        SchedQueue[pos] = SchedQueue[parent];
+        SchedQueuePos[SchedQueue[pos] & 0xF] = pos;
+        pos = parent;
+    }
+
+    SchedQueue[pos] = key;
+    SchedQueuePos[key & 0xF] = pos;
+}
+
+void SchedQueueSiftDown(u32 pos, u64 key)
+{
+    for (;;)
+    {
+        u32 child = (pos << 1) + 1;
+        if (child >= SchedQueueLen) break;
+        // the entries past the end are all ones
+        child += SchedQueue[child+1] < SchedQueue[child];
+        if (SchedQueue[child] >= key) break;
 
-        mask >>= 1;
+        SchedQueue[pos] = SchedQueue[child];
+        SchedQueuePos[SchedQueue[pos] & 0xF] = pos;
+        pos = child;
     }
 
+    SchedQueue[pos] = key;
+    SchedQueuePos[key & 0xF] = pos;
+}
+
+// moves the entry at pos to where it belongs
+void SchedQueuePlace(u32 pos, u64 key)
+{
+    if (pos > 0 && key < SchedQueue[(pos - 1) >> 1])
+        SchedQueueSiftUp(pos, key);
+    else
+        SchedQueueSiftDown(pos, key);
+}
+
+void SchedQueueInsert(u32 id)
+{
+    SchedQueueSiftUp(SchedQueueLen++, SchedQueueKey(id));
+}
+
+// after the timestamp of a queued event changed
+void SchedQueueUpdate(u32 id)
+{
+    SchedQueuePlace(SchedQueuePos[id], SchedQueueKey(id));
+}
+
+void SchedQueueRemove(u32 id)
+{
+    u32 pos = SchedQueuePos[id];
+    u64 last = SchedQueue[--SchedQueueLen];
+    SchedQueue[SchedQueueLen] = ~0ULL;
+    SchedQueuePos[id] = kNotQueued;
+    if ((last & 0xF) == id) return;
+
+    SchedQueuePlace(pos, last);
+}
+
+void RebuildSchedQueue()
+{
+    SchedQueueLen = 0;
+    memset(SchedQueue, 0xFF, sizeof(SchedQueue));
+    memset(SchedQueuePos, kNotQueued, sizeof(SchedQueuePos));
+    for (u32 i = 0; i < Event_MAX; i++)
+    {
+        if (SchedListMask & (1<<i))
+            SchedQueueInsert(i);
+    }
+}
+
+u64 NextTarget()
+{
+    u64 ret = SysTimestamp + kMaxIterationCycles;
+
+    if (SchedQueueLen && (SchedQueue[0] >> 4) < ret)
+        ret = SchedQueue[0] >> 4;
+
     return ret;
 }
 
+u64 NextEventTimestamp()
+{
+    if (SchedQueueLen)
+        return SchedQueue[0] >> 4;
+    return SysTimestamp + kMaxIterationCycles;
+}
+
 void RunSystem(u64 timestamp)
 {
     SysTimestamp = timestamp;
 
-    u32 mask = SchedListMask;
-    for (int i = 0; i < Event_MAX; i++)
+    // nothing due yet: we're done
+    if (!SchedQueueLen || (SchedQueue[0] >> 4) > SysTimestamp)
+        return;
+
+    // due events are processed in event ID order, not in timestamp order
+    // events that were due when we started are considered
+    // (even if a previous callback canceled them)
+    // they're the top of the heap: the children of an entry which isn't
+    // due aren't due either, so only the due entries and their children
+    // are looked at
+    u32 mask = 0;
+    u8 pending[Event_MAX];
+    int numPending = 0;
+    pending[numPending++] = 0;
+    while (numPending)
+    {
+        u32 pos = pending[--numPending];
+        mask |= (1 << (SchedQueue[pos] & 0xF));
+
+        // the entries past the end are all ones, so they're never due
+        u32 child = (pos << 1) + 1;
+        if ((SchedQueue[child] >> 4) <= SysTimestamp) pending[numPending++] = child;
+        if ((SchedQueue[child+1] >> 4) <= SysTimestamp) pending[numPending++] = child+1;
+    }
+
+    while (mask)
     {
-        if (!mask) break;
-        if (mask & 0x1)
+        int i = __builtin_ctz(mask);
+        mask &= ~(1<<i);
+
+        // a previous callback can have canceled and rescheduled it
+        if (SchedList[i].Timestamp <= SysTimestamp)
         {
-            if (SchedList[i].Timestamp <= SysTimestamp)
-            {
-                SchedListMask &= ~(1<<i);
-                SchedList[i].Func(SchedList[i].Param);
-            }
-        }
+            // the event stays in the queue while it runs. most events schedule
+            // themselves again, which then only moves them to their new place
+            SchedListMask &= ~(1<<i);
+
+            // counts how late the event ran
+            FRAMEPROF_BEGIN(prof, SchedList[i].Timestamp);
+            SchedList[i].Func(SchedList[i].Param);
+            FRAMEPROF_END_EVENT(prof, i, SysTimestamp);
 
-        mask >>= 1;
+            if (!(SchedListMask & (1<<i)) && SchedQueuePos[i] != kNotQueued)
+                SchedQueueRemove(i);
+        }
     }
 }
 
@@ -910,6 +1053,8 @@ u32 RunFrame()
     if (!Running) return 263; // dorp
     if (CPUStop & 0x40000000) return 263;
 
+    FRAMEPROF_FRAME_BEGIN();
+
     GPU::StartFrame();
 
     while (Running && GPU::TotalScanlines==0)
@@ -919,6 +1064,29 @@ u32 RunFrame()
         ARM9Target = target << ARM9ClockShift;
         CurCPU = 0;
 
+        if (Config::SkipIdle && !(CPUStop & 0x8FFF0FFF) && ARM9->Halted == 1 && ARM7->Halted == 1
+            && !HaltInterrupted(0) && !HaltInterrupted(1))
+        {
+            // both CPUs are halted and no DMA is running
+            // nothing can happen before the next event, skip straight to it
+            if (ARM9Timestamp < ARM9Target)
+                ARM9Timestamp = ARM9Target;
+            RunTimers(0);
+            GPU3D::Run();
+
+            target = ARM9Timestamp >> ARM9ClockShift;
+            CurCPU = 1;
+
+            if (ARM7Timestamp < target)
+                ARM7Timestamp = target;
+            RunTimers(1);
+
+            FRAMEPROF_BEGIN(prof, SysTimestamp);
+            RunSystem(target);
+            FRAMEPROF_END(prof, FrameProfiler::Section_System, SysTimestamp);
+            continue;
+        }
+
         if (CPUStop & 0x80000000)
         {
             // GXFIFO stall
@@ -928,24 +1096,42 @@ u32 RunFrame()
         }
         else if (CPUStop & 0x0FFF)
         {
+            FRAMEPROF_BEGIN(prof, ARM9Timestamp >> ARM9ClockShift);
+
             DMAs[0]->Run<ConsoleType>();
             if (!(CPUStop & 0x80000000)) DMAs[1]->Run<ConsoleType>();
             if (!(CPUStop & 0x80000000)) DMAs[2]->Run<ConsoleType>();
             if (!(CPUStop & 0x80000000)) DMAs[3]->Run<ConsoleType>();
             if (ConsoleType == 1) DSi::RunNDMAs(0);
+
+            FRAMEPROF_END(prof, FrameProfiler::Section_DMA, ARM9Timestamp >> ARM9ClockShift);
         }
         else
         {
+            FRAMEPROF_BEGIN(prof, ARM9Timestamp >> ARM9ClockShift);
+
 #ifdef JIT_ENABLED
             if (EnableJIT)
                 ARM9->ExecuteJIT();
+            else if (Config::JIT_CachedInterpreter)
+                ARM9->ExecuteCached();
             else
 #endif
                 ARM9->Execute();
+
+            FRAMEPROF_END(prof, FrameProfiler::Section_ARM9, ARM9Timestamp >> ARM9ClockShift);
         }
 
-        RunTimers(0);
-        GPU3D::Run();
+        {
+            FRAMEPROF_BEGIN(prof, TimerTimestamp[0]);
+            RunTimers(0);
+            FRAMEPROF_END(prof, FrameProfiler::Section_Timers, TimerTimestamp[0]);
+        }
+        {
+            FRAMEPROF_BEGIN(prof, GPU3D::Timestamp);
+            GPU3D::Run();
+            FRAMEPROF_END(prof, FrameProfiler::Section_GPU3D, GPU3D::Timestamp);
+        }
 
         target = ARM9Timestamp >> ARM9ClockShift;
         CurCPU = 1;
@@ -956,26 +1142,42 @@ u32 RunFrame()
 
             if (CPUStop & 0x0FFF0000)
             {
+                FRAMEPROF_BEGIN(prof, ARM7Timestamp);
+
                 DMAs[4]->Run<ConsoleType>();
                 DMAs[5]->Run<ConsoleType>();
                 DMAs[6]->Run<ConsoleType>();
                 DMAs[7]->Run<ConsoleType>();
                 if (ConsoleType == 1) DSi::RunNDMAs(1);
+
+                FRAMEPROF_END(prof, FrameProfiler::Section_DMA, ARM7Timestamp);
             }
             else
             {
+                FRAMEPROF_BEGIN(prof, ARM7Timestamp);
+
 #ifdef JIT_ENABLED
                 if (EnableJIT)
                     ARM7->ExecuteJIT();
+                else if (Config::JIT_CachedInterpreter)
+                    ARM7->ExecuteCached();
                 else
 #endif
                     ARM7->Execute();
+
+                FRAMEPROF_END(prof, FrameProfiler::Section_ARM7, ARM7Timestamp);
             }
 
+            FRAMEPROF_BEGIN(prof, TimerTimestamp[1]);
             RunTimers(1);
+            FRAMEPROF_END(prof, FrameProfiler::Section_Timers, TimerTimestamp[1]);
         }
 
-        RunSystem(target);
+        {
+            FRAMEPROF_BEGIN(prof, SysTimestamp);
+            RunSystem(target);
+            FRAMEPROF_END(prof, FrameProfiler::Section_System, SysTimestamp);
+        }
 
         if (CPUStop & 0x40000000)
         {
@@ -993,12 +1195,19 @@ u32 RunFrame()
            ARM7Timestamp-SysTimestamp,
            GPU3D::Timestamp-SysTimestamp);
 #endif
-    SPU::TransferOutput();
+    {
+        // the output of the whole frame is transferred
+        FRAMEPROF_BEGIN(prof, FrameStartTimestamp);
+        SPU::TransferOutput();
+        FRAMEPROF_END(prof, FrameProfiler::Section_SPUOutput, SysTimestamp);
+    }
 
     NDSCart::FlushSRAMFile();
 
     NumFrames++;
 
+    FRAMEPROF_FRAME_END();
+
     return GPU::TotalScanlines;
 }
 
@@ -1054,12 +1263,19 @@ void ScheduleEvent(u32 id, bool periodic, s32 delay, void (*func)(u32), u32 para
     evt->Param = param;
 
     SchedListMask |= (1<<id);
+    // still queued if it's the event which is running, see RunSystem
+    if (SchedQueuePos[id] != kNotQueued)
+        SchedQueueUpdate(id);
+    else
+        SchedQueueInsert(id);
 
     Reschedule(evt->Timestamp);
 }
 
 void CancelEvent(u32 id)
 {
+    if (SchedQueuePos[id] != kNotQueued)
+        SchedQueueRemove(id);
     SchedListMask &= ~(1<<id);
 }
 
@@ -1179,6 +1395,80 @@ void MapSharedWRAM(u8 val)
         SWRAM_ARM7.Mask = 0x7FFF;
         break;
     }
+
+    UpdateMemMap();
+}
+
+void UpdateMemMap()
+{
+    for (u32 num = 0; num < 2; num++)
+    {
+        MemRegion& swram = num == 0 ? SWRAM_ARM9 : SWRAM_ARM7;
+        for (u32 page = 0; page < MemMapNumPages; page++)
+        {
+            u32 addr = page << MemMapPageShift;
+            u8* mem = NULL;
+            switch (addr & 0xFF800000)
+            {
+            case 0x02000000:
+            case 0x02800000:
+                mem = &MainRAM[addr & MainRAMMask];
+                break;
+
+            case 0x03000000:
+            case 0x03800000:
+                if (swram.Mem && (num == 0 || addr < 0x03800000))
+                    mem = &swram.Mem[addr & swram.Mask];
+                else if (num == 1)
+                    mem = &ARM7WRAM[addr & (ARM7WRAMSize - 1)];
+                break;
+            }
+
+            MemMaps[num].Mem[page] = mem;
+#ifdef JIT_ENABLED
+            if (!mem)
+                MemMaps[num].CodeAddr[page] = 0;
+            else if (mem >= MainRAM && mem < MainRAM + MainRAMMaxSize)
+                MemMaps[num].CodeAddr[page] = (mem - MainRAM) | (ARMJIT_Memory::memregion_MainRAM << 27);
+            else if (mem >= SharedWRAM && mem < SharedWRAM + SharedWRAMSize)
+                MemMaps[num].CodeAddr[page] = (mem - SharedWRAM) | (ARMJIT_Memory::memregion_SharedWRAM << 27);
+            else
+                MemMaps[num].CodeAddr[page] = (mem - ARM7WRAM) | (ARMJIT_Memory::memregion_WRAM7 << 27);
+#endif
+        }
+    }
+}
+
+template <typename T, u32 num>
+inline bool ReadMemMap(u32 addr, T& val)
+{
+    if (addr >= 0x10000000)
+        return false;
+
+    u8* mem = MemMaps[num].Mem[addr >> MemMapPageShift];
+    if (!mem)
+        return false;
+
+    val = *(T*)&mem[addr & MemMapPageMask];
+    return true;
+}
+
+template <typename T, u32 num>
+inline bool WriteMemMap(u32 addr, T val)
+{
+    if (addr >= 0x10000000)
+        return false;
+
+    u32 page = addr >> MemMapPageShift;
+    u8* mem = MemMaps[num].Mem[page];
+    if (!mem)
+        return false;
+
+#ifdef JIT_ENABLED
+    ARMJIT::CheckAndInvalidateLocal(MemMaps[num].CodeAddr[page] + (addr & MemMapPageMask));
+#endif
+    *(T*)&mem[addr & MemMapPageMask] = val;
+    return true;
 }
 
 
@@ -1850,6 +2140,10 @@ void debug(u32 param)
 
 u8 ARM9Read8(u32 addr)
 {
+    u8 val;
+    if (ReadMemMap<u8, 0>(addr, val))
+        return val;
+
     if ((addr & 0xFFFFF000) == 0xFFFF0000)
     {
         return *(u8*)&ARM9BIOS[addr & 0xFFF];
@@ -1871,6 +2165,8 @@ u8 ARM9Read8(u32 addr)
         }
 
     case 0x04000000:
+        if (IOHandlers* io = GetIOHandlers(0, addr))
+            return io->Read8(addr);
         return ARM9IORead8(addr);
 
     case 0x05000000:
@@ -1915,6 +2211,10 @@ u8 ARM9Read8(u32 addr)
 
 u16 ARM9Read16(u32 addr)
 {
+    u16 val;
+    if (ReadMemMap<u16, 0>(addr, val))
+        return val;
+
     if ((addr & 0xFFFFF000) == 0xFFFF0000)
     {
         return *(u16*)&ARM9BIOS[addr & 0xFFF];
@@ -1936,6 +2236,8 @@ u16 ARM9Read16(u32 addr)
         }
 
     case 0x04000000:
+        if (IOHandlers* io = GetIOHandlers(0, addr))
+            return io->Read16(addr);
         return ARM9IORead16(addr);
 
     case 0x05000000:
@@ -1980,6 +2282,10 @@ u16 ARM9Read16(u32 addr)
 
 u32 ARM9Read32(u32 addr)
 {
+    u32 val;
+    if (ReadMemMap<u32, 0>(addr, val))
+        return val;
+
     if ((addr & 0xFFFFF000) == 0xFFFF0000)
     {
         return *(u32*)&ARM9BIOS[addr & 0xFFF];
@@ -2001,6 +2307,8 @@ u32 ARM9Read32(u32 addr)
         }
 
     case 0x04000000:
+        if (IOHandlers* io = GetIOHandlers(0, addr))
+            return io->Read32(addr);
         return ARM9IORead32(addr);
 
     case 0x05000000:
@@ -2045,6 +2353,9 @@ u32 ARM9Read32(u32 addr)
 
 void ARM9Write8(u32 addr, u8 val)
 {
+    if (WriteMemMap<u8, 0>(addr, val))
+        return;
+
     switch (addr & 0xFF000000)
     {
     case 0x02000000:
@@ -2065,7 +2376,10 @@ void ARM9Write8(u32 addr, u8 val)
         return;
 
     case 0x04000000:
-        ARM9IOWrite8(addr, val);
+        if (IOHandlers* io = GetIOHandlers(0, addr))
+            io->Write8(addr, val);
+        else
+            ARM9IOWrite8(addr, val);
         return;
 
     case 0x05000000:
@@ -2101,6 +2415,9 @@ void ARM9Write8(u32 addr, u8 val)
 
 void ARM9Write16(u32 addr, u16 val)
 {
+    if (WriteMemMap<u16, 0>(addr, val))
+        return;
+
     switch (addr & 0xFF000000)
     {
     case 0x02000000:
@@ -2121,7 +2438,10 @@ void ARM9Write16(u32 addr, u16 val)
         return;
 
     case 0x04000000:
-        ARM9IOWrite16(addr, val);
+        if (IOHandlers* io = GetIOHandlers(0, addr))
+            io->Write16(addr, val);
+        else
+            ARM9IOWrite16(addr, val);
         return;
 
     case 0x05000000:
@@ -2176,6 +2496,9 @@ void ARM9Write16(u32 addr, u16 val)
 
 void ARM9Write32(u32 addr, u32 val)
 {
+    if (WriteMemMap<u32, 0>(addr, val))
+        return;
+
     switch (addr & 0xFF000000)
     {
     case 0x02000000:
@@ -2196,7 +2519,10 @@ void ARM9Write32(u32 addr, u32 val)
         return;
 
     case 0x04000000:
-        ARM9IOWrite32(addr, val);
+        if (IOHandlers* io = GetIOHandlers(0, addr))
+            io->Write32(addr, val);
+        else
+            ARM9IOWrite32(addr, val);
         return;
 
     case 0x05000000:
@@ -2284,6 +2610,10 @@ bool ARM9GetMemRegion(u32 addr, bool write, MemRegion* region)
 
 u8 ARM7Read8(u32 addr)
 {
+    u8 val;
+    if (ReadMemMap<u8, 1>(addr, val))
+        return val;
+
     if (addr < 0x00004000)
     {
         // TODO: check the boundary? is it 4000 or higher on regular DS?
@@ -2315,6 +2645,8 @@ u8 ARM7Read8(u32 addr)
         return *(u8*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)];
 
     case 0x04000000:
+        if (IOHandlers* io = GetIOHandlers(1, addr))
+            return io->Read8(addr);
         return ARM7IORead8(addr);
 
     case 0x06000000:
@@ -2345,6 +2677,10 @@ u8 ARM7Read8(u32 addr)
 
 u16 ARM7Read16(u32 addr)
 {
+    u16 val;
+    if (ReadMemMap<u16, 1>(addr, val))
+        return val;
+
     if (addr < 0x00004000)
     {
         if (ARM7->R[15] >= 0x00004000)
@@ -2375,6 +2711,8 @@ u16 ARM7Read16(u32 addr)
         return *(u16*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)];
 
     case 0x04000000:
+        if (IOHandlers* io = GetIOHandlers(1, addr))
+            return io->Read16(addr);
         return ARM7IORead16(addr);
 
     case 0x04800000:
@@ -2412,6 +2750,10 @@ u16 ARM7Read16(u32 addr)
 
 u32 ARM7Read32(u32 addr)
 {
+    u32 val;
+    if (ReadMemMap<u32, 1>(addr, val))
+        return val;
+
     if (addr < 0x00004000)
     {
         if (ARM7->R[15] >= 0x00004000)
@@ -2442,6 +2784,8 @@ u32 ARM7Read32(u32 addr)
         return *(u32*)&ARM7WRAM[addr & (ARM7WRAMSize - 1)];
 
     case 0x04000000:
+        if (IOHandlers* io = GetIOHandlers(1, addr))
+            return io->Read32(addr);
         return ARM7IORead32(addr);
 
     case 0x04800000:
@@ -2479,6 +2823,9 @@ u32 ARM7Read32(u32 addr)
 
 void ARM7Write8(u32 addr, u8 val)
 {
+    if (WriteMemMap<u8, 1>(addr, val))
+        return;
+
     switch (addr & 0xFF800000)
     {
     case 0x02000000:
@@ -2515,7 +2862,10 @@ void ARM7Write8(u32 addr, u8 val)
         return;
 
     case 0x04000000:
-        ARM7IOWrite8(addr, val);
+        if (IOHandlers* io = GetIOHandlers(1, addr))
+            io->Write8(addr, val);
+        else
+            ARM7IOWrite8(addr, val);
         return;
 
     case 0x06000000:
@@ -2554,6 +2904,9 @@ void ARM7Write8(u32 addr, u8 val)
 
 void ARM7Write16(u32 addr, u16 val)
 {
+    if (WriteMemMap<u16, 1>(addr, val))
+        return;
+
     switch (addr & 0xFF800000)
     {
     case 0x02000000:
@@ -2590,7 +2943,10 @@ void ARM7Write16(u32 addr, u16 val)
         return;
 
     case 0x04000000:
-        ARM7IOWrite16(addr, val);
+        if (IOHandlers* io = GetIOHandlers(1, addr))
+            io->Write16(addr, val);
+        else
+            ARM7IOWrite16(addr, val);
         return;
 
     case 0x04800000:
@@ -2638,6 +2994,9 @@ void ARM7Write16(u32 addr, u16 val)
 
 void ARM7Write32(u32 addr, u32 val)
 {
+    if (WriteMemMap<u32, 1>(addr, val))
+        return;
+
     switch (addr & 0xFF800000)
     {
     case 0x02000000:
@@ -2674,7 +3033,10 @@ void ARM7Write32(u32 addr, u32 val)
         return;
 
     case 0x04000000:
-        ARM7IOWrite32(addr, val);
+        if (IOHandlers* io = GetIOHandlers(1, addr))
+            io->Write32(addr, val);
+        else
+            ARM7IOWrite32(addr, val);
         return;
 
     case 0x04800000:
@@ -2780,6 +3142,395 @@ bool ARM7GetMemRegion(u32 addr, bool write, MemRegion* region)
     case (addr+2): return ((val) >> 16) & 0xFF; \
     case (addr+3): return (val) >> 24;
 
+// the shared parts of both CPUs' IPC registers
+
+template <u32 num>
+u16 ReadIPCFIFOCnt()
+{
+    FIFO<u32, 16>& send = num ? IPCFIFO7 : IPCFIFO9;
+    FIFO<u32, 16>& recv = num ? IPCFIFO9 : IPCFIFO7;
+
+    u16 val = num ? IPCFIFOCnt7 : IPCFIFOCnt9;
+    if (send.IsEmpty())     val |= 0x0001;
+    else if (send.IsFull()) val |= 0x0002;
+    if (recv.IsEmpty())     val |= 0x0100;
+    else if (recv.IsFull()) val |= 0x0200;
+    return val;
+}
+
+template <u32 num>
+void WriteIPCSync(u16 val)
+{
+    u16& own = num ? IPCSync7 : IPCSync9;
+    u16& other = num ? IPCSync9 : IPCSync7;
+
+    other &= 0xFFF0;
+    other |= ((val & 0x0F00) >> 8);
+    own &= 0xB0FF;
+    own |= (val & 0x4F00);
+    if ((val & 0x2000) && (other & 0x4000))
+    {
+        SetIRQ(num ^ 1, IRQ_IPCSync);
+    }
+}
+
+template <u32 num>
+void WriteIPCFIFOCnt(u16 val)
+{
+    u16& cnt = num ? IPCFIFOCnt7 : IPCFIFOCnt9;
+    FIFO<u32, 16>& send = num ? IPCFIFO7 : IPCFIFO9;
+    FIFO<u32, 16>& recv = num ? IPCFIFO9 : IPCFIFO7;
+
+    if (val & 0x0008)
+        send.Clear();
+    if ((val & 0x0004) && (!(cnt & 0x0004)) && send.IsEmpty())
+        SetIRQ(num, IRQ_IPCSendDone);
+    if ((val & 0x0400) && (!(cnt & 0x0400)) && (!recv.IsEmpty()))
+        SetIRQ(num, IRQ_IPCRecv);
+    if (val & 0x4000)
+        cnt &= ~0x4000;
+    cnt = (val & 0x8404) | (cnt & 0x4000);
+}
+
+template <u32 num>
+void WriteIPCFIFOSend(u32 val)
+{
+    u16& cnt = num ? IPCFIFOCnt7 : IPCFIFOCnt9;
+    FIFO<u32, 16>& send = num ? IPCFIFO7 : IPCFIFO9;
+
+    if (cnt & 0x8000)
+    {
+        if (send.IsFull())
+            cnt |= 0x4000;
+        else
+        {
+            bool wasempty = send.IsEmpty();
+            send.Write(val);
+            if (((num ? IPCFIFOCnt9 : IPCFIFOCnt7) & 0x0400) && wasempty)
+                SetIRQ(num ^ 1, IRQ_IPCRecv);
+        }
+    }
+}
+
+// handlers of the I/O map. they do the same as the switches below for
+// their registers, halves of them which the switches don't know about
+// are passed on
+
+template <u32 num>
+u16 IORead16Fallback(u32 addr)
+{
+    return num ? ARM7IORead16(addr) : ARM9IORead16(addr);
+}
+
+template <u32 num>
+u16 IOReadDispStat16(u32 addr)
+{
+    return (addr & 2) ? GPU::VCount : GPU::DispStat[num];
+}
+
+template <u32 num>
+u32 IOReadDispStat32(u32 addr)
+{
+    return GPU::DispStat[num] | (GPU::VCount << 16);
+}
+
+template <u32 num>
+void IOWriteDispStat16(u32 addr, u16 val)
+{
+    if (addr & 2)
+        GPU::SetVCount(val);
+    else
+        GPU::SetDispStat(num, val);
+}
+
+template <u32 num>
+void IOWriteDispStat32(u32 addr, u32 val)
+{
+    GPU::SetDispStat(num, val & 0xFFFF);
+    GPU::SetVCount(val >> 16);
+}
+
+template <u32 num>
+u16 IOReadTimer16(u32 addr)
+{
+    u32 timer = (num << 2) | ((addr >> 2) & 0x3);
+    return (addr & 2) ? Timers[timer].Cnt : TimerGetCounter(timer);
+}
+
+template <u32 num>
+u32 IOReadTimer32(u32 addr)
+{
+    u32 timer = (num << 2) | ((addr >> 2) & 0x3);
+    return TimerGetCounter(timer) | (Timers[timer].Cnt << 16);
+}
+
+template <u32 num>
+void IOWriteTimer16(u32 addr, u16 val)
+{
+    u32 timer = (num << 2) | ((addr >> 2) & 0x3);
+    if (addr & 2)
+        TimerStart(timer, val);
+    else
+        Timers[timer].Reload = val;
+}
+
+template <u32 num>
+void IOWriteTimer32(u32 addr, u32 val)
+{
+    u32 timer = (num << 2) | ((addr >> 2) & 0x3);
+    Timers[timer].Reload = val & 0xFFFF;
+    TimerStart(timer, val>>16);
+}
+
+u16 IOReadKeyInput16(u32 addr)
+{
+    return (addr & 2) ? KeyCnt : (KeyInput & 0xFFFF);
+}
+
+u32 IOReadKeyInput32(u32 addr)
+{
+    return (KeyInput & 0xFFFF) | (KeyCnt << 16);
+}
+
+template <u32 num>
+u16 IOReadIPCSync16(u32 addr)
+{
+    if (addr & 2)
+        return IORead16Fallback<num>(addr);
+    return num ? IPCSync7 : IPCSync9;
+}
+
+template <u32 num>
+u32 IOReadIPCSync32(u32 addr)
+{
+    return num ? IPCSync7 : IPCSync9;
+}
+
+template <u32 num>
+void IOWriteIPCSync16(u32 addr, u16 val)
+{
+    if (addr & 2)
+        (num ? ARM7IOWrite16 : ARM9IOWrite16)(addr, val);
+    else
+        WriteIPCSync<num>(val);
+}
+
+template <u32 num>
+void IOWriteIPCSync32(u32 addr, u32 val)
+{
+    WriteIPCSync<num>(val);
+}
+
+template <u32 num>
+u16 IOReadIPCFIFOCnt16(u32 addr)
+{
+    if (addr & 2)
+        return IORead16Fallback<num>(addr);
+    return ReadIPCFIFOCnt<num>();
+}
+
+template <u32 num>
+u32 IOReadIPCFIFOCnt32(u32 addr)
+{
+    return ReadIPCFIFOCnt<num>();
+}
+
+template <u32 num>
+void IOWriteIPCFIFOCnt16(u32 addr, u16 val)
+{
+    if (addr & 2)
+        (num ? ARM7IOWrite16 : ARM9IOWrite16)(addr, val);
+    else
+        WriteIPCFIFOCnt<num>(val);
+}
+
+template <u32 num>
+void IOWriteIPCFIFOCnt32(u32 addr, u32 val)
+{
+    WriteIPCFIFOCnt<num>(val);
+}
+
+template <u32 num>
+void IOWriteIPCFIFOSend32(u32 addr, u32 val)
+{
+    WriteIPCFIFOSend<num>(val);
+}
+
+template <u32 num>
+u32 IOReadIME32(u32 addr)
+{
+    return IME[num];
+}
+
+template <u32 num>
+void IOWriteIME32(u32 addr, u32 val)
+{
+    IME[num] = val & 0x1;
+    UpdateIRQ(num);
+}
+
+template <u32 num>
+u16 IOReadIE16(u32 addr)
+{
+    return (addr & 2) ? (IE[num] >> 16) : (IE[num] & 0xFFFF);
+}
+
+template <u32 num>
+u32 IOReadIE32(u32 addr)
+{
+    return IE[num];
+}
+
+template <u32 num>
+void IOWriteIE16(u32 addr, u16 val)
+{
+    if (addr & 2)
+        IE[num] = (IE[num] & 0x0000FFFF) | (val << 16);
+    else
+        IE[num] = (IE[num] & 0xFFFF0000) | val;
+    UpdateIRQ(num);
+}
+
+template <u32 num>
+void IOWriteIE32(u32 addr, u32 val)
+{
+    IE[num] = val;
+    UpdateIRQ(num);
+}
+
+template <u32 num>
+u32 IOReadIF32(u32 addr)
+{
+    return IF[num];
+}
+
+template <u32 num>
+void IOWriteIF32(u32 addr, u32 val)
+{
+    IF[num] &= ~val;
+    if (num == 0)
+        GPU3D::CheckFIFOIRQ();
+    UpdateIRQ(num);
+}
+
+u32 IOReadDivSqrt32(u32 addr)
+{
+    switch (addr)
+    {
+    case 0x04000280: return DivCnt;
+    case 0x04000290: return DivNumerator[0];
+    case 0x04000294: return DivNumerator[1];
+    case 0x04000298: return DivDenominator[0];
+    case 0x0400029C: return DivDenominator[1];
+    case 0x040002A0: return DivQuotient[0];
+    case 0x040002A4: return DivQuotient[1];
+    case 0x040002A8: return DivRemainder[0];
+    case 0x040002AC: return DivRemainder[1];
+
+    case 0x040002B0: return SqrtCnt;
+    case 0x040002B4: return SqrtRes;
+    case 0x040002B8: return SqrtVal[0];
+    case 0x040002BC: return SqrtVal[1];
+    }
+    return ARM9IORead32(addr);
+}
+
+void IOWriteDivSqrt32(u32 addr, u32 val)
+{
+    switch (addr)
+    {
+    case 0x04000280: DivCnt = val; StartDiv(); return;
+    case 0x04000290: DivNumerator[0] = val; StartDiv(); return;
+    case 0x04000294: DivNumerator[1] = val; StartDiv(); return;
+    case 0x04000298: DivDenominator[0] = val; StartDiv(); return;
+    case 0x0400029C: DivDenominator[1] = val; StartDiv(); return;
+
+    case 0x040002B0: SqrtCnt = val; StartSqrt(); return;
+    case 0x040002B8: SqrtVal[0] = val; StartSqrt(); return;
+    case 0x040002BC: SqrtVal[1] = val; StartSqrt(); return;
+    }
+    ARM9IOWrite32(addr, val);
+}
+
+u8 IORead2DA8(u32 addr) { return GPU::GPU2D_A->Read8(addr); }
+u16 IORead2DA16(u32 addr) { return GPU::GPU2D_A->Read16(addr); }
+u32 IORead2DA32(u32 addr) { return GPU::GPU2D_A->Read32(addr); }
+void IOWrite2DA8(u32 addr, u8 val) { GPU::GPU2D_A->Write8(addr, val); }
+void IOWrite2DA16(u32 addr, u16 val) { GPU::GPU2D_A->Write16(addr, val); }
+void IOWrite2DA32(u32 addr, u32 val) { GPU::GPU2D_A->Write32(addr, val); }
+
+void MapIORange(u32 num, u32 start, u32 end, IOHandlers handlers)
+{
+    for (u32 addr = start; addr < end; addr += 4)
+        IOMap[num][(addr - 0x04000000) >> 2] = handlers;
+}
+
+template <u32 num>
+void MapHotIORegisters(const IOHandlers& def)
+{
+    IOHandlers* map = IOMap[num];
+
+    // 8 bit accesses go to the 2D engine on the ARM9
+    map[0x004 >> 2] = {num ? def.Read8 : IORead2DA8, IOReadDispStat16<num>, IOReadDispStat32<num>,
+                       num ? def.Write8 : IOWrite2DA8, IOWriteDispStat16<num>, IOWriteDispStat32<num>};
+
+    for (u32 addr = 0x100; addr < 0x110; addr += 4)
+        map[addr >> 2] = {def.Read8, IOReadTimer16<num>, IOReadTimer32<num>, def.Write8, IOWriteTimer16<num>, IOWriteTimer32<num>};
+
+    map[0x130 >> 2].Read16 = IOReadKeyInput16;
+    map[0x130 >> 2].Read32 = IOReadKeyInput32;
+
+    map[0x180 >> 2] = {def.Read8, IOReadIPCSync16<num>, IOReadIPCSync32<num>, def.Write8, IOWriteIPCSync16<num>, IOWriteIPCSync32<num>};
+    map[0x184 >> 2] = {def.Read8, IOReadIPCFIFOCnt16<num>, IOReadIPCFIFOCnt32<num>, def.Write8, IOWriteIPCFIFOCnt16<num>, IOWriteIPCFIFOCnt32<num>};
+    map[0x188 >> 2].Write32 = IOWriteIPCFIFOSend32<num>;
+
+    map[0x208 >> 2].Read32 = IOReadIME32<num>;
+    map[0x208 >> 2].Write32 = IOWriteIME32<num>;
+    map[0x210 >> 2] = {def.Read8, IOReadIE16<num>, IOReadIE32<num>, def.Write8, IOWriteIE16<num>, IOWriteIE32<num>};
+    map[0x214 >> 2].Read32 = IOReadIF32<num>;
+    map[0x214 >> 2].Write32 = IOWriteIF32<num>;
+
+    if (num == 0)
+    {
+        for (u32 addr = 0x280; addr < 0x2C0; addr += 4)
+        {
+            map[addr >> 2].Read32 = IOReadDivSqrt32;
+            map[addr >> 2].Write32 = IOWriteDivSqrt32;
+        }
+    }
+}
+
+void InitIOMap()
+{
+    IOHandlers defaults[2];
+    if (ConsoleType == 1)
+    {
+        defaults[0] = {DSi::ARM9IORead8, DSi::ARM9IORead16, DSi::ARM9IORead32, DSi::ARM9IOWrite8, DSi::ARM9IOWrite16, DSi::ARM9IOWrite32};
+        defaults[1] = {DSi::ARM7IORead8, DSi::ARM7IORead16, DSi::ARM7IORead32, DSi::ARM7IOWrite8, DSi::ARM7IOWrite16, DSi::ARM7IOWrite32};
+    }
+    else
+    {
+        defaults[0] = {ARM9IORead8, ARM9IORead16, ARM9IORead32, ARM9IOWrite8, ARM9IOWrite16, ARM9IOWrite32};
+        defaults[1] = {ARM7IORead8, ARM7IORead16, ARM7IORead32, ARM7IOWrite8, ARM7IOWrite16, ARM7IOWrite32};
+    }
+
+    for (u32 num = 0; num < 2; num++)
+        MapIORange(num, 0x04000000, 0x04000000 + IOMapSize, defaults[num]);
+
+    // none of these are changed by the DSi
+    IOHandlers io;
+
+    io = {IORead2DA8, IORead2DA16, IORead2DA32, IOWrite2DA8, IOWrite2DA16, IOWrite2DA32};
+    MapIORange(0, 0x04000000, 0x04000060, io);
+    io = {GPU3D::Read8, GPU3D::Read16, GPU3D::Read32, GPU3D::Write8, GPU3D::Write16, GPU3D::Write32};
+    MapIORange(0, 0x04000320, 0x040006A4, io);
+    io = {SPU::Read8, SPU::Read16, SPU::Read32, SPU::Write8, SPU::Write16, SPU::Write32};
+    MapIORange(1, 0x04000400, 0x04000520, io);
+
+    MapHotIORegisters<0>(defaults[0]);
+    MapHotIORegisters<1>(defaults[1]);
+}
+
 u8 ARM9IORead8(u32 addr)
 {
     switch (addr)
@@ -2890,15 +3641,7 @@ u16 ARM9IORead16(u32 addr)
     case 0x04000132: return KeyCnt;
 
     case 0x04000180: return IPCSync9;
-    case 0x04000184:
-        {
-            u16 val = IPCFIFOCnt9;
-            if (IPCFIFO9.IsEmpty())     val |= 0x0001;
-            else if (IPCFIFO9.IsFull()) val |= 0x0002;
-            if (IPCFIFO7.IsEmpty())     val |= 0x0100;
-            else if (IPCFIFO7.IsFull()) val |= 0x0200;
-            return val;
-        }
+    case 0x04000184: return ReadIPCFIFOCnt<0>();
 
     case 0x040001A0: return NDSCart::SPICnt;
     case 0x040001A2: return NDSCart::ReadSPIData();
@@ -3219,28 +3962,8 @@ void ARM9IOWrite16(u32 addr, u16 val)
         KeyCnt = val;
         return;
 
-    case 0x04000180:
-        IPCSync7 &= 0xFFF0;
-        IPCSync7 |= ((val & 0x0F00) >> 8);
-        IPCSync9 &= 0xB0FF;
-        IPCSync9 |= (val & 0x4F00);
-        if ((val & 0x2000) && (IPCSync7 & 0x4000))
-        {
-            SetIRQ(1, IRQ_IPCSync);
-        }
-        return;
-
-    case 0x04000184:
-        if (val & 0x0008)
-            IPCFIFO9.Clear();
-        if ((val & 0x0004) && (!(IPCFIFOCnt9 & 0x0004)) && IPCFIFO9.IsEmpty())
-            SetIRQ(0, IRQ_IPCSendDone);
-        if ((val & 0x0400) && (!(IPCFIFOCnt9 & 0x0400)) && (!IPCFIFO7.IsEmpty()))
-            SetIRQ(0, IRQ_IPCRecv);
-        if (val & 0x4000)
-            IPCFIFOCnt9 &= ~0x4000;
-        IPCFIFOCnt9 = (val & 0x8404) | (IPCFIFOCnt9 & 0x4000);
-        return;
+    case 0x04000180: WriteIPCSync<0>(val); return;
+    case 0x04000184: WriteIPCFIFOCnt<0>(val); return;
 
     case 0x04000188:
         ARM9IOWrite32(addr, val | (val << 16));
@@ -3398,20 +4121,7 @@ void ARM9IOWrite32(u32 addr, u32 val)
     case 0x04000184:
         ARM9IOWrite16(addr, val);
         return;
-    case 0x04000188:
-        if (IPCFIFOCnt9 & 0x8000)
-        {
-            if (IPCFIFO9.IsFull())
-                IPCFIFOCnt9 |= 0x4000;
-            else
-            {
-                bool wasempty = IPCFIFO9.IsEmpty();
-                IPCFIFO9.Write(val);
-                if ((IPCFIFOCnt7 & 0x0400) && wasempty)
-                    SetIRQ(1, IRQ_IPCRecv);
-            }
-        }
-        return;
+    case 0x04000188: WriteIPCFIFOSend<0>(val); return;
 
     case 0x040001A0:
         if (!(ExMemCnt[0] & (1<<11)))
@@ -3581,15 +4291,7 @@ u16 ARM7IORead16(u32 addr)
     case 0x04000138: return RTC::Read();
 
     case 0x04000180: return IPCSync7;
-    case 0x04000184:
-        {
-            u16 val = IPCFIFOCnt7;
-            if (IPCFIFO7.IsEmpty())     val |= 0x0001;
-            else if (IPCFIFO7.IsFull()) val |= 0x0002;
-            if (IPCFIFO9.IsEmpty())     val |= 0x0100;
-            else if (IPCFIFO9.IsFull()) val |= 0x0200;
-            return val;
-        }
+    case 0x04000184: return ReadIPCFIFOCnt<1>();
 
     case 0x040001A0: return NDSCart::SPICnt;
     case 0x040001A2: return NDSCart::ReadSPIData();
@@ -3822,28 +4524,8 @@ void ARM7IOWrite16(u32 addr, u16 val)
 
     case 0x04000138: RTC::Write(val, false); return;
 
-    case 0x04000180:
-        IPCSync9 &= 0xFFF0;
-        IPCSync9 |= ((val & 0x0F00) >> 8);
-        IPCSync7 &= 0xB0FF;
-        IPCSync7 |= (val & 0x4F00);
-        if ((val & 0x2000) && (IPCSync9 & 0x4000))
-        {
-            SetIRQ(0, IRQ_IPCSync);
-        }
-        return;
-
-    case 0x04000184:
-        if (val & 0x0008)
-            IPCFIFO7.Clear();
-        if ((val & 0x0004) && (!(IPCFIFOCnt7 & 0x0004)) && IPCFIFO7.IsEmpty())
-            SetIRQ(1, IRQ_IPCSendDone);
-        if ((val & 0x0400) && (!(IPCFIFOCnt7 & 0x0400)) && (!IPCFIFO9.IsEmpty()))
-            SetIRQ(1, IRQ_IPCRecv);
-        if (val & 0x4000)
-            IPCFIFOCnt7 &= ~0x4000;
-        IPCFIFOCnt7 = (val & 0x8404) | (IPCFIFOCnt7 & 0x4000);
-        return;
+    case 0x04000180: WriteIPCSync<1>(val); return;
+    case 0x04000184: WriteIPCFIFOCnt<1>(val); return;
 
     case 0x04000188:
         ARM7IOWrite32(addr, val | (val << 16));
@@ -3968,20 +4650,7 @@ void ARM7IOWrite32(u32 addr, u32 val)
     case 0x04000184:
         ARM7IOWrite16(addr, val);
         return;
-    case 0x04000188:
-        if (IPCFIFOCnt7 & 0x8000)
-        {
-            if (IPCFIFO7.IsFull())
-                IPCFIFOCnt7 |= 0x4000;
-            else
-            {
-                bool wasempty = IPCFIFO7.IsEmpty();
-                IPCFIFO7.Write(val);
-                if ((IPCFIFOCnt9 & 0x0400) && wasempty)
-                    SetIRQ(0, IRQ_IPCRecv);
-            }
-        }
-        return;
+    case 0x04000188: WriteIPCFIFOSend<1>(val); return;
 
     case 0x040001A0:
         if (ExMemCnt[0] & (1<<11))
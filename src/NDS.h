@@ -179,6 +179,25 @@ extern u32 KeyInput;
 const u32 ARM7WRAMSize = 0x10000;
 extern u8* ARM7WRAM;
 
+// software TLB of the first 256 MB of each CPU's address space. pages of
+// plain memory point directly to it, everything else like I/O is NULL and
+// goes through the regular dispatch. the TCMs are handled by the ARM9
+// itself before it gets here and the DSi's NWRAM by DSi.cpp
+const u32 MemMapPageShift = 14;
+const u32 MemMapPageMask = (1 << MemMapPageShift) - 1;
+const u32 MemMapNumPages = 0x10000000 >> MemMapPageShift;
+
+struct MemMap
+{
+    u8* Mem[MemMapNumPages];
+#ifdef JIT_ENABLED
+    // localised address of every page, to check writes for code
+    u32 CodeAddr[MemMapNumPages];
+#endif
+};
+
+extern MemMap MemMaps[2];
+
 bool Init();
 void DeInit();
 void Reset();
@@ -214,12 +233,22 @@ int ImportSRAM(u8* data, u32 length);
 
 void ScheduleEvent(u32 id, bool periodic, s32 delay, void (*func)(u32), u32 param);
 void CancelEvent(u32 id);
+// system timestamp of the next event, the CPUs may run up to it
+// without anything being delayed besides the other CPU
+u64 NextEventTimestamp();
+// the main loop: where the CPUs run up to next, at most kMaxIterationCycles
+// ahead, and running the events which are due once they got there
+const s32 kMaxIterationCycles = 64;
+u64 NextTarget();
+void RunSystem(u64 timestamp);
 
 void debug(u32 p);
 
 void Halt();
 
 void MapSharedWRAM(u8 val);
+// has to be called whenever the memory behind a page changes
+void UpdateMemMap();
 
 void UpdateIRQ(u32 cpu);
 void SetIRQ(u32 cpu, u32 irq);
@@ -263,6 +292,34 @@ void ARM7Write32(u32 addr, u32 val);
 
 bool ARM7GetMemRegion(u32 addr, bool write, MemRegion* region);
 
+// the first 2 KB of I/O registers, where the busy ones are, are dispatched
+// through a table with an entry per 32-bit register. hot registers have
+// their own handlers, the others go to the regular ARM9IO/ARM7IO
+// functions of the current console type
+struct IOHandlers
+{
+    u8 (*Read8)(u32 addr);
+    u16 (*Read16)(u32 addr);
+    u32 (*Read32)(u32 addr);
+    void (*Write8)(u32 addr, u8 val);
+    void (*Write16)(u32 addr, u16 val);
+    void (*Write32)(u32 addr, u32 val);
+};
+
+const u32 IOMapSize = 0x800;
+extern IOHandlers IOMap[2][IOMapSize / 4];
+
+// rebuilds the table for the current console type
+void InitIOMap();
+
+// NULL if the register isn't in the table
+inline IOHandlers* GetIOHandlers(u32 num, u32 addr)
+{
+    if (addr - 0x04000000 >= IOMapSize)
+        return NULL;
+    return &IOMap[num][(addr - 0x04000000) >> 2];
+}
+
 u8 ARM9IORead8(u32 addr);
 u16 ARM9IORead16(u32 addr);
 u32 ARM9IORead32(u32 addr);
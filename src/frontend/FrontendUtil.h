@@ -100,6 +100,13 @@ bool SaveState(const char* filename);
 // undo the latest savestate load
 void UndoStateLoad();
 
+#ifdef JIT_ENABLED
+// load or save the persistent JIT block cache of the current ROM
+// only does something if the JIT and Config::JIT_PersistentCache are enabled
+void LoadJITCache();
+void SaveJITCache();
+#endif
+
 // imports savedata from an external file. Returns the difference between the filesize and the SRAM size
 int ImportSRAM(const char* filename);
 
@@ -29,6 +29,10 @@
 
 #include "AREngine.h"
 
+#ifdef JIT_ENABLED
+#include "ARMJIT.h"
+#endif
+
 
 namespace Frontend
 {
@@ -328,6 +332,10 @@ int LoadROM(const char* file, int slot)
     strncpy(oldpath, ROMPath[slot], 1024);
     strncpy(oldsram, SRAMPath[slot], 1024);
 
+#ifdef JIT_ENABLED
+    if (slot == ROMSlot_NDS) SaveJITCache();
+#endif
+
     strncpy(ROMPath[slot], file, 1023);
     ROMPath[slot][1023] = '\0';
 
@@ -347,6 +355,10 @@ int LoadROM(const char* file, int slot)
         if (ROMPath[ROMSlot_GBA][0] != '\0') NDS::LoadGBAROM(ROMPath[ROMSlot_GBA], SRAMPath[ROMSlot_GBA]);
 
         strncpy(PrevSRAMPath[slot], SRAMPath[slot], 1024); // safety
+
+#ifdef JIT_ENABLED
+        LoadJITCache();
+#endif
         return Load_OK;
     }
     else if (slot == ROMSlot_GBA && NDS::LoadGBAROM(ROMPath[slot], SRAMPath[slot]))
@@ -414,6 +426,10 @@ int Reset()
 
     SavestateLoaded = false;
 
+#ifdef JIT_ENABLED
+    SaveJITCache();
+#endif
+
     NDS::SetConsoleType(Config::ConsoleType);
 
     if (ROMPath[ROMSlot_NDS][0] == '\0')
@@ -436,6 +452,10 @@ int Reset()
 
     LoadCheats();
 
+#ifdef JIT_ENABLED
+    LoadJITCache();
+#endif
+
     return Load_OK;
 }
 
@@ -469,6 +489,43 @@ void GetSavestateName(int slot, char* filename, int len)
     filename[pos+4] = '\0';
 }
 
+#ifdef JIT_ENABLED
+bool GetJITCacheName(char* filename, int len)
+{
+    if (ROMPath[ROMSlot_NDS][0] == '\0')
+        return false;
+
+    int l = strlen(ROMPath[ROMSlot_NDS]);
+    int pos = l;
+    while (ROMPath[ROMSlot_NDS][pos] != '.' && pos > 0) pos--;
+    if (pos == 0) pos = l;
+
+    if (pos > len-5) pos = len-5;
+
+    strncpy(&filename[0], ROMPath[ROMSlot_NDS], pos);
+    strcpy(&filename[pos], ".mlj");
+    return true;
+}
+
+void LoadJITCache()
+{
+    char filename[1024];
+    if (!Config::JIT_Enable || !Config::JIT_PersistentCache) return;
+    if (!GetJITCacheName(filename, 1024)) return;
+
+    ARMJIT::LoadCache(filename);
+}
+
+void SaveJITCache()
+{
+    char filename[1024];
+    if (!Config::JIT_Enable || !Config::JIT_PersistentCache) return;
+    if (!GetJITCacheName(filename, 1024)) return;
+
+    ARMJIT::SaveCache(filename);
+}
+#endif
+
 bool SavestateExists(int slot)
 {
     char ssfile[1024];
@@ -0,0 +1,248 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// Platform implementation for the headless runner
+// only depends on the C++ standard library: no display, no audio device,
+// no network. local multiplayer and LAN are reported as unavailable.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "Platform.h"
+#include "PlatformConfig.h"
+
+
+char* EmuDirectory;
+
+void emuStop();
+
+
+namespace Platform
+{
+
+struct Semaphore
+{
+    std::mutex Lock;
+    std::condition_variable Cond;
+    int Count = 0;
+};
+
+
+void Init(int argc, char** argv)
+{
+    // headless runs are always 'portable': relative paths
+    // are resolved against the directory of the executable
+    if (argc > 0 && strlen(argv[0]) > 0)
+    {
+        int len = strlen(argv[0]);
+        while (len > 0)
+        {
+            if (argv[0][len] == '/') break;
+            if (argv[0][len] == '\\') break;
+            len--;
+        }
+        if (len > 0)
+        {
+            EmuDirectory = new char[len+1];
+            strncpy(EmuDirectory, argv[0], len);
+            EmuDirectory[len] = '\0';
+            return;
+        }
+    }
+
+    EmuDirectory = new char[2];
+    strcpy(EmuDirectory, ".");
+}
+
+void DeInit()
+{
+    delete[] EmuDirectory;
+}
+
+
+void StopEmu()
+{
+    emuStop();
+}
+
+
+FILE* OpenFile(const char* path, const char* mode, bool mustexist)
+{
+    if (mustexist)
+    {
+        FILE* f = fopen(path, "rb");
+        if (!f) return nullptr;
+        fclose(f);
+    }
+
+    return fopen(path, mode);
+}
+
+FILE* OpenLocalFile(const char* path, const char* mode)
+{
+    if (!path[0]) return nullptr;
+
+    bool absolute = path[0] == '/' || path[0] == '\\' ||
+                    (path[0] != '\0' && path[1] == ':');
+    if (absolute)
+        return OpenFile(path, mode, mode[0] != 'w');
+
+    // current working directory first, then the emulator directory
+    FILE* f = OpenFile(path, mode, mode[0] != 'w');
+    if (f) return f;
+
+    std::string fullpath = std::string(EmuDirectory) + "/" + path;
+    return OpenFile(fullpath.c_str(), mode, mode[0] != 'w');
+}
+
+FILE* OpenDataFile(const char* path)
+{
+    return OpenLocalFile(path, "rb");
+}
+
+
+Thread* Thread_Create(void (* func)())
+{
+    return (Thread*) new std::thread(func);
+}
+
+void Thread_Free(Thread* thread)
+{
+    std::thread* t = (std::thread*) thread;
+    if (t->joinable()) t->detach();
+    delete t;
+}
+
+void Thread_Wait(Thread* thread)
+{
+    std::thread* t = (std::thread*) thread;
+    if (t->joinable()) t->join();
+}
+
+
+Semaphore* Semaphore_Create()
+{
+    return new Semaphore();
+}
+
+void Semaphore_Free(Semaphore* sema)
+{
+    delete sema;
+}
+
+void Semaphore_Reset(Semaphore* sema)
+{
+    std::lock_guard<std::mutex> lock(sema->Lock);
+    sema->Count = 0;
+}
+
+void Semaphore_Wait(Semaphore* sema)
+{
+    std::unique_lock<std::mutex> lock(sema->Lock);
+    sema->Cond.wait(lock, [sema]() { return sema->Count > 0; });
+    sema->Count--;
+}
+
+void Semaphore_Post(Semaphore* sema, int count)
+{
+    {
+        std::lock_guard<std::mutex> lock(sema->Lock);
+        sema->Count += count;
+    }
+    if (count == 1) sema->Cond.notify_one();
+    else            sema->Cond.notify_all();
+}
+
+
+Mutex* Mutex_Create()
+{
+    return (Mutex*) new std::mutex();
+}
+
+void Mutex_Free(Mutex* mutex)
+{
+    delete (std::mutex*) mutex;
+}
+
+void Mutex_Lock(Mutex* mutex)
+{
+    ((std::mutex*) mutex)->lock();
+}
+
+void Mutex_Unlock(Mutex* mutex)
+{
+    ((std::mutex*) mutex)->unlock();
+}
+
+bool Mutex_TryLock(Mutex* mutex)
+{
+    return ((std::mutex*) mutex)->try_lock();
+}
+
+
+void* GL_GetProcAddress(const char* proc)
+{
+    return nullptr;
+}
+
+
+bool MP_Init()
+{
+    return false;
+}
+
+void MP_DeInit()
+{
+}
+
+int MP_SendPacket(u8* data, int len)
+{
+    return 0;
+}
+
+int MP_RecvPacket(u8* data, bool block)
+{
+    return 0;
+}
+
+
+bool LAN_Init()
+{
+    return false;
+}
+
+void LAN_DeInit()
+{
+}
+
+int LAN_SendPacket(u8* data, int len)
+{
+    return 0;
+}
+
+int LAN_RecvPacket(u8* data)
+{
+    return 0;
+}
+
+}
@@ -0,0 +1,201 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// microbenchmark of the scheduler (--bench-scheduler)
+// drives NDS::NextTarget and NDS::RunSystem the way the main loop does,
+// with events which reschedule themselves periodically, and compares them
+// to the linear scan over SchedList the scheduler used before
+
+#include <stdio.h>
+#include <chrono>
+
+#include "SchedulerBench.h"
+#include "NDS.h"
+
+namespace SchedulerBench
+{
+
+const u32 kNumSlices = 20000000;
+
+struct Scenario
+{
+    const char* Name;
+    int NumEvents;
+    // in system cycles
+    s32 Periods[NDS::Event_MAX];
+};
+
+// the first ones are like a game which only has the display and audio
+// events running, with a few transfers in the second. in the other ones
+// an event is due in almost every slice, which is the worst case
+const Scenario Scenarios[] =
+{
+    {"3 idle", 3, {1024, 1606, 2130}},
+    {"6 idle", 6, {1024, 1606, 2130, 350, 4200, 12000}},
+    {"3 busy", 3, {33, 1024, 2130}},
+    {"6 busy", 6, {33, 1024, 2130, 350, 4200, 12000}},
+    {"15 busy", 15, {33, 37, 41, 45, 49, 53, 57, 61, 65, 69, 73, 77, 81, 85, 89}},
+};
+
+const Scenario* CurScenario;
+
+// the scheduler as it was before the heap, verbatim besides the names and
+// Reschedule, which isn't needed here. NextTarget and RunSystem aren't
+// inlined into the loop, just like the ones of NDS
+namespace Scan
+{
+
+NDS::SchedEvent SchedList[NDS::Event_MAX];
+u32 SchedListMask;
+u64 SysTimestamp;
+
+void ScheduleEvent(u32 id, bool periodic, s32 delay, void (*func)(u32), u32 param)
+{
+    if (SchedListMask & (1<<id))
+    {
+        printf("!! EVENT %d ALREADY SCHEDULED\n", id);
+        return;
+    }
+
+    NDS::SchedEvent* evt = &SchedList[id];
+
+    if (periodic)
+        evt->Timestamp += delay;
+    else
+        evt->Timestamp = SysTimestamp + delay;
+
+    evt->Func = func;
+    evt->Param = param;
+
+    SchedListMask |= (1<<id);
+}
+
+__attribute__((noinline)) u64 NextTarget()
+{
+    u64 ret = SysTimestamp + NDS::kMaxIterationCycles;
+
+    u32 mask = SchedListMask;
+    for (int i = 0; i < NDS::Event_MAX; i++)
+    {
+        if (!mask) break;
+        if (mask & 0x1)
+        {
+            if (SchedList[i].Timestamp < ret)
+                ret = SchedList[i].Timestamp;
+        }
+
+        mask >>= 1;
+    }
+
+    return ret;
+}
+
+__attribute__((noinline)) void RunSystem(u64 timestamp)
+{
+    SysTimestamp = timestamp;
+
+    u32 mask = SchedListMask;
+    for (int i = 0; i < NDS::Event_MAX; i++)
+    {
+        if (!mask) break;
+        if (mask & 0x1)
+        {
+            if (SchedList[i].Timestamp <= SysTimestamp)
+            {
+                SchedListMask &= ~(1<<i);
+                SchedList[i].Func(SchedList[i].Param);
+            }
+        }
+
+        mask >>= 1;
+    }
+}
+
+void Tick(u32 id)
+{
+    ScheduleEvent(id, true, CurScenario->Periods[id], Tick, id);
+}
+
+double Run()
+{
+    SchedListMask = 0;
+    SysTimestamp = 0;
+    for (int i = 0; i < CurScenario->NumEvents; i++)
+        ScheduleEvent(i, false, CurScenario->Periods[i], Tick, i);
+
+    auto start = std::chrono::steady_clock::now();
+    for (u32 i = 0; i < kNumSlices; i++)
+        RunSystem(NextTarget());
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+}
+
+namespace Heap
+{
+
+void Tick(u32 id)
+{
+    NDS::ScheduleEvent(id, true, CurScenario->Periods[id], Tick, id);
+}
+
+double Run()
+{
+    for (int i = 0; i < NDS::Event_MAX; i++)
+        NDS::CancelEvent(i);
+
+    // the events are scheduled relative to the ARM9's time, it has
+    // to be the current time of the previous run
+    NDS::CurCPU = 0;
+    NDS::ARM9Timestamp = (NDS::NextTarget() - NDS::kMaxIterationCycles) << NDS::ARM9ClockShift;
+
+    for (int i = 0; i < CurScenario->NumEvents; i++)
+        NDS::ScheduleEvent(i, false, CurScenario->Periods[i], Tick, i);
+
+    auto start = std::chrono::steady_clock::now();
+    for (u32 i = 0; i < kNumSlices; i++)
+        NDS::RunSystem(NDS::NextTarget());
+    auto end = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < NDS::Event_MAX; i++)
+        NDS::CancelEvent(i);
+
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+}
+
+void Run()
+{
+    printf("scheduler benchmark, %u slices per run\n", kNumSlices);
+
+    for (const Scenario& scenario : Scenarios)
+    {
+        CurScenario = &scenario;
+
+        double scan = Scan::Run();
+        double heap = Heap::Run();
+
+        printf("%-10s  scan: %6.2f ns/slice  heap: %6.2f ns/slice\n",
+            scenario.Name, scan / kNumSlices, heap / kNumSlices);
+    }
+}
+
+}
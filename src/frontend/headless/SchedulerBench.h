@@ -0,0 +1,32 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+#ifndef SCHEDULERBENCH_H
+#define SCHEDULERBENCH_H
+
+namespace SchedulerBench
+{
+
+// prints the time per main loop slice of the scheduler and of the
+// linear scan it replaced. NDS::Init has to be called before, the
+// console mustn't have been started since
+void Run();
+
+}
+
+#endif // SCHEDULERBENCH_H
@@ -0,0 +1,137 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// self test of the vectorised 2D loops (--selftest-2d)
+// two 2D engines, one with the scalar loops forced, run the color effects,
+// master brightness and BGRA conversion on the same random lines
+
+#include <stdio.h>
+#include <string.h>
+
+#include "Selftest2D.h"
+#include "GPU2D.h"
+
+namespace Selftest2D
+{
+
+const u32 kNumLines = 100000;
+const u32 kMaxReported = 8;
+
+u32 RandomState;
+
+u32 Random()
+{
+    // xorshift32, so that every run tests the same lines
+    RandomState ^= RandomState << 13;
+    RandomState ^= RandomState >> 17;
+    RandomState ^= RandomState << 5;
+    return RandomState;
+}
+
+// a pixel like the ones the layers put into BGOBJLine
+u32 RandomPixel()
+{
+    u32 color = Random() & 0x3F3F3F;
+    u32 r = Random();
+
+    u32 flag;
+    switch (r % 6)
+    {
+    case 0: flag = 1 << ((r >> 8) & 0x3); break; // BG
+    case 1: flag = 0x20; break; // backdrop
+    case 2: flag = 0x10; break; // sprite
+    case 3: flag = 0x80; break; // semi-transparent sprite
+    case 4: flag = 0xC0 | ((r >> 8) & 0xF); break; // bitmap sprite
+    default: flag = 0x40 | ((r >> 8) & 0x1F); break; // 3D
+    }
+
+    return color | (flag << 24);
+}
+
+bool Run()
+{
+    if (!GPU2D_Composite::Get())
+    {
+        printf("2D self test: there are no vectorised loops on this host, nothing to compare\n");
+        return true;
+    }
+
+    printf("2D self test: comparing %s to the scalar loops on %u lines\n",
+        GPU2D_Composite::Get()->Name, kNumLines);
+
+    GPU2D_Soft* vec = new GPU2D_Soft(0);
+    GPU2D_Soft* scalar = new GPU2D_Soft(0);
+    vec->SetRenderSettings(false, false);
+    scalar->SetRenderSettings(false, true);
+
+    RandomState = 0x2D2D2D2D;
+
+    u32 input[512];
+    u32 lineVec[512], lineScalar[512];
+    u8 windowMask[256];
+    u32 numWrong = 0;
+
+    for (u32 l = 0; l < kNumLines; l++)
+    {
+        for (int i = 0; i < 512; i++)
+            input[i] = RandomPixel();
+        for (int i = 0; i < 256; i++)
+            windowMask[i] = Random();
+
+        // EVA, EVB and EVY are clamped to 16 when BLDALPHA/BLDY are written
+        u16 blendCnt = Random() & 0x3FFF;
+        u8 eva = Random() % 17;
+        u8 evb = Random() % 17;
+        u8 evy = Random() % 17;
+        u16 masterBrightness = Random() & 0xC01F;
+
+        memcpy(lineVec, input, sizeof(input));
+        memcpy(lineScalar, input, sizeof(input));
+        vec->CompositeTestLine(lineVec, windowMask, blendCnt, eva, evb, evy, masterBrightness);
+        scalar->CompositeTestLine(lineScalar, windowMask, blendCnt, eva, evb, evy, masterBrightness);
+
+        for (int i = 0; i < 256; i++)
+        {
+            if (lineVec[i] == lineScalar[i])
+                continue;
+
+            if (numWrong < kMaxReported)
+            {
+                printf("line %u pixel %d: %08X instead of %08X (pixels %08X %08X, window %02X, "
+                    "BLDCNT %04X, EVA %d, EVB %d, EVY %d, brightness %04X)\n",
+                    l, i, lineVec[i], lineScalar[i], input[i], input[256+i], windowMask[i],
+                    blendCnt, eva, evb, evy, masterBrightness);
+            }
+            numWrong++;
+        }
+    }
+
+    delete vec;
+    delete scalar;
+
+    if (numWrong)
+    {
+        printf("2D self test: %u pixels differ\n", numWrong);
+        return false;
+    }
+
+    printf("2D self test: all pixels match\n");
+    return true;
+}
+
+}
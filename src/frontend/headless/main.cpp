@@ -0,0 +1,410 @@
+/*
+    Copyright 2016-2020 Arisotura
+
+    This file is part of melonDS.
+
+    melonDS is free software: you can redistribute it and/or modify it under
+    the terms of the GNU General Public License as published by the Free
+    Software Foundation, either version 3 of the License, or (at your option)
+    any later version.
+
+    melonDS is distributed in the hope that it will be useful, but WITHOUT ANY
+    WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+    FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with melonDS. If not, see http://www.gnu.org/licenses/.
+*/
+
+// headless runner
+// runs the core as fast as possible for a fixed amount of frames, without
+// any display or audio output. meant for batch regression and benchmark runs.
+//
+// input file format: one entry per line, '#' starts a comment
+//   <frame> <keys> [<touchX> <touchY>]
+// * frame: frame number at which the entry takes effect
+// * keys: hex mask of the pressed keys, in KEYINPUT order
+//   (A B Select Start Right Left Up Down R L X Y)
+// * touchX/touchY: if present, the touchscreen is pressed at that position
+// entries must be sorted by frame. an entry stays in effect until the next one.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+#include <vector>
+
+#include "Platform.h"
+#include "PlatformConfig.h"
+#include "FrontendUtil.h"
+#include "SchedulerBench.h"
+#include "Selftest2D.h"
+
+#include "NDS.h"
+#include "GPU.h"
+#include "SPU.h"
+#include "CRC32.h"
+#include "FrameProfiler.h"
+#ifdef JIT_ENABLED
+#include "ARMJIT.h"
+#endif
+#include "version.h"
+
+
+struct InputEntry
+{
+    u32 Frame;
+    u32 Keys;
+    bool Touch;
+    u16 TouchX, TouchY;
+};
+
+bool EmuStopped = false;
+
+
+void emuStop()
+{
+    EmuStopped = true;
+}
+
+
+void printUsage(const char* exe)
+{
+    printf("usage: %s [options] [rom.nds]\n\n", exe);
+    printf("without a ROM, the console firmware is booted\n\n");
+    printf("options:\n");
+    printf("  --bios9 <path>         ARM9 BIOS\n");
+    printf("  --bios7 <path>         ARM7 BIOS\n");
+    printf("  --firmware <path>      firmware\n");
+    printf("  --dsi                  run in DSi mode\n");
+    printf("  --dsi-bios9 <path>     DSi ARM9 BIOS\n");
+    printf("  --dsi-bios7 <path>     DSi ARM7 BIOS\n");
+    printf("  --dsi-firmware <path>  DSi firmware\n");
+    printf("  --dsi-nand <path>      DSi NAND\n");
+    printf("  --gba <path>           GBA ROM to insert in slot 2\n");
+    printf("  --frames <n>           number of frames to run (default: 600)\n");
+    printf("  --input <path>         input file\n");
+    printf("  --no-direct-boot       boot the ROM through the firmware\n");
+    printf("  --threaded-3d          run the software 3D renderer on its own thread\n");
+    printf("  --threaded-2d          draw the two 2D engines on separate threads\n");
+    printf("  --scalar-2d            don't use the vectorised 2D loops\n");
+    printf("  --skip-idle            skip interpreter idle loops and periods where both CPUs are halted\n");
+    printf("  --bios-hle             perform some BIOS calls natively instead of running the BIOS\n");
+    printf("  --bios-hle-validate    run the BIOS calls but report where they differ from --bios-hle\n");
+#ifdef JIT_ENABLED
+    printf("  --jit                  enable the JIT recompiler\n");
+    printf("  --cached-interp        use the cached interpreter when the JIT is disabled\n");
+    printf("  --jit-cache            load and save compiled JIT code next to the ROM\n");
+    printf("  --jit-async            compile JIT blocks on a separate thread\n");
+    printf("  --jit-cache-size <mb>  size of the JIT code memory (4-128 MB)\n");
+    printf("  --jit-perf-map         write /tmp/perf-<pid>.map for profiling JIT code with perf\n");
+    printf("  --jit-dump             also write jitdump records to /tmp/jit-<pid>.dump\n");
+    printf("  --jit-no-hot-loops     don't compile hot loops so that they run without the dispatcher\n");
+    printf("  --jit-no-bulk-loops    run memory copy and fill loops one iteration at a time\n");
+#endif
+    printf("  --report <n>           print progress every n frames\n");
+    printf("  --bench-scheduler      compare the scheduler to a linear scan and exit\n");
+    printf("  --selftest-2d          compare the vectorised 2D loops to the scalar ones and exit\n");
+#ifdef FRAMEPROFILER_ENABLED
+    printf("  --profile <n>          print a frame time profile every n frames\n");
+#endif
+}
+
+bool loadInputFile(const char* path, std::vector<InputEntry>& entries)
+{
+    FILE* f = fopen(path, "r");
+    if (!f)
+    {
+        printf("could not open input file %s\n", path);
+        return false;
+    }
+
+    char linebuf[256];
+    int lineno = 0;
+    while (fgets(linebuf, sizeof(linebuf), f))
+    {
+        lineno++;
+
+        char* comment = strchr(linebuf, '#');
+        if (comment) *comment = '\0';
+
+        u32 frame, keys, tx, ty;
+        int ret = sscanf(linebuf, "%u %x %u %u", &frame, &keys, &tx, &ty);
+        if (ret <= 0) continue;
+        if (ret < 2 || ret == 3)
+        {
+            printf("input file: bad entry at line %d\n", lineno);
+            fclose(f);
+            return false;
+        }
+        if (!entries.empty() && frame < entries.back().Frame)
+        {
+            printf("input file: entries not sorted at line %d\n", lineno);
+            fclose(f);
+            return false;
+        }
+
+        InputEntry entry;
+        entry.Frame = frame;
+        entry.Keys = keys & 0xFFF;
+        entry.Touch = (ret == 4);
+        entry.TouchX = entry.Touch ? (tx > 255 ? 255 : tx) : 0;
+        entry.TouchY = entry.Touch ? (ty > 191 ? 191 : ty) : 0;
+        entries.push_back(entry);
+    }
+
+    fclose(f);
+    return true;
+}
+
+const char* loadErrorString(int res)
+{
+    switch (res)
+    {
+    case Frontend::Load_BIOS9Missing: return "DS ARM9 BIOS missing";
+    case Frontend::Load_BIOS9Bad: return "DS ARM9 BIOS invalid";
+    case Frontend::Load_BIOS7Missing: return "DS ARM7 BIOS missing";
+    case Frontend::Load_BIOS7Bad: return "DS ARM7 BIOS invalid";
+    case Frontend::Load_FirmwareMissing: return "DS firmware missing";
+    case Frontend::Load_FirmwareBad: return "DS firmware invalid";
+    case Frontend::Load_FirmwareNotBootable: return "DS firmware not bootable";
+    case Frontend::Load_DSiBIOS9Missing: return "DSi ARM9 BIOS missing";
+    case Frontend::Load_DSiBIOS9Bad: return "DSi ARM9 BIOS invalid";
+    case Frontend::Load_DSiBIOS7Missing: return "DSi ARM7 BIOS missing";
+    case Frontend::Load_DSiBIOS7Bad: return "DSi ARM7 BIOS invalid";
+    case Frontend::Load_DSiNANDMissing: return "DSi NAND missing";
+    case Frontend::Load_DSiNANDBad: return "DSi NAND invalid";
+    case Frontend::Load_ROMLoadError: return "failed to load ROM";
+    default: return "unknown error";
+    }
+}
+
+void setPath(char* dst, const char* src)
+{
+    strncpy(dst, src, 1023);
+    dst[1023] = '\0';
+}
+
+int main(int argc, char** argv)
+{
+    srand(time(NULL));
+
+    printf("melonDS " MELONDS_VERSION " (headless)\n");
+    printf(MELONDS_URL "\n");
+
+    Platform::Init(argc, argv);
+    Config::Load();
+
+    const char* romPath = nullptr;
+    const char* gbaPath = nullptr;
+    const char* inputPath = nullptr;
+    u32 numFrames = 600;
+    u32 reportInterval = 0;
+    u32 profileInterval = 0;
+    bool benchScheduler = false;
+    bool selftest2D = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        bool hasval = (i+1) < argc;
+
+#define PATH_ARG(name, dst) \
+        if (!strcmp(arg, name) && hasval) { setPath(dst, argv[++i]); continue; }
+
+        PATH_ARG("--bios9", Config::BIOS9Path)
+        PATH_ARG("--bios7", Config::BIOS7Path)
+        PATH_ARG("--firmware", Config::FirmwarePath)
+        PATH_ARG("--dsi-bios9", Config::DSiBIOS9Path)
+        PATH_ARG("--dsi-bios7", Config::DSiBIOS7Path)
+        PATH_ARG("--dsi-firmware", Config::DSiFirmwarePath)
+        PATH_ARG("--dsi-nand", Config::DSiNANDPath)
+
+#undef PATH_ARG
+
+        if (!strcmp(arg, "--gba") && hasval) gbaPath = argv[++i];
+        else if (!strcmp(arg, "--frames") && hasval) numFrames = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(arg, "--input") && hasval) inputPath = argv[++i];
+        else if (!strcmp(arg, "--report") && hasval) reportInterval = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(arg, "--bench-scheduler")) benchScheduler = true;
+        else if (!strcmp(arg, "--selftest-2d")) selftest2D = true;
+        else if (!strcmp(arg, "--dsi")) Config::ConsoleType = 1;
+        else if (!strcmp(arg, "--no-direct-boot")) Config::DirectBoot = 0;
+        else if (!strcmp(arg, "--threaded-3d")) Config::Threaded3D = 1;
+        else if (!strcmp(arg, "--threaded-2d")) Config::Threaded2D = 1;
+        else if (!strcmp(arg, "--scalar-2d")) Config::Scalar2D = 1;
+        else if (!strcmp(arg, "--skip-idle")) Config::SkipIdle = 1;
+        else if (!strcmp(arg, "--bios-hle")) Config::BIOS_HLE = 1;
+        else if (!strcmp(arg, "--bios-hle-validate")) Config::BIOS_HLE = 2;
+#ifdef JIT_ENABLED
+        else if (!strcmp(arg, "--jit")) Config::JIT_Enable = 1;
+        else if (!strcmp(arg, "--cached-interp")) Config::JIT_CachedInterpreter = 1;
+        else if (!strcmp(arg, "--jit-cache")) Config::JIT_PersistentCache = 1;
+        else if (!strcmp(arg, "--jit-async")) Config::JIT_AsyncCompile = 1;
+        else if (!strcmp(arg, "--jit-cache-size") && hasval) Config::JIT_CodeCacheSize = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(arg, "--jit-perf-map")) Config::JIT_PerfMap = 1;
+        else if (!strcmp(arg, "--jit-dump")) Config::JIT_PerfMap = 2;
+        else if (!strcmp(arg, "--jit-no-hot-loops")) Config::JIT_HotLoops = 0;
+        else if (!strcmp(arg, "--jit-no-bulk-loops")) Config::JIT_BulkLoops = 0;
+#endif
+#ifdef FRAMEPROFILER_ENABLED
+        else if (!strcmp(arg, "--profile") && hasval) profileInterval = strtoul(argv[++i], NULL, 10);
+#endif
+        else if (!strcmp(arg, "--help") || !strcmp(arg, "-h"))
+        {
+            printUsage(argv[0]);
+            Platform::DeInit();
+            return 0;
+        }
+        else if (arg[0] != '-' && !romPath) romPath = arg;
+        else
+        {
+            printf("unknown or incomplete option: %s\n\n", arg);
+            printUsage(argv[0]);
+            Platform::DeInit();
+            return 1;
+        }
+    }
+
+    std::vector<InputEntry> input;
+    if (inputPath && !loadInputFile(inputPath, input))
+    {
+        Platform::DeInit();
+        return 1;
+    }
+
+    NDS::Init();
+
+    if (benchScheduler)
+    {
+        SchedulerBench::Run();
+
+        NDS::DeInit();
+        Platform::DeInit();
+        return 0;
+    }
+
+    if (selftest2D)
+    {
+        bool ok = Selftest2D::Run();
+
+        NDS::DeInit();
+        Platform::DeInit();
+        return ok ? 0 : 1;
+    }
+
+    GPU::RenderSettings videoSettings;
+    videoSettings.Soft_Threaded = Config::Threaded3D != 0;
+    videoSettings.Threaded2D = Config::Threaded2D != 0;
+    videoSettings.Scalar2D = Config::Scalar2D != 0;
+    videoSettings.GL_ScaleFactor = 1;
+    videoSettings.GL_BetterPolygons = false;
+    GPU::InitRenderer(0);
+    GPU::SetRenderSettings(0, videoSettings);
+
+    Frontend::Init_ROM();
+
+    int res;
+    if (romPath)
+    {
+        res = Frontend::LoadROM(romPath, Frontend::ROMSlot_NDS);
+        if (res == Frontend::Load_OK && gbaPath)
+            res = Frontend::LoadROM(gbaPath, Frontend::ROMSlot_GBA);
+    }
+    else
+        res = Frontend::LoadBIOS();
+
+    if (res != Frontend::Load_OK)
+    {
+        printf("failed to start emulation: %s\n", loadErrorString(res));
+
+        Frontend::DeInit_ROM();
+        GPU::DeInitRenderer();
+        NDS::DeInit();
+        Platform::DeInit();
+        return 1;
+    }
+
+#ifdef FRAMEPROFILER_ENABLED
+    FrameProfiler::SetReportInterval(profileInterval);
+#endif
+
+    int nextInput = 0;
+    u64 totalLines = 0;
+    u32 frame = 0;
+
+    auto startTime = std::chrono::steady_clock::now();
+    auto lastReportTime = startTime;
+
+    for (frame = 0; frame < numFrames && !EmuStopped; frame++)
+    {
+        bool inputChanged = false;
+        while (nextInput < (int)input.size() && input[nextInput].Frame <= frame)
+        {
+            nextInput++;
+            inputChanged = true;
+        }
+
+        if (inputChanged)
+        {
+            InputEntry& entry = input[nextInput-1];
+
+            NDS::SetKeyMask(~entry.Keys & 0xFFF);
+            if (entry.Touch)
+                NDS::TouchScreen(entry.TouchX, entry.TouchY);
+            else
+                NDS::ReleaseScreen();
+        }
+
+        totalLines += NDS::RunFrame();
+
+        // nobody is consuming the audio, keep the buffer from overflowing
+        SPU::DrainOutput();
+
+        if (reportInterval && ((frame+1) % reportInterval) == 0)
+        {
+            auto now = std::chrono::steady_clock::now();
+            double dt = std::chrono::duration<double>(now - lastReportTime).count();
+            lastReportTime = now;
+
+            printf("frame %u: %.1f fps\n", frame+1, reportInterval / dt);
+        }
+    }
+
+    auto endTime = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(endTime - startTime).count();
+
+    u32 fbcrc[2] = {0, 0};
+    int frontbuf = GPU::FrontBuffer;
+    if (GPU::Framebuffer[frontbuf][0] && GPU::Framebuffer[frontbuf][1])
+    {
+        fbcrc[0] = CRC32((u8*)GPU::Framebuffer[frontbuf][0], 256*192*4);
+        fbcrc[1] = CRC32((u8*)GPU::Framebuffer[frontbuf][1], 256*192*4);
+    }
+
+    printf("ran %u frames (%llu scanlines) in %.3f s: %.1f fps\n",
+           frame, (unsigned long long)totalLines, elapsed,
+           elapsed > 0 ? frame / elapsed : 0.0);
+    printf("framebuffer CRC: %08X %08X\n", fbcrc[0], fbcrc[1]);
+
+#ifdef JIT_ENABLED
+    if (Config::JIT_Enable)
+    {
+        ARMJIT::CodeCacheStats stats;
+        ARMJIT::GetCodeCacheStats(&stats);
+        printf("JIT code cache: %u/%u KB used, %u blocks (%u loops), %u evictions (%u blocks), %u resets\n",
+               stats.Used / 1024, stats.Size / 1024, stats.NumBlocks, stats.NumLoops,
+               stats.NumEvictions, stats.NumEvictedBlocks, stats.NumResets);
+    }
+
+    Frontend::SaveJITCache();
+#endif
+
+    Frontend::DeInit_ROM();
+    GPU::DeInitRenderer();
+    NDS::DeInit();
+    Platform::DeInit();
+
+    return 0;
+}
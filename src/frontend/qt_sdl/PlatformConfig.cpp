@@ -49,6 +49,8 @@ int ScreenVSyncInterval;
 
 int _3DRenderer;
 int Threaded3D;
+int Threaded2D;
+int Scalar2D;
 
 int GL_ScaleFactor;
 int GL_BetterPolygons;
@@ -145,6 +147,8 @@ ConfigEntry PlatformConfigFile[] =
 
     {"3DRenderer", 0, &_3DRenderer, 0, NULL, 0},
     {"Threaded3D", 0, &Threaded3D, 1, NULL, 0},
+    {"Threaded2D", 0, &Threaded2D, 0, NULL, 0},
+    {"Scalar2D", 0, &Scalar2D, 0, NULL, 0},
 
     {"GL_ScaleFactor", 0, &GL_ScaleFactor, 1, NULL, 0},
     {"GL_BetterPolygons", 0, &GL_BetterPolygons, 0, NULL, 0},
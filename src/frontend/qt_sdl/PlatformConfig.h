@@ -63,6 +63,8 @@ extern int ScreenVSyncInterval;
 
 extern int _3DRenderer;
 extern int Threaded3D;
+extern int Threaded2D;
+extern int Scalar2D;
 
 extern int GL_ScaleFactor;
 extern int GL_BetterPolygons;
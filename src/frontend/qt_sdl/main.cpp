@@ -336,6 +336,8 @@ void EmuThread::run()
 
     videoSettingsDirty = false;
     videoSettings.Soft_Threaded = Config::Threaded3D != 0;
+    videoSettings.Threaded2D = Config::Threaded2D != 0;
+    videoSettings.Scalar2D = Config::Scalar2D != 0;
     videoSettings.GL_ScaleFactor = Config::GL_ScaleFactor;
 
 #ifdef OGLRENDERER_ENABLED
@@ -420,6 +422,8 @@ void EmuThread::run()
                 videoSettingsDirty = false;
 
                 videoSettings.Soft_Threaded = Config::Threaded3D != 0;
+                videoSettings.Threaded2D = Config::Threaded2D != 0;
+                videoSettings.Scalar2D = Config::Scalar2D != 0;
                 videoSettings.GL_ScaleFactor = Config::GL_ScaleFactor;
                 videoSettings.GL_BetterPolygons = Config::GL_BetterPolygons;
 
@@ -555,6 +559,10 @@ void EmuThread::run()
 
     EmuStatus = 0;
 
+#ifdef JIT_ENABLED
+    Frontend::SaveJITCache();
+#endif
+
     GPU::DeInitRenderer();
     NDS::DeInit();
     //Platform::LAN_DeInit();